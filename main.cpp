@@ -1,13 +1,27 @@
+#include "src/AsyncLogger.h"
+#include "src/Compression.h"
 #include "src/IServer.h"
 #include "src/Logger.h"
+#include "src/MetricsServer.h"
 #include "src/ServerImpEpoll.h"
+#include "src/ServerImpIoUring.h"
+#include "src/ServerImpMultiEpoll.h"
+#include <algorithm>
 #include <csignal>
+#include <cstdlib>
 #include <iostream>
 #include <memory>
+#include <unistd.h>
+
+// the most event loop threads --threads accepts
+#define MAX_THREADS 256
 
 using ServerImp = ServerEpoll;
+using MultiServerImp = ServerMultiEpoll;
+using IoUringServerImp = ServerIoUring;
 
 std::shared_ptr<IServer> g_server;
+ClientLogger::pointer g_logger;
 
 void sigHandler(int sig) {
   std::cout << "\nSignal " << sig << " received, stopping the server ..."
@@ -15,15 +29,108 @@ void sigHandler(int sig) {
   g_server->stop();
 }
 
+void bypassHandler(int) {
+  // toggles full logging, e.g. for the time of an incident. only an atomic
+  // and write(2) here, the streams are not async-signal-safe
+  static const char off[] = "\nlogging policy off\n";
+  static const char on[] = "\nlogging policy on\n";
+  bool bypassed = g_logger->getLogPolicy().toggleBypass();
+  ssize_t written = bypassed ? write(STDOUT_FILENO, off, sizeof(off) - 1)
+                             : write(STDOUT_FILENO, on, sizeof(on) - 1);
+  (void)written; // nothing to do about a failed report
+}
+
+void usage() {
+  std::cout << "./ProxyServer localIP localPort remoteIP remotePort logPath "
+               "[options]\n"
+            << "localIP: is the ip (IPv4) of this server.\n"
+            << "localPort: is the port for this server.\n"
+            << "remoteIP: is the ip (IPv4) for the postgresql server.\n"
+            << "remotePort: is the port for the postgresql server.\n"
+            << "logPath: is the path for the log file.\n"
+            << "options:\n"
+            << "  --threads N: number of event loop threads sharing the "
+               "local port (default 1, at most 256).\n"
+            << "  --io-uring: one event loop driven by io_uring (no --threads, "
+               "--splice, --pool or --replica).\n"
+            << "  --splice: relay the responses with splice() (zero copy).\n"
+            << "  --huge-pages: back the session buffers with huge pages.\n"
+            << "  --connect-timeout MS: close a client when the connection to "
+               "the postgresql server takes longer (default 10000, 0 for "
+               "none).\n"
+            << "  --backlog N: the length of the accept queue (default "
+               "4096).\n"
+            << "  --max-clients N: the number of clients served at once per "
+               "thread, the others wait in the accept queue (default 0: no "
+               "limit).\n"
+            << "  --reject-over-limit: reject the clients over --max-clients "
+               "with a too_many_connections error instead.\n"
+            << "  --accept-batch N: the connections accepted per loop "
+               "iteration (default 64).\n"
+            << "  --pool N: share N connections per user/database (per "
+               "thread) between the clients, one per transaction.\n"
+            << "  --async-log: write the log from a dedicated thread.\n"
+            << "  --log-queue N: the number of records the async log queue "
+               "holds (default 65536).\n"
+            << "  --log-overflow block|drop: what to do when the async log "
+               "queue is full (default block).\n"
+            << "  --log-segment-size BYTES: write the async log to memory "
+               "mapped segments (logPath.date.N) of this size.\n"
+            << "  --log-segment-time SECONDS: also roll the segments after "
+               "this time (with --log-segment-size).\n"
+            << "  --log-format text|binary: the format of the async log "
+               "(default text), see LogDecoder.\n"
+            << "  --log-compress: compress the async log in blocks (LZ4 "
+               "style), see LogDecompress, the segments must hold a frame "
+               "(262156 bytes).\n"
+            << "  --log-statements: log each Execute once with the query of "
+               "its prepared statement and its parameters.\n"
+            << "  --stats-file PATH: aggregate the queries per fingerprint "
+               "and write snapshots to this file.\n"
+            << "  --stats-interval SECONDS: the time between two snapshots "
+               "(default 60).\n"
+            << "  --stats-only: only write the stats, not the queries.\n"
+            << "  --log-types LETTERS: the message types logged (default "
+               "QBPDECF).\n"
+            << "  --log-sample N: log 1 request in N of each client.\n"
+            << "  --log-sample-rate P: log a request with the probability P "
+               "(0 < P <= 1).\n"
+            << "  --log-rate N: log at most N messages per second.\n"
+            << "  --log-client-rate N: log at most N messages per second per "
+               "client.\n"
+            << "  --log-always ddl,errors|none: what is logged whatever the "
+               "sampling and the rates (default ddl,errors), SIGUSR1 "
+               "toggles logging everything.\n"
+            << "  --slow-query-log PATH: write the queries slower than "
+               "--slow-query-ms with their duration to this file.\n"
+            << "  --slow-query-ms MS: the slow query threshold (default "
+               "1000).\n"
+            << "  --cache-tables LIST: answer the SELECTs that only read these "
+               "comma separated tables from a result cache.\n"
+            << "  --cache-prefix TEXT: also cache the SELECTs starting with "
+               "this text (repeatable).\n"
+            << "  --cache-ttl MS: how long a result is served (default "
+               "5000).\n"
+            << "  --cache-size BYTES: the memory of the result cache (default "
+               "64 MiB), not with --splice.\n"
+            << "  --replica IP:PORT[:WEIGHT]: route the read only sessions "
+               "(default_transaction_read_only=on) to this replica, whole "
+               "sessions only (repeatable, not with --splice).\n"
+            << "  --balance least-conn|round-robin: how the read only sessions "
+               "are spread on the replicas (default least-conn), by weight.\n"
+            << "  --health-interval MS: the time between two health checks of "
+               "the servers (default 2000).\n"
+            << "  --health-fails N: the failed checks in a row that eject a "
+               "server (default 3).\n"
+            << "  --metrics ADDR: serve the metrics (Prometheus format) on "
+               "this unix socket path or loopback port."
+            << std::endl;
+}
+
 int main(int argc, char **argv) {
 
-  if (argc != 6) {
-    std::cout << "./ProxyServer localIP localPort remoteIP remotePort logPath\n"
-              << "localIP: is the ip (IPv4) of this server.\n"
-              << "localPort: is the port for this server.\n"
-              << "remoteIP: is the ip (IPv4) for the postgresql server.\n"
-              << "remotePort: is the port for the postgresql server.\n"
-              << "logPath: is the path for the log file." << std::endl;
+  if (argc < 6) {
+    usage();
     return 1;
   }
 
@@ -37,16 +144,233 @@ int main(int argc, char **argv) {
   std::string logPath(argv[5]);
   int localPort = atoi(argv[2]);
   int remotePort = atoi(argv[4]);
+  int threads = 1;
+  bool ioUring = false;
+  ServerOptions options;
+  bool asyncLog = false;
+  std::size_t logQueue = 65536;
+  auto overflow = AsyncQueryLogger::Overflow::BLOCK;
+  std::size_t segmentSize = 0;
+  time_t segmentTime = 0;
+  LogFormat format = LogFormat::TEXT;
+  bool compress = false;
+  bool trackStatements = false;
+  std::string statsPath;
+  time_t statsInterval = 60;
+  bool rawLines = true;
+  std::string metricsAddress;
+  std::string slowLogPath;
+  long slowQueryMs = 1000;
+  LogPolicyOptions policy;
+  ResultCacheOptions cache;
+  std::vector<BackendSet::Backend> replicas;
+  auto balance = BackendSet::Balance::LEAST_CONNECTIONS;
+  long healthInterval = 2000;
+  unsigned healthFails = 3;
+
+  for (int i = 6; i < argc; ++i) {
+    std::string opt(argv[i]);
+    if (opt == "--threads" && i + 1 < argc) {
+      char *end = nullptr;
+      long n = strtol(argv[++i], &end, 10);
+      if (end == argv[i] || *end != '\0' || n <= 0 || n > MAX_THREADS) {
+        usage();
+        return 1;
+      }
+      threads = int(n);
+    } else if (opt == "--io-uring") {
+      ioUring = true;
+    } else if (opt == "--splice") {
+      options.splice = true;
+    } else if (opt == "--huge-pages") {
+      options.hugePages = true;
+    } else if (opt == "--connect-timeout" && i + 1 < argc) {
+      options.connectTimeout = atol(argv[++i]);
+    } else if (opt == "--backlog" && i + 1 < argc) {
+      options.backlog = atoi(argv[++i]);
+    } else if (opt == "--max-clients" && i + 1 < argc) {
+      options.maxClients = atol(argv[++i]);
+    } else if (opt == "--reject-over-limit") {
+      options.rejectOverLimit = true;
+    } else if (opt == "--accept-batch" && i + 1 < argc) {
+      options.acceptBatch = std::max(atol(argv[++i]), 1L);
+    } else if (opt == "--pool" && i + 1 < argc) {
+      options.poolSize = atol(argv[++i]);
+    } else if (opt == "--async-log") {
+      asyncLog = true;
+    } else if (opt == "--log-queue" && i + 1 < argc) {
+      logQueue = atol(argv[++i]);
+    } else if (opt == "--log-overflow" && i + 1 < argc &&
+               (argv[i + 1] == std::string("block") ||
+                argv[i + 1] == std::string("drop"))) {
+      overflow = argv[++i] == std::string("drop")
+                     ? AsyncQueryLogger::Overflow::DROP
+                     : AsyncQueryLogger::Overflow::BLOCK;
+    } else if (opt == "--log-segment-size" && i + 1 < argc) {
+      segmentSize = atol(argv[++i]);
+      asyncLog = true;
+    } else if (opt == "--log-segment-time" && i + 1 < argc) {
+      segmentTime = atol(argv[++i]);
+    } else if (opt == "--log-format" && i + 1 < argc &&
+               (argv[i + 1] == std::string("text") ||
+                argv[i + 1] == std::string("binary"))) {
+      format = argv[++i] == std::string("binary") ? LogFormat::BINARY
+                                                  : LogFormat::TEXT;
+      asyncLog = true;
+    } else if (opt == "--log-compress") {
+      compress = true;
+      asyncLog = true;
+    } else if (opt == "--log-statements") {
+      trackStatements = true;
+    } else if (opt == "--stats-file" && i + 1 < argc) {
+      statsPath = argv[++i];
+    } else if (opt == "--stats-interval" && i + 1 < argc) {
+      statsInterval = atol(argv[++i]);
+    } else if (opt == "--stats-only") {
+      rawLines = false;
+    } else if (opt == "--metrics" && i + 1 < argc) {
+      metricsAddress = argv[++i];
+    } else if (opt == "--log-types" && i + 1 < argc) {
+      policy.types = argv[++i];
+    } else if (opt == "--log-sample" && i + 1 < argc) {
+      policy.sampleEvery = std::max(atol(argv[++i]), 1L);
+    } else if (opt == "--log-sample-rate" && i + 1 < argc) {
+      policy.sampleRate = atof(argv[++i]);
+    } else if (opt == "--log-rate" && i + 1 < argc) {
+      policy.rate = atof(argv[++i]);
+    } else if (opt == "--log-client-rate" && i + 1 < argc) {
+      policy.clientRate = atof(argv[++i]);
+    } else if (opt == "--log-always" && i + 1 < argc) {
+      std::string always(argv[++i]);
+      policy.alwaysDDL = always.find("ddl") != std::string::npos;
+      policy.alwaysErrors = always.find("errors") != std::string::npos;
+    } else if (opt == "--cache-tables" && i + 1 < argc) {
+      std::string tables(argv[++i]);
+      for (std::size_t start = 0; start <= tables.size();) {
+        std::size_t end = std::min(tables.find(',', start), tables.size());
+        if (end > start)
+          cache.tables.push_back(tables.substr(start, end - start));
+        start = end + 1;
+      }
+    } else if (opt == "--cache-prefix" && i + 1 < argc) {
+      cache.prefixes.push_back(argv[++i]);
+    } else if (opt == "--cache-ttl" && i + 1 < argc) {
+      cache.ttl = std::max(atol(argv[++i]), 1L);
+    } else if (opt == "--cache-size" && i + 1 < argc) {
+      cache.maxBytes = atol(argv[++i]);
+    } else if (opt == "--replica" && i + 1 < argc) {
+      std::string replica(argv[++i]);
+      std::size_t colon = replica.find(':');
+      if (colon == std::string::npos) {
+        usage();
+        return 1;
+      }
+      std::size_t weight = replica.find(':', colon + 1);
+      replicas.push_back(BackendSet::Backend{
+          replica.substr(0, colon), atoi(replica.c_str() + colon + 1),
+          BackendSet::Role::REPLICA,
+          weight == std::string::npos
+              ? 1u
+              : unsigned(std::max(atoi(replica.c_str() + weight + 1), 1))});
+    } else if (opt == "--balance" && i + 1 < argc &&
+               (argv[i + 1] == std::string("least-conn") ||
+                argv[i + 1] == std::string("round-robin"))) {
+      balance = argv[++i] == std::string("round-robin")
+                    ? BackendSet::Balance::ROUND_ROBIN
+                    : BackendSet::Balance::LEAST_CONNECTIONS;
+    } else if (opt == "--health-interval" && i + 1 < argc) {
+      healthInterval = std::max(atol(argv[++i]), 1L);
+    } else if (opt == "--health-fails" && i + 1 < argc) {
+      healthFails = std::max(atoi(argv[++i]), 1);
+    } else if (opt == "--slow-query-log" && i + 1 < argc) {
+      slowLogPath = argv[++i];
+    } else if (opt == "--slow-query-ms" && i + 1 < argc) {
+      slowQueryMs = std::max(atol(argv[++i]), 0L);
+    } else {
+      usage();
+      return 1;
+    }
+  }
+  if (ioUring && (threads != 1 || options.splice || options.poolSize > 0 ||
+                  !replicas.empty())) {
+    usage();
+    return 1;
+  }
+  // the time only rolls segments, there are none without a size
+  if (segmentTime != 0 && segmentSize == 0) {
+    usage();
+    return 1;
+  }
+  // LogDecompress reads each segment on its own, a frame must fit in one
+  if (compress && segmentSize > 0 && segmentSize < COMPRESSED_FRAME_MAX) {
+    usage();
+    return 1;
+  }
+  bool cached = !cache.tables.empty() || !cache.prefixes.empty();
+  if ((cached || !replicas.empty()) && options.splice) {
+    usage();
+    return 1;
+  }
 
   try {
 
-    ClientLogger::pointer logger = std::make_shared<FileQueryLogger>(logPath);
+    QueryStats::uniq_ptr stats;
+    if (!statsPath.empty())
+      stats = std::make_unique<QueryStats>(statsPath, statsInterval);
 
-    g_server = std::make_shared<ServerImp>(localIP, localPort, remoteIP,
-                                           remotePort, logger);
+    ClientLogger::pointer logger;
+    if (asyncLog) {
+      LogSink::uniq_ptr sink;
+      if (segmentSize > 0)
+        sink = std::make_unique<SegmentSink>(logPath, segmentSize, segmentTime);
+      else
+        sink = std::make_unique<FileSink>(logPath);
+      if (compress)
+        sink = std::make_unique<CompressedSink>(std::move(sink));
+      logger = std::make_shared<AsyncQueryLogger>(
+          std::move(sink), logQueue, overflow, format, std::move(stats),
+          rawLines);
+    } else
+      logger = std::make_shared<FileQueryLogger>(logPath, true,
+                                                 std::move(stats), rawLines);
+    if (!slowLogPath.empty())
+      logger->setSlowQueryLog(
+          std::make_unique<SlowQueryLog>(slowLogPath, slowQueryMs * 1000));
+    logger->setLogPolicy(std::make_unique<LogPolicy>(policy));
+    logger->setStatementTracking(trackStatements);
+    g_logger = logger;
+    signal(SIGUSR1, bypassHandler);
+    if (cached)
+      options.resultCache = std::make_shared<ResultCache>(cache);
+    if (!replicas.empty()) {
+      options.backends = std::make_shared<BackendSet>(
+          remoteIP, remotePort, balance, healthInterval, healthFails);
+      for (const auto &r : replicas)
+        options.backends->addReplica(r.ip, r.port, r.weight);
+      options.backends->start();
+    }
+
+    if (ioUring)
+      g_server = std::make_shared<IoUringServerImp>(
+          localIP, localPort, remoteIP, remotePort, logger, options);
+    else if (threads == 1)
+      g_server = std::make_shared<ServerImp>(localIP, localPort, remoteIP,
+                                             remotePort, logger, options);
+    else
+      g_server = std::make_shared<MultiServerImp>(
+          localIP, localPort, remoteIP, remotePort, logger, threads, options);
 
     std::cout << "init ..." << std::endl;
     g_server->init();
+
+    // after init(), the multi reactor server creates its reactors there
+    MetricsServer::uniq_ptr metrics;
+    if (!metricsAddress.empty()) {
+      metrics = std::make_unique<MetricsServer>(
+          metricsAddress, g_server->getMetrics(), logger,
+          options.resultCache, options.backends);
+      metrics->start();
+    }
     std::cout << "loop ..." << std::endl;
     g_server->loop();
   } catch (const std::exception &e) {
@@ -0,0 +1,353 @@
+#include "AsyncLogger.h"
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+AsyncQueryLogger::AsyncQueryLogger(LogSink::uniq_ptr sink,
+                                   const std::size_t queueSize,
+                                   const Overflow overflow,
+                                   const LogFormat format,
+                                   QueryStats::uniq_ptr stats,
+                                   const bool rawLines)
+    : ClientLogger(std::move(stats), rawLines), _sink(std::move(sink)),
+      _ring(queueSize), _overflow(overflow), _format(format) {
+  _iov.resize(LOG_BATCH_SIZE * 3);
+  _headerEnds.resize(LOG_BATCH_SIZE);
+  _writer = std::thread(&AsyncQueryLogger::writerLoop, this);
+}
+
+AsyncQueryLogger::~AsyncQueryLogger() {
+  _running = false;
+  {
+    std::lock_guard<std::mutex> lock(_wakeMutex);
+    _wakeCond.notify_one();
+  }
+  if (_writer.joinable())
+    _writer.join();
+
+  if (_dropped > 0)
+    std::cerr << _dropped << " log records were dropped" << std::endl;
+}
+
+void AsyncQueryLogger::log(const Client::pointer &c) {
+  bool pushed = false;
+  int64_t now = -1;
+  LogPolicy::Tally tally;
+
+  for (auto &m : c->getLastMessages()) {
+    const StatementCache::Portal *portal;
+    if (!track(c, m, portal) ||
+        !_policy->allow(m, c->logState(), tally,
+                        portal ? *portal->query : std::string_view()))
+      continue;
+
+    if (now == -1)
+      now = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::system_clock::now().time_since_epoch())
+                .count();
+
+    std::size_t pos;
+    LogRecord *r = reserve(pos);
+    if (r == nullptr)
+      continue;
+
+    if (portal) {
+      // the statement and the parameters are copied into the record
+      fill(*r, c, now, LOG_EXECUTE_TYPE, std::string_view());
+      StatementCache::describe(*portal, r->query);
+    } else
+      fill(*r, c, now, m.type, m.body);
+    _ring.publish(pos);
+    pushed = true;
+  }
+  _policy->commit(tally);
+
+  if (pushed)
+    wakeWriter();
+}
+
+void AsyncQueryLogger::logErrors(const Client::pointer &c) {
+  LogPolicy::Tally tally;
+  int64_t now = -1;
+
+  if (!_rawLines)
+    return;
+
+  for (auto &q : c->getCompletedQueries()) {
+    if (!q.failed)
+      continue;
+
+    if (now == -1)
+      now = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::system_clock::now().time_since_epoch())
+                .count();
+
+    std::size_t pos;
+    LogRecord *r = reserve(pos);
+    if (r == nullptr)
+      continue;
+
+    fill(*r, c, now, LOG_ERROR_TYPE, q.query);
+    _ring.publish(pos);
+    ++tally.forced;
+  }
+  _policy->commit(tally);
+
+  if (tally.forced > 0)
+    wakeWriter();
+}
+
+void AsyncQueryLogger::fill(LogRecord &r, const Client::pointer &c,
+                            int64_t timestamp, char type,
+                            std::string_view query) {
+  r.kind = LogRecord::Kind::MESSAGE;
+  r.clientID = c->getID();
+  r.timestamp = timestamp;
+  r.type = type;
+  if (_format == LogFormat::TEXT) {
+    std::strncpy(r.ip, c->getIP().c_str(), sizeof(r.ip) - 1);
+    r.ip[sizeof(r.ip) - 1] = '\0';
+  }
+  r.query.assign(query.data(), query.size());
+}
+
+void AsyncQueryLogger::connect(const Client::pointer &c) {
+  pushSession(c, LogRecord::Kind::SESSION);
+}
+
+void AsyncQueryLogger::disconnect(const Client::pointer &c) {
+  pushSession(c, LogRecord::Kind::END);
+}
+
+void AsyncQueryLogger::pushSession(const Client::pointer &c,
+                                   LogRecord::Kind kind) {
+  if (_format != LogFormat::BINARY || !_rawLines)
+    return;
+
+  std::size_t pos;
+  LogRecord *r = reserve(pos);
+  if (r == nullptr)
+    return;
+
+  r->kind = kind;
+  r->clientID = c->getID();
+  std::strncpy(r->ip, c->getIP().c_str(), sizeof(r->ip) - 1);
+  r->ip[sizeof(r->ip) - 1] = '\0';
+  r->query.clear();
+  _ring.publish(pos);
+  wakeWriter();
+}
+
+LogRecord *AsyncQueryLogger::reserve(std::size_t &pos) {
+  LogRecord *r;
+  while ((r = _ring.reserve(pos)) == nullptr &&
+         _overflow == Overflow::BLOCK) {
+    // the writer is late, give it the cpu
+    wakeWriter();
+    std::this_thread::yield();
+  }
+  if (r == nullptr)
+    ++_dropped;
+  return r;
+}
+
+std::size_t AsyncQueryLogger::getDropped() const { return _dropped; }
+
+std::size_t AsyncQueryLogger::getQueueDepth() const { return _ring.size(); }
+
+void AsyncQueryLogger::wakeWriter() {
+  if (_writerSleeping.load(std::memory_order_relaxed)) {
+    std::lock_guard<std::mutex> lock(_wakeMutex);
+    _wakeCond.notify_one();
+  }
+}
+
+void AsyncQueryLogger::writerLoop() {
+  time_t lastFlush = 0;
+  for (;;) {
+    time_t now = time(nullptr);
+    if (_stats)
+      _stats->maybeDump(now);
+    if (writeBatch() > 0)
+      continue;
+    // idle, what the sink buffered (a compressed block) is written at most
+    // once per second so the blocks stay big under a light load
+    if (now != lastFlush || !_running) {
+      if (!_sink->flush())
+        std::cerr << "log flush failed: " << strerror(errno) << std::endl;
+      lastFlush = now;
+    }
+    if (!_running)
+      break; // the ring is drained
+
+    std::unique_lock<std::mutex> lock(_wakeMutex);
+    _writerSleeping = true;
+    // the timeout covers a producer that checked the flag before it was set
+    if (_running && _ring.peek(0) == nullptr)
+      _wakeCond.wait_for(lock, std::chrono::milliseconds(100));
+    _writerSleeping = false;
+  }
+}
+
+std::size_t AsyncQueryLogger::writeBatch() {
+  std::size_t count = 0;
+  std::size_t first = 0;   // the first record not written yet
+  std::size_t queries = 0; // the bytes of its query and of the next ones
+  LogRecord *r;
+
+  // format what comes before the query of the ready records
+  _headers.clear();
+  while (count < LOG_BATCH_SIZE && (r = _ring.peek(count)) != nullptr) {
+    if (_stats && r->kind == LogRecord::Kind::MESSAGE)
+      _stats->record(r->type, r->query, r->timestamp / 1000000);
+    if (_rawLines && _format == LogFormat::TEXT)
+      formatText(*r);
+    else if (_rawLines)
+      formatBinary(*r);
+    _headerEnds[count] = _headers.size();
+    queries += r->query.size();
+
+    if (_rawLines && _format == LogFormat::BINARY) {
+      std::size_t pending = _headers.size() - headerBegin(first) + queries;
+      std::size_t bytes =
+          _headers.size() - headerBegin(count) + r->query.size();
+      // the records before end the current segment if they fit in it
+      if (first < count && !_sink->fits(pending) &&
+          _sink->fits(pending - bytes)) {
+        writeRecords(first, count);
+        first = count;
+        queries = r->query.size();
+        pending = bytes;
+      }
+      // a binary segment is readable on its own: the records that start one
+      // (after a roll here or an idle one) go after its header
+      if ((first == count || !_sink->fits(pending)) &&
+          (_sink->startSegment(pending) || !_headerWritten))
+        startSegment(first, count);
+    }
+    ++count;
+  }
+
+  if (count == 0)
+    return 0;
+
+  if (_rawLines)
+    writeRecords(first, count);
+  release(count);
+  return count;
+}
+
+void AsyncQueryLogger::writeRecords(std::size_t first, std::size_t end) {
+  // header, query (and new line) of each record, the queries are not copied
+  static char newLine = '\n';
+  int iovCount = 0;
+  for (std::size_t i = first; i < end; ++i) {
+    LogRecord *r = _ring.peek(i);
+    std::size_t start = headerBegin(i);
+    _iov[iovCount++] = {&_headers[start], _headerEnds[i] - start};
+    if (!r->query.empty())
+      _iov[iovCount++] = {r->query.data(), r->query.size()};
+    if (_format == LogFormat::TEXT)
+      _iov[iovCount++] = {&newLine, 1};
+  }
+
+  if (iovCount > 0 && !_sink->write(_iov.data(), iovCount)) {
+    std::cerr << "log write failed: " << strerror(errno) << std::endl;
+    _dropped += end - first;
+  }
+
+  // the sessions the next segment starts with
+  for (std::size_t i = first; _format == LogFormat::BINARY && i < end; ++i) {
+    LogRecord *r = _ring.peek(i);
+    if (r->kind == LogRecord::Kind::SESSION)
+      _sessions[r->clientID] = r->ip;
+    else if (r->kind == LogRecord::Kind::END)
+      _sessions.erase(r->clientID);
+  }
+}
+
+std::size_t AsyncQueryLogger::headerBegin(std::size_t i) const {
+  return i == 0 ? 0 : _headerEnds[i - 1];
+}
+
+void AsyncQueryLogger::startSegment(std::size_t first, std::size_t last) {
+  char buf[MAX_VARINT_SIZE * 2 + 1];
+
+  // the header and the sessions go before the first record
+  _headers.resize(headerBegin(first));
+  _headers.push_back(BINARY_LOG_HEADER);
+  _headers.append(BINARY_LOG_MAGIC);
+  _headers.push_back(BINARY_LOG_VERSION);
+  for (const auto &[id, ip] : _sessions) {
+    std::size_t n = 0;
+    buf[n++] = BINARY_LOG_SESSION;
+    n += putVarint(buf + n, id);
+    n += putVarint(buf + n, ip.size());
+    _headers.append(buf, n).append(ip);
+  }
+  _headerWritten = true;
+
+  // the first message of the segment holds its absolute timestamp
+  _lastTimestamp = 0;
+  for (std::size_t i = first; i <= last; ++i) {
+    formatBinary(*_ring.peek(i));
+    _headerEnds[i] = _headers.size();
+  }
+}
+
+void AsyncQueryLogger::release(std::size_t count) {
+  for (std::size_t i = 0; i < count; ++i) {
+    LogRecord *r = _ring.peek(i);
+    if (r->query.capacity() > LOG_RECORD_KEEP)
+      std::string().swap(r->query);
+  }
+  _ring.release(count);
+}
+
+void AsyncQueryLogger::formatText(const LogRecord &r) {
+  time_t second = r.timestamp / 1000000;
+  if (second != _lastSecond) {
+    std::tm tm_now;
+    localtime_r(&second, &tm_now);
+    std::strftime(_timeStr, sizeof(_timeStr), "%Y-%m-%d\t%X", &tm_now);
+    _lastSecond = second;
+  }
+
+  char id[16];
+  auto idEnd = std::to_chars(id, id + sizeof(id), r.clientID).ptr;
+  _headers.append(_timeStr)
+      .append("\t\t-\tIP: ")
+      .append(r.ip)
+      .append("\t-\tclient ")
+      .append(id, idEnd)
+      .append(": (")
+      .append(_messageTypes[(unsigned char)r.type])
+      .append(")\t\t");
+}
+
+void AsyncQueryLogger::formatBinary(const LogRecord &r) {
+  char buf[MAX_VARINT_SIZE * 3 + 2];
+  std::size_t n = 0;
+
+  if (r.kind == LogRecord::Kind::END)
+    return;
+
+  if (r.kind == LogRecord::Kind::SESSION) {
+    std::size_t ipLen = std::strlen(r.ip);
+    buf[n++] = BINARY_LOG_SESSION;
+    n += putVarint(buf + n, r.clientID);
+    n += putVarint(buf + n, ipLen);
+    _headers.append(buf, n).append(r.ip, ipLen);
+    return;
+  }
+
+  buf[n++] = BINARY_LOG_MESSAGE;
+  n += putVarint(buf + n, zigzag(r.timestamp - _lastTimestamp));
+  n += putVarint(buf + n, r.clientID);
+  buf[n++] = r.type;
+  n += putVarint(buf + n, r.query.size());
+  _headers.append(buf, n);
+  _lastTimestamp = r.timestamp;
+}
@@ -0,0 +1,221 @@
+#ifndef __ASYNC_LOGGER_HPP_
+#define __ASYNC_LOGGER_HPP_
+
+#include <arpa/inet.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <sys/uio.h>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "Client.h"
+#include "LogRing.h"
+#include "LogSink.h"
+#include "Logger.h"
+
+// the maximum number of records written by one writev
+#define LOG_BATCH_SIZE 256
+
+// the query capacity a slot of the ring keeps once it is written, the
+// buffers of bigger queries are freed so a burst does not stay resident
+#define LOG_RECORD_KEEP (std::size_t(16 * 1024))
+
+/*
+ * @brief a compact log record, pushed by the event loops into the ring and
+ * formatted by the writer thread.
+ */
+struct LogRecord {
+  enum class Kind {
+    MESSAGE,
+    SESSION, // a client connected (binary format)
+    END      // a client left (binary format), not written
+  };
+
+  Kind kind;
+  int clientID;
+  int64_t timestamp; // microseconds since the epoch
+  char type;         // the type of the message
+  char ip[INET_ADDRSTRLEN];
+  std::string query; // the body of the message, its capacity is reused
+};
+
+/*
+ * This is an asynchronous implementation of the client logger interface:
+ * log() only copies the query messages of the client into a bounded lock-free
+ * ring, a dedicated writer thread formats them in the same layout as
+ * FileQueryLogger (or in the binary format, see LogFormat.h) and writes them
+ * to the sink in batches (writev for a file), so a slow disk never stalls the
+ * event loops.
+ */
+class AsyncQueryLogger : public ClientLogger {
+
+public:
+  /*
+   * what log() does when the ring is full.
+   */
+  enum class Overflow {
+    BLOCK, // wait for the writer thread to free a slot
+    DROP   // drop the record and count it
+  };
+
+  /*
+   * @brief construct an asynchronous logger and starts its writer thread.
+   *
+   * @param sink where the writer thread writes (FileSink, SegmentSink).
+   * @param queueSize the number of records the ring can hold.
+   * @param overflow what to do when the ring is full.
+   * @param format the format of the log (text or binary).
+   * @param stats if not null the writer thread also aggregates the queries
+   * per fingerprint.
+   * @param rawLines false to only keep the stats.
+   */
+  AsyncQueryLogger(LogSink::uniq_ptr sink,
+                   const std::size_t queueSize = 65536,
+                   const Overflow overflow = Overflow::BLOCK,
+                   const LogFormat format = LogFormat::TEXT,
+                   QueryStats::uniq_ptr stats = nullptr,
+                   const bool rawLines = true);
+
+  /*
+   * @brief writes the records left in the ring, stops the writer thread and
+   * closes the sink.
+   */
+  ~AsyncQueryLogger();
+
+  /*
+   * @brief pushes each query message read from the client into the ring,
+   * thread safe (lock-free), never does any formatting nor I/O.
+   *
+   * @param c a pointer (shared pointer) to a client.
+   */
+  void log(const Client::pointer &c) override;
+
+  /*
+   * @brief in the binary format, pushes the session record (id and ip) of
+   * the client, the message records then only hold its id.
+   */
+  void connect(const Client::pointer &c) override;
+
+  /*
+   * @brief in the binary format, tells the writer thread the session is
+   * over, its record is not written again at the start of the next segments.
+   */
+  void disconnect(const Client::pointer &c) override;
+
+  /*
+   * @return the number of records dropped because the ring was full or the
+   * write failed.
+   */
+  std::size_t getDropped() const override;
+
+  /*
+   * @return the number of records waiting for the writer thread.
+   */
+  std::size_t getQueueDepth() const override;
+
+protected:
+  /*
+   * @brief pushes the queries that failed into the ring like log() does.
+   */
+  void logErrors(const Client::pointer &c) override;
+
+private:
+  /*
+   * @brief fills the record of a message of the client (not a session).
+   */
+  void fill(LogRecord &r, const Client::pointer &c, int64_t timestamp,
+            char type, std::string_view query);
+
+  /*
+   * @brief the writer thread: writes the batches while there are records and
+   * sleeps on the condition variable when the ring is empty (after a flush of
+   * the sink, at most once per second), the stats snapshots are written from
+   * here too.
+   */
+  void writerLoop();
+
+  /*
+   * @brief formats up to LOG_BATCH_SIZE ready records and writes them to the
+   * sink in one call (the queries are not copied), or in one call per
+   * segment in the binary format, then releases their slots.
+   * @return the number of records written.
+   */
+  std::size_t writeBatch();
+
+  /*
+   * @brief appends what comes before the query of the record to _headers, in
+   * the text or the binary format.
+   */
+  void formatText(const LogRecord &r);
+  void formatBinary(const LogRecord &r);
+
+  /*
+   * @brief writes the formatted records [first, end) to the sink in one call
+   * and keeps track of the sessions they start and end.
+   */
+  void writeRecords(std::size_t first, std::size_t end);
+
+  /*
+   * @return where the header of the record i begins in _headers.
+   */
+  std::size_t headerBegin(std::size_t i) const;
+
+  /*
+   * @brief binary format: puts the header and the session records of the
+   * clients still connected before the record first, so the log and each of
+   * its segments can be decoded on their own, then formats the records
+   * [first, last] again with the timestamps starting from 0.
+   */
+  void startSegment(std::size_t first, std::size_t last);
+
+  /*
+   * @brief pushes a session record of the client.
+   */
+  void pushSession(const Client::pointer &c, LogRecord::Kind kind);
+
+  /*
+   * @brief reserves a slot, waiting or dropping according to the overflow
+   * policy.
+   * @return the slot to fill then publish or nullptr if it was dropped.
+   */
+  LogRecord *reserve(std::size_t &pos);
+
+  /*
+   * @brief gives the first count records back to the ring, after freeing the
+   * queries over LOG_RECORD_KEEP.
+   */
+  void release(std::size_t count);
+
+  /*
+   * @brief wakes the writer thread up if it is sleeping.
+   */
+  void wakeWriter();
+
+  LogSink::uniq_ptr _sink;
+  LogRing<LogRecord> _ring;
+  Overflow _overflow;
+  LogFormat _format;
+  std::atomic<std::size_t> _dropped{0};
+  std::atomic<bool> _running{true};
+  std::atomic<bool> _writerSleeping{false};
+  std::mutex _wakeMutex;
+  std::condition_variable _wakeCond;
+
+  // writer thread only
+  std::string _headers;
+  std::vector<std::size_t> _headerEnds;
+  std::vector<iovec> _iov;
+  std::unordered_map<int, std::string> _sessions; // the ips by client id
+  bool _headerWritten = false;
+  int64_t _lastTimestamp = 0;
+  time_t _lastSecond = -1;
+  char _timeStr[32];
+  std::thread _writer;
+};
+
+#endif // __ASYNC_LOGGER_HPP_
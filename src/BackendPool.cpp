@@ -0,0 +1,53 @@
+#include "BackendPool.h"
+
+BackendPool::BackendPool(const std::string &remoteIP, const int remotePort,
+                         const std::size_t maxSize)
+    : _remoteIP(remoteIP), _remotePort(remotePort), _maxSize(maxSize) {}
+
+bool BackendPool::canOpen(const std::string &key) const {
+  auto it = _pools.find(key);
+  return it == _pools.end() || it->second.total < _maxSize;
+}
+
+Connection::uniq_ptr BackendPool::open(const std::string &key) {
+  return open(key, _remoteIP, _remotePort);
+}
+
+Connection::uniq_ptr BackendPool::open(const std::string &key,
+                                       const std::string &ip, const int port) {
+  auto conn = std::make_unique<Connection>(ip, port);
+  ++_pools[key].total;
+  return conn;
+}
+
+Connection::uniq_ptr BackendPool::acquire(const std::string &key) {
+  auto it = _pools.find(key);
+  if (it == _pools.end())
+    return nullptr;
+
+  // the most recently used one, so the extra connections stay idle
+  auto &idle = it->second.idle;
+  while (!idle.empty()) {
+    auto conn = std::move(idle.back());
+    idle.pop_back();
+    if (conn->isIdle())
+      return conn;
+    --it->second.total; // closed here
+  }
+  return nullptr;
+}
+
+void BackendPool::release(const std::string &key, Connection::uniq_ptr conn) {
+  _pools[key].idle.push_back(std::move(conn));
+}
+
+void BackendPool::discard(const std::string &key) {
+  auto it = _pools.find(key);
+  if (it != _pools.end() && it->second.total > 0)
+    --it->second.total;
+}
+
+std::size_t BackendPool::size(const std::string &key) const {
+  auto it = _pools.find(key);
+  return it == _pools.end() ? 0 : it->second.total;
+}
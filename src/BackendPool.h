@@ -0,0 +1,94 @@
+#ifndef __BACKEND_POOL_HPP_
+#define __BACKEND_POOL_HPP_
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Connection.h"
+
+/*
+ * @brief the authenticated connections to the remote server shared by the
+ * clients in pooling mode, one pool per user/database pair.
+ *
+ * a connection is opened when a client starts a session and the pool is not
+ * full, the client authenticates through it. after that the connection is
+ * only assigned to a client for the duration of a transaction and goes back
+ * to the idle list when the remote server reports it idle (ReadyForQuery 'I').
+ * once the pool of a key is full the new clients authenticate through a
+ * connection of their own that is not part of the pool (the server closes it
+ * after the handshake), the proxy never authenticates a client itself.
+ *
+ * a pool is owned by one server (thread) and is not thread safe.
+ */
+class BackendPool {
+
+public:
+  using uniq_ptr = std::unique_ptr<BackendPool>;
+
+  /*
+   * @param remoteIP : the ip (ipv4) address of the remote server.
+   * @param remotePort : the port of the remote server.
+   * @param maxSize : the maximum number of connections per user/database.
+   */
+  BackendPool(const std::string &remoteIP, const int remotePort,
+              const std::size_t maxSize);
+
+  /*
+   * @return true if a new connection can be opened for the key.
+   */
+  bool canOpen(const std::string &key) const;
+
+  /*
+   * @brief opens a new connection counted in the pool of the key, it is not
+   * authenticated yet.
+   *
+   * @throws Connection::ConnectionException on error.
+   */
+  Connection::uniq_ptr open(const std::string &key);
+
+  /*
+   * @brief same to another server (a replica the sessions of the key are
+   * routed to).
+   */
+  Connection::uniq_ptr open(const std::string &key, const std::string &ip,
+                            const int port);
+
+  /*
+   * @return an idle connection of the key or nullptr if there is none. the
+   * idle connections the remote server closed or wrote to meanwhile
+   * (restart, idle_session_timeout, pg_terminate_backend) are closed and
+   * forgotten on the way.
+   */
+  Connection::uniq_ptr acquire(const std::string &key);
+
+  /*
+   * @brief gives back an idle connection.
+   */
+  void release(const std::string &key, Connection::uniq_ptr conn);
+
+  /*
+   * @brief forgets a connection that was closed instead of released.
+   */
+  void discard(const std::string &key);
+
+  /*
+   * @return the number of connections of the key, idle and assigned.
+   */
+  std::size_t size(const std::string &key) const;
+
+private:
+  struct Pool {
+    std::vector<Connection::uniq_ptr> idle;
+    std::size_t total = 0; // idle and assigned connections
+  };
+
+  std::string _remoteIP;
+  int _remotePort;
+  std::size_t _maxSize;
+  std::unordered_map<std::string, Pool> _pools;
+};
+
+#endif // __BACKEND_POOL_HPP_
@@ -0,0 +1,230 @@
+#include "BackendSet.h"
+#include "MessageFramer.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <iostream>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+BackendSet::BackendSet(const std::string &primaryIP, const int primaryPort,
+                       const Balance balance, const long interval,
+                       const unsigned fails)
+    : _balance(balance), _interval(interval), _fails(std::max(fails, 1u)) {
+  _backends.push_back(Backend{primaryIP, primaryPort, Role::PRIMARY, 1});
+  _states.emplace_back();
+}
+
+BackendSet::~BackendSet() {
+  {
+    std::lock_guard<std::mutex> lock(_stopMutex);
+    _stopping = true;
+  }
+  _stopCond.notify_all();
+  if (_thread.joinable())
+    _thread.join();
+}
+
+void BackendSet::addReplica(const std::string &ip, const int port,
+                            const unsigned weight) {
+  _backends.push_back(
+      Backend{ip, port, Role::REPLICA, std::max(weight, 1u)});
+  _states.emplace_back();
+}
+
+void BackendSet::start() {
+  // the termination signals stay for the main thread
+  sigset_t set, old;
+  sigemptyset(&set);
+  sigaddset(&set, SIGINT);
+  sigaddset(&set, SIGTERM);
+  sigaddset(&set, SIGQUIT);
+  pthread_sigmask(SIG_BLOCK, &set, &old);
+  _thread = std::thread(&BackendSet::run, this);
+  pthread_sigmask(SIG_SETMASK, &old, nullptr);
+}
+
+std::size_t BackendSet::pick(const bool readOnly) {
+  std::size_t chosen = 0; // the primary
+
+  if (readOnly) {
+    std::lock_guard<std::mutex> lock(_pickMutex);
+    long total = 0;
+    bool found = false;
+    for (std::size_t i = 1; i < _backends.size(); ++i) {
+      State &s = _states[i];
+      if (!s.up.load(std::memory_order_relaxed))
+        continue;
+      if (_balance == Balance::ROUND_ROBIN) {
+        // each replica gains its weight, the highest is chosen and loses the
+        // total
+        s.current += _backends[i].weight;
+        total += _backends[i].weight;
+        if (!found || s.current > _states[chosen].current)
+          chosen = i;
+      } else if (!found ||
+                 s.sessions.load(std::memory_order_relaxed) *
+                         _backends[chosen].weight <
+                     _states[chosen].sessions.load(std::memory_order_relaxed) *
+                         _backends[i].weight) {
+        // the fewest sessions per weight
+        chosen = i;
+      }
+      found = true;
+    }
+    if (found && _balance == Balance::ROUND_ROBIN)
+      _states[chosen].current -= total;
+  }
+
+  _states[chosen].sessions.fetch_add(1, std::memory_order_relaxed);
+  _states[chosen].sessionsTotal.fetch_add(1, std::memory_order_relaxed);
+  return chosen;
+}
+
+void BackendSet::release(const std::size_t index) {
+  _states[index].sessions.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void BackendSet::reportFailure(const std::size_t index) {
+  record(index, false);
+}
+
+std::size_t BackendSet::size() const { return _backends.size(); }
+
+const BackendSet::Backend &BackendSet::get(const std::size_t index) const {
+  return _backends[index];
+}
+
+bool BackendSet::isUp(const std::size_t index) const {
+  return _states[index].up.load(std::memory_order_relaxed);
+}
+
+uint64_t BackendSet::getSessions(const std::size_t index) const {
+  return _states[index].sessions.load(std::memory_order_relaxed);
+}
+
+uint64_t BackendSet::getSessionsTotal(const std::size_t index) const {
+  return _states[index].sessionsTotal.load(std::memory_order_relaxed);
+}
+
+uint64_t BackendSet::getEjections(const std::size_t index) const {
+  return _states[index].ejections.load(std::memory_order_relaxed);
+}
+
+const char *BackendSet::roleName(const Role role) {
+  return role == Role::PRIMARY ? "primary" : "replica";
+}
+
+void BackendSet::cancel(const std::string &request) {
+  {
+    std::lock_guard<std::mutex> lock(_stopMutex);
+    if (_cancels.size() >= CANCEL_QUEUE_MAX)
+      return;
+    _cancels.push_back(request);
+  }
+  _stopCond.notify_all();
+}
+
+void BackendSet::run() {
+  std::unique_lock<std::mutex> lock(_stopMutex);
+  auto next = std::chrono::steady_clock::now();
+
+  while (!_stopping) {
+    if (!_cancels.empty()) {
+      std::string request = std::move(_cancels.front());
+      _cancels.pop_front();
+      lock.unlock();
+      for (const auto &b : _backends)
+        sendCancel(b, request);
+      lock.lock();
+      continue;
+    }
+
+    if (std::chrono::steady_clock::now() >= next) {
+      lock.unlock();
+      for (std::size_t i = 0; i < _backends.size(); ++i)
+        record(i, check(_backends[i]));
+      lock.lock();
+      next = std::chrono::steady_clock::now() +
+             std::chrono::milliseconds(_interval);
+      continue;
+    }
+    _stopCond.wait_until(lock, next, [this]() {
+      return _stopping || !_cancels.empty();
+    });
+  }
+}
+
+int BackendSet::connectTo(const Backend &b) const {
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(b.port);
+  if (!inet_aton(b.ip.c_str(), &addr.sin_addr))
+    return -1;
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return -1;
+
+  pollfd pfd{fd, POLLOUT, 0};
+  int error = 0;
+  socklen_t len = sizeof(error);
+  if ((connect(fd, (const sockaddr *)&addr, sizeof(addr)) == 0 ||
+       errno == EINPROGRESS) &&
+      poll(&pfd, 1, HEALTH_CHECK_TIMEOUT_MS) == 1 &&
+      getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) == 0 && error == 0)
+    return fd;
+  close(fd);
+  return -1;
+}
+
+bool BackendSet::check(const Backend &b) const {
+  int fd = connectTo(b);
+  if (fd < 0)
+    return false;
+
+  // an SSLRequest is answered before any authentication
+  uint32_t request[2] = {htonl(8), htonl(SSL_REQUEST_CODE)};
+  pollfd pfd{fd, POLLIN, 0};
+  char answer = 0;
+  bool alive =
+      send(fd, request, sizeof(request), MSG_NOSIGNAL) == sizeof(request) &&
+      poll(&pfd, 1, HEALTH_CHECK_TIMEOUT_MS) == 1 &&
+      recv(fd, &answer, 1, 0) == 1 && (answer == 'S' || answer == 'N');
+  close(fd);
+  return alive;
+}
+
+void BackendSet::sendCancel(const Backend &b,
+                            const std::string &request) const {
+  int fd = connectTo(b);
+  if (fd < 0)
+    return;
+
+  // nothing is answered, the request is read before our FIN
+  if (send(fd, request.data(), request.size(), MSG_NOSIGNAL) !=
+      long(request.size()))
+    std::cerr << roleName(b.role) << " " << b.ip << ":" << b.port
+              << " : could not forward a CancelRequest" << std::endl;
+  close(fd);
+}
+
+void BackendSet::record(const std::size_t index, const bool alive) {
+  State &s = _states[index];
+  const Backend &b = _backends[index];
+
+  if (alive) {
+    s.failures.store(0, std::memory_order_relaxed);
+    if (!s.up.exchange(true))
+      std::cout << roleName(b.role) << " " << b.ip << ":" << b.port
+                << " : is up" << std::endl;
+  } else if (s.failures.fetch_add(1) + 1 >= _fails && s.up.exchange(false)) {
+    s.ejections.fetch_add(1, std::memory_order_relaxed);
+    std::cerr << roleName(b.role) << " " << b.ip << ":" << b.port
+              << " : is down, ejected" << std::endl;
+  }
+}
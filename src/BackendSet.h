@@ -0,0 +1,176 @@
+#ifndef __BACKEND_SET_HPP_
+#define __BACKEND_SET_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// the time a health check waits for the connect and the answer
+#define HEALTH_CHECK_TIMEOUT_MS 1000
+
+// the CancelRequests waiting for the health check thread
+#define CANCEL_QUEUE_MAX 1024
+
+/*
+ * @brief the remote servers the sessions are routed to: the primary (the
+ * remote server of the command line) and its replicas, with the health of
+ * each one.
+ *
+ * a session that only reads (see Client::isReadOnly()) is routed to a
+ * healthy replica, balanced by least connections (the sessions routed there
+ * over the weight) or by weighted round robin (smooth, the replicas are
+ * interleaved), the other sessions and all of them when no replica is healthy
+ * go to the primary. a session stays on its server (in pooling mode as
+ * well): it authenticated there and the proxy cannot open a connection to
+ * another server for it, so the transactions are not routed on their own.
+ *
+ * a thread checks each server every interval: it connects and sends an
+ * SSLRequest, a server answering 'S' or 'N' in time is alive. a server is
+ * ejected after the given number of failed checks in a row and admitted
+ * again after one successful check. the failed connects of the sessions are
+ * counted too (see reportFailure()), the session of a replica that failed
+ * that way is routed to the primary. the same thread forwards the
+ * CancelRequests of the clients to all the servers (see cancel()).
+ *
+ * the set is shared by the servers (threads), the replicas are added before
+ * start().
+ */
+class BackendSet {
+
+public:
+  using pointer = std::shared_ptr<BackendSet>;
+
+  enum class Role { PRIMARY, REPLICA };
+
+  enum class Balance {
+    LEAST_CONNECTIONS,
+    ROUND_ROBIN // weighted
+  };
+
+  struct Backend {
+    std::string ip;
+    int port;
+    Role role;
+    unsigned weight;
+  };
+
+  /*
+   * @param primaryIP : the ip (ipv4) address of the primary.
+   * @param primaryPort : the port of the primary.
+   * @param balance : how the read only sessions are spread on the replicas.
+   * @param interval : the milliseconds between two checks of a server.
+   * @param fails : the failed checks in a row that eject a server.
+   */
+  BackendSet(const std::string &primaryIP, const int primaryPort,
+             const Balance balance = Balance::LEAST_CONNECTIONS,
+             const long interval = 2000, const unsigned fails = 3);
+
+  /*
+   * @brief stops the health check thread.
+   */
+  ~BackendSet();
+
+  BackendSet(const BackendSet &other) = delete;
+  BackendSet &operator=(const BackendSet &other) = delete;
+
+  void addReplica(const std::string &ip, const int port,
+                  const unsigned weight = 1);
+
+  /*
+   * @brief starts the health check thread.
+   */
+  void start();
+
+  /*
+   * @brief chooses the server of a new session and counts the session on it
+   * (see release()).
+   *
+   * @param readOnly : the session only reads, a replica can serve it.
+   * @return the index of the server.
+   */
+  std::size_t pick(const bool readOnly);
+
+  /*
+   * @brief a session of the server is over.
+   */
+  void release(const std::size_t index);
+
+  /*
+   * @brief a connection to the server could not be opened, counted like a
+   * failed check.
+   */
+  void reportFailure(const std::size_t index);
+
+  /*
+   * @brief queues a CancelRequest, the health check thread sends it to each
+   * server on a new connection (a server ignores the keys of the sessions
+   * it does not have). dropped when CANCEL_QUEUE_MAX requests are waiting.
+   */
+  void cancel(const std::string &request);
+
+  std::size_t size() const;
+  const Backend &get(const std::size_t index) const;
+  bool isUp(const std::size_t index) const;
+  uint64_t getSessions(const std::size_t index) const; // a gauge
+  uint64_t getSessionsTotal(const std::size_t index) const;
+  uint64_t getEjections(const std::size_t index) const;
+
+  static const char *roleName(const Role role);
+
+private:
+  struct State {
+    std::atomic<bool> up{true};
+    std::atomic<unsigned> failures{0}; // failed checks in a row
+    std::atomic<uint64_t> sessions{0};
+    std::atomic<uint64_t> sessionsTotal{0};
+    std::atomic<uint64_t> ejections{0};
+    long current = 0; // smooth weighted round robin, under _pickMutex
+  };
+
+  /*
+   * @brief checks the servers every interval until the destructor.
+   */
+  void run();
+
+  /*
+   * @return true if the server answers an SSLRequest in time.
+   */
+  bool check(const Backend &b) const;
+
+  /*
+   * @brief sends the CancelRequest to the server on a new connection.
+   */
+  void sendCancel(const Backend &b, const std::string &request) const;
+
+  /*
+   * @return a socket connected to the server within
+   * HEALTH_CHECK_TIMEOUT_MS, -1 on error.
+   */
+  int connectTo(const Backend &b) const;
+
+  /*
+   * @brief records the result of a check (or of a connect).
+   */
+  void record(const std::size_t index, const bool alive);
+
+  std::vector<Backend> _backends;
+  std::deque<State> _states; // not movable, a deque does not move them
+  Balance _balance;
+  long _interval;
+  unsigned _fails;
+  std::mutex _pickMutex;
+  std::mutex _stopMutex;
+  std::condition_variable _stopCond;
+  bool _stopping = false;
+  std::deque<std::string> _cancels; // under _stopMutex
+  std::thread _thread;
+};
+
+#endif // __BACKEND_SET_HPP_
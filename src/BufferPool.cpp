@@ -0,0 +1,58 @@
+#include "BufferPool.h"
+#include <new>
+#include <sys/mman.h>
+
+BufferPool::BufferPool(const bool hugePages) : _hugePages(hugePages) {}
+
+BufferPool::~BufferPool() {
+  for (void *slab : _slabs)
+    munmap(slab, BUFFER_SLAB_SIZE);
+}
+
+BufferChunk *BufferPool::acquire() {
+  if (_free == nullptr)
+    grow();
+
+  BufferChunk *chunk = _free;
+  _free = chunk->next;
+  chunk->next = nullptr;
+  ++_inUse;
+  return chunk;
+}
+
+void BufferPool::release(BufferChunk *chunk) {
+  // last in first out, the chunk is likely still in the cache
+  chunk->next = _free;
+  _free = chunk;
+  --_inUse;
+}
+
+std::size_t BufferPool::getChunksInUse() const { return _inUse; }
+
+std::size_t BufferPool::getMappedSize() const {
+  return _slabs.size() * BUFFER_SLAB_SIZE;
+}
+
+void BufferPool::grow() {
+  void *slab = MAP_FAILED;
+  if (_hugePages)
+    slab = mmap(nullptr, BUFFER_SLAB_SIZE, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (slab == MAP_FAILED) {
+    // no reserved huge pages, ask for transparent ones
+    slab = mmap(nullptr, BUFFER_SLAB_SIZE, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (slab == MAP_FAILED)
+      throw std::bad_alloc();
+    if (_hugePages)
+      madvise(slab, BUFFER_SLAB_SIZE, MADV_HUGEPAGE);
+  }
+  _slabs.push_back(slab);
+
+  auto *chunks = static_cast<BufferChunk *>(slab);
+  std::size_t count = BUFFER_SLAB_SIZE / sizeof(BufferChunk);
+  for (std::size_t i = count; i-- > 0;) {
+    chunks[i].next = _free;
+    _free = &chunks[i];
+  }
+}
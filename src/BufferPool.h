@@ -0,0 +1,86 @@
+#ifndef __BUFFER_POOL_HPP_
+#define __BUFFER_POOL_HPP_
+
+#include <cstddef>
+#include <vector>
+
+// the size of a chunk, header included
+#define BUFFER_CHUNK_SIZE (std::size_t(16 * 1024))
+
+// the chunks are carved from slabs of this size (a huge page)
+#define BUFFER_SLAB_SIZE (std::size_t(2 * 1024 * 1024))
+
+/*
+ * @brief a fixed size piece of a session buffer, the link is used by the
+ * chain of the buffer it belongs to or by the free list of the pool.
+ */
+struct BufferChunk {
+  static constexpr std::size_t DATA_SIZE =
+      BUFFER_CHUNK_SIZE - sizeof(BufferChunk *);
+
+  BufferChunk *next;
+  char data[DATA_SIZE];
+};
+
+/*
+ * @brief a pool of fixed size chunks the sessions borrow while they have data
+ * in flight and give back as soon as their buffers are empty, so idle
+ * sessions hold no buffer memory and the steady state does not allocate.
+ *
+ * the chunks are carved from slabs mapped with mmap (with huge pages if
+ * asked, falls back to normal pages and transparent huge pages), the slabs
+ * are only unmapped when the pool is destroyed.
+ *
+ * a pool is owned by one server (thread) and is not thread safe.
+ */
+class BufferPool {
+
+public:
+  /*
+   * @param hugePages : try to back the slabs with huge pages (MAP_HUGETLB).
+   */
+  BufferPool(const bool hugePages = false);
+
+  /*
+   * @brief unmaps the slabs, every chunk must have been released.
+   */
+  ~BufferPool();
+
+  BufferPool(const BufferPool &other) = delete;
+  BufferPool &operator=(const BufferPool &other) = delete;
+
+  /*
+   * @return a chunk (its content is undefined).
+   *
+   * @throws std::bad_alloc if a new slab can not be mapped.
+   */
+  BufferChunk *acquire();
+
+  /*
+   * @brief gives a chunk back to the pool.
+   */
+  void release(BufferChunk *chunk);
+
+  /*
+   * @return the number of chunks borrowed by the sessions.
+   */
+  std::size_t getChunksInUse() const;
+
+  /*
+   * @return the number of bytes mapped for the slabs.
+   */
+  std::size_t getMappedSize() const;
+
+private:
+  /*
+   * @brief maps a new slab and adds its chunks to the free list.
+   */
+  void grow();
+
+  bool _hugePages;
+  BufferChunk *_free = nullptr;
+  std::size_t _inUse = 0;
+  std::vector<void *> _slabs;
+};
+
+#endif // __BUFFER_POOL_HPP_
@@ -1,169 +1,773 @@
 #include "Client.h"
 #include <algorithm>
+#include <arpa/inet.h>
 #include <cstddef>
+#include <cstring>
+#include <fcntl.h>
+#include <utility>
+
+static uint32_t readInt32(const char *p) {
+  uint32_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return ntohl(v);
+}
+
+// a boolean setting of postgresql
+static bool isOn(std::string_view value) {
+  return value == "on" || value == "true" || value == "yes" || value == "1";
+}
+
+// the session key of the parameters of a StartupMessage (name\0value\0 pairs
+// ended by \0): the user, the database and the other parameters sorted by
+// name, since a pooled connection keeps the settings it was opened with
+// (options, client_encoding, role...). application_name is left out, it only
+// labels the session. readOnly is set when the session asks for read only
+// transactions (default_transaction_read_only, as a parameter or in the
+// options)
+static std::string startupKey(std::string_view params, bool &readOnly) {
+  static const std::string_view setting = "default_transaction_read_only=";
+  std::string user, database;
+  std::vector<std::pair<std::string, std::string>> others;
+  const char *p = params.data();
+  const char *end = params.data() + params.size();
+  while (p < end && *p != '\0') {
+    std::string name(p, strnlen(p, end - p));
+    p += name.size() + 1;
+    if (p >= end)
+      break;
+    std::string value(p, strnlen(p, end - p));
+    p += value.size() + 1;
+    if (name == "user") {
+      user = value;
+      continue;
+    }
+    if (name == "database") {
+      database = value;
+      continue;
+    }
+    if (name == "application_name")
+      continue;
+    if (name == "default_transaction_read_only")
+      readOnly = isOn(value);
+    else if (name == "options" && value.find(setting) != std::string::npos) {
+      std::string_view v(value);
+      v.remove_prefix(v.find(setting) + setting.size());
+      readOnly = isOn(v.substr(0, v.find(' ')));
+    }
+    others.emplace_back(std::move(name), std::move(value));
+  }
+
+  std::string key = user + '\0' + (database.empty() ? user : database);
+  std::sort(others.begin(), others.end());
+  for (const auto &o : others)
+    key.append(1, '\0').append(o.first).append(1, '=').append(o.second);
+  return key;
+}
 
 Client::Client(const int clientSock, const std::string &localIP,
-               const std::string &remoteIP, const int remotePort)
+               const std::string &remoteIP, const int remotePort,
+               BufferPool &buffers, const bool splice, const bool pooled,
+               const bool routed)
     : _clientSock(clientSock), _localIP(localIP), _remoteIP(remoteIP),
-      _remotePort(remotePort) {
-
-  _connection = std::make_unique<Connection>(_remoteIP, _remotePort);
-  _mode = Client::Mode::CLIENT_READ;
+      _remotePort(remotePort), _requestBuffer(buffers),
+      _responseBuffer(buffers), _pooled(pooled), _routed(routed && !pooled),
+      // without pooling only the status of ReadyForQuery is read
+      _responseFramer(false, pooled ? MAX_CARRY_SIZE : 1) {
+
+  // a pooled (routed) client gets its connection from the server
+  if (_pooled || _routed) {
+    _handshake = Handshake::STARTUP;
+    _frameResponses = true;
+  } else
+    _connection = std::make_unique<Connection>(_remoteIP, _remotePort);
+  _mode = Client::Mode::RELAY;
   _ID = -1;
-  _tmpBuff.resize(BUFF_SIZE);
+  if (splice && _connection)
+    initSplice();
 }
 
 Client::~Client() {
   if (_clientSock != -1)
     close(_clientSock);
+  if (_pipe[0] != -1)
+    close(_pipe[0]);
+  if (_pipe[1] != -1)
+    close(_pipe[1]);
+}
+
+void Client::initSplice() {
+  if (pipe2(_pipe, O_NONBLOCK | O_CLOEXEC) < 0)
+    return;
+
+  // a bigger pipe means less wake ups, the default size is fine on failure
+  fcntl(_pipe[1], F_SETPIPE_SZ, MAX_PENDING_SIZE);
+
+  int flags = fcntl(_clientSock, F_GETFL);
+  fcntl(_clientSock, F_SETFL, flags | O_NONBLOCK);
+  flags = fcntl(getRemoteSocket(), F_GETFL);
+  fcntl(getRemoteSocket(), F_SETFL, flags | O_NONBLOCK);
+  _splice = true;
 }
 
 bool Client::isConnected() const { return _mode != Mode::OFF; }
 
-bool Client::readyForRead() const {
-  return _mode == Mode::CLIENT_READ || _mode == Mode::REMOTE_READ;
+bool Client::hasPendingRequest() const { return !_requestBuffer.empty(); }
+
+bool Client::hasPendingResponse() const {
+  return _pipeSize > 0 || !_responseBuffer.empty();
 }
 
-bool Client::readyForWrite() const { return _mode == Mode::CLIENT_WRITE; }
+uint32_t Client::clientEvents() const {
+  if (_mode == Mode::OFF)
+    return 0;
 
-bool Client::readyToQueryServer() const { return _mode == Mode::REMOTE_WRITE; }
+  uint32_t events = 0;
+  if (!_clientEOF && _requestBuffer.size() < MAX_PENDING_SIZE)
+    events |= EPOLLIN;
+  if (hasPendingResponse())
+    events |= EPOLLOUT;
+  return events;
+}
+
+uint32_t Client::remoteEvents() const {
+  if (_mode == Mode::OFF || !_connection)
+    return 0;
+
+  // the socket becomes writable when the connect is over
+  if (_connection->isConnecting())
+    return EPOLLOUT;
 
-bool Client::readyToReadServerResp() const {
-  return _mode == Mode::REMOTE_READ || _mode == Mode::CLIENT_READ;
+  uint32_t events = 0;
+  if (!_remoteEOF && _pipeSize + _responseBuffer.size() < MAX_PENDING_SIZE)
+    events |= EPOLLIN;
+  if (!_requestBuffer.empty())
+    events |= EPOLLOUT;
+  return events;
 }
 
+uint32_t &Client::watchedClientEvents() { return _watchedClientEvents; }
+
+uint32_t &Client::watchedRemoteEvents() { return _watchedRemoteEvents; }
+
+Client::pointer &Client::nextDead() { return _nextDead; }
+
+bool &Client::deadQueued() { return _deadQueued; }
+
 int Client::getClientSocket() const { return _clientSock; }
 
 int Client::getRemoteSocket() const {
-  return _connection->getConnectionSocket();
+  return _connection ? _connection->getConnectionSocket() : -1;
 }
 
-const std::vector<char> &Client::getBuffer() const { return _buffer; };
+const std::vector<PgMessage> &Client::getLastMessages() const {
+  return _lastMessages;
+}
 
-void Client::readRequest() {
+void Client::readFromClient() {
   long len = 0;
 
-  while ((len = recv(_clientSock, _tmpBuff.data(), BUFF_SIZE, 0)) > 0) {
-    _buffer.insert(_buffer.end(), _tmpBuff.begin(), _tmpBuff.begin() + len);
-    if (len < BUFF_SIZE)
+  _framer.feed(std::string_view(), _lastMessages);
+
+  // drain the socket, MSG_DONTWAIT so the loop never blocks on an empty socket,
+  // the data is received directly in the chunks of the request buffer
+  while (_requestBuffer.size() < MAX_PENDING_SIZE) {
+    std::size_t space;
+    char *p = _requestBuffer.writeSpace(space);
+    if ((len = recv(_clientSock, p, space, MSG_DONTWAIT)) <= 0)
       break;
+    _requestBuffer.commit(len);
+    if (_metrics)
+      _metrics->requestBytes.add(len);
+    // the messages are views on the request buffer, nothing is copied
+    _framer.feedMore(std::string_view(p, len), _lastMessages);
   }
+  _requestBuffer.trim();
+  trackRequests();
 
-  if (len < 0) {
+  if (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
     _mode = Mode::OFF;
     throw ClientReadWriteException(strerror(errno));
-  } else if (len == 0) {
-    _mode = Mode::OFF;
-  } else
-    _mode = Mode::REMOTE_WRITE;
+  } else if (len == 0 && _requestBuffer.size() < MAX_PENDING_SIZE) {
+    // the client closed its side
+    _clientEOF = true;
+    checkClosed();
+  }
 }
 
-void Client::sendRequest() {
+void Client::writeToRemote() {
   long len = 0;
 
-  if (!_buffer.empty())
-    len = _connection->send(_buffer);
+  // a pooled client waiting for a connection keeps its requests
+  if (!_connection || !finishConnect())
+    return;
+
+  // the queued chunks go in one sendmsg, the sent data is consumed without
+  // moving the rest
+  while (!_requestBuffer.empty()) {
+    iovec iov[SEND_IOV_MAX];
+    int count = _requestBuffer.peek(iov, SEND_IOV_MAX);
+    std::size_t total = 0;
+    for (int i = 0; i < count; ++i)
+      total += iov[i].iov_len;
+    if ((len = _connection->send(iov, count)) < 0)
+      break;
+    _requestBuffer.consume(len);
+    if (_metrics)
+      _metrics->sentBytes.add(len);
+    if (static_cast<std::size_t>(len) < total)
+      break;
+  }
 
-  if (len < 0) {
+  if (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
     _mode = Mode::OFF;
+    _releasable = false;
     throw Connection::ConnectionException(strerror(errno));
   }
+  // the socket buffer is full, the rest waits for EPOLLOUT
+  _lastMessages.clear();
+  checkClosed();
+}
+
+void Client::readFromRemote() {
+  long len = 0;
 
-  if (static_cast<std::size_t>(len) < _buffer.size()) {
-    // in case not all the content of the buffer was sent due to some reason!
-    std::rotate(_buffer.begin(), _buffer.begin() + len, _buffer.end());
-    _buffer.resize(_buffer.size() - len);
+  compactPending();
+  if (!_connection || !finishConnect())
+    return;
+  if (_splice)
+    return spliceFromRemote();
 
-  } else {
-    // all the content of the buffer was sent to the remote server
-    _buffer.clear();
-    _mode = Mode::REMOTE_READ;
+  while (_responseBuffer.size() < MAX_PENDING_SIZE) {
+    std::size_t space;
+    char *p = _responseBuffer.writeSpace(space);
+    if ((len = _connection->receive(p, space)) <= 0)
+      break;
+    _responseBuffer.commit(len);
+    if (_metrics)
+      _metrics->responseBytes.add(len);
+    if (_frameResponses)
+      trackResponses(std::string_view(p, len));
+  }
+  _responseBuffer.trim();
+
+  if (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+    _mode = Mode::OFF;
+    _releasable = false;
+    throw Connection::ConnectionException(strerror(errno));
+  } else if (len == 0 && _responseBuffer.size() < MAX_PENDING_SIZE) {
+    // the remote server closed its side
+    _remoteEOF = true;
+    _releasable = false;
+    checkClosed();
   }
 }
 
-void Client::receiveResponse() {
-  long len;
+void Client::writeToClient() {
+  long len = 0;
 
-  while ((len = _connection->receive(_tmpBuff, BUFF_SIZE)) > 0) {
-    _buffer.insert(_buffer.end(), _tmpBuff.begin(), _tmpBuff.begin() + len);
-    if (len < BUFF_SIZE)
+  if (_splice)
+    return spliceToClient();
+
+  // the queued chunks go in one sendmsg, the sent data is consumed without
+  // moving the rest
+  while (!_responseBuffer.empty()) {
+    msghdr msg{};
+    iovec iov[SEND_IOV_MAX];
+    msg.msg_iov = iov;
+    msg.msg_iovlen = _responseBuffer.peek(iov, SEND_IOV_MAX);
+    std::size_t total = 0;
+    for (std::size_t i = 0; i < msg.msg_iovlen; ++i)
+      total += iov[i].iov_len;
+    if ((len = sendmsg(_clientSock, &msg, MSG_DONTWAIT)) < 0)
+      break;
+    _responseBuffer.consume(len);
+    if (_metrics)
+      _metrics->sentBytes.add(len);
+    if (static_cast<std::size_t>(len) < total)
       break;
   }
 
-  if (len < 0) {
+  if (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
     _mode = Mode::OFF;
-    throw Connection::ConnectionException(strerror(errno));
-  } else if (len == 0) {
+    throw ClientReadWriteException(strerror(errno));
+  }
+  // the socket buffer is full, the rest waits for EPOLLOUT
+  checkClosed();
+}
+
+void Client::spliceFromRemote() {
+  long len = 0;
+
+  while (_pipeSize < MAX_PENDING_SIZE &&
+         (len = splice(getRemoteSocket(), NULL, _pipe[1], NULL,
+                       MAX_PENDING_SIZE - _pipeSize,
+                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK)) > 0) {
+    _pipeSize += len;
+    if (_metrics)
+      _metrics->responseBytes.add(len);
+  }
+
+  if (len < 0 && (errno == EINVAL || errno == ENOSYS) && _pipeSize == 0) {
+    // splice is not supported for these fds, use the response buffer
+    _splice = false;
+    return readFromRemote();
+  } else if (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
     _mode = Mode::OFF;
-  } else
-    _mode = Mode::CLIENT_WRITE;
+    throw Connection::ConnectionException(strerror(errno));
+  } else if (len == 0 && _pipeSize < MAX_PENDING_SIZE) {
+    // the remote server closed its side
+    _remoteEOF = true;
+    checkClosed();
+  }
 }
 
-void Client::sendResponse() {
+void Client::spliceToClient() {
   long len = 0;
-  if (!_buffer.empty())
-    len = send(_clientSock, _buffer.data(), _buffer.size(), 0);
 
-  if (len < 0) {
+  while (_pipeSize > 0 &&
+         (len = splice(_pipe[0], NULL, _clientSock, NULL, _pipeSize,
+                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK)) > 0) {
+    _pipeSize -= len;
+    if (_metrics)
+      _metrics->sentBytes.add(len);
+  }
+
+  if (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
     _mode = Mode::OFF;
     throw ClientReadWriteException(strerror(errno));
   }
+  checkClosed();
+}
 
-  if (static_cast<std::size_t>(len) < _buffer.size()) {
-    // in case not all the content of the buffer was sent due to some reason!
-    std::rotate(_buffer.begin(), _buffer.begin() + len, _buffer.end());
-    _buffer.resize(_buffer.size() - len);
+void Client::receivedFromClient(std::string_view data) {
+  _requestBuffer.append(data.data(), data.size());
+  if (_metrics)
+    _metrics->requestBytes.add(data.size());
+  _framer.feed(data, _lastMessages);
+  trackRequests();
+}
 
-  } else {
-    // all the content of the buffer was sent to the client
-    _buffer.clear();
-    _mode = Mode::CLIENT_READ;
-  }
+void Client::receivedFromRemote(std::string_view data) {
+  compactPending();
+  _responseBuffer.append(data.data(), data.size());
+  if (_metrics)
+    _metrics->responseBytes.add(data.size());
+  if (_frameResponses)
+    trackResponses(data);
+}
+
+void Client::clientClosed() {
+  _clientEOF = true;
+  checkClosed();
+}
+
+void Client::remoteClosed() {
+  _remoteEOF = true;
+  _releasable = false;
+  checkClosed();
+}
+
+int Client::peekRequests(iovec *iov, int max) const {
+  return _requestBuffer.peek(iov, max);
+}
+
+int Client::peekResponses(iovec *iov, int max) const {
+  return _responseBuffer.peek(iov, max);
+}
+
+void Client::sentToRemote(std::size_t len) {
+  _requestBuffer.consume(len);
+  if (_metrics)
+    _metrics->sentBytes.add(len);
+  _lastMessages.clear();
+  checkClosed();
+}
+
+void Client::sentToClient(std::size_t len) {
+  _responseBuffer.consume(len);
+  if (_metrics)
+    _metrics->sentBytes.add(len);
+  checkClosed();
 }
 
-void Client::relay() {
-  long lenr, lenw;
+std::size_t Client::getPendingRequestSize() const {
+  return _requestBuffer.size();
+}
+
+std::size_t Client::getPendingResponseSize() const {
+  return _responseBuffer.size();
+}
 
-  // read from the remote server
-  while ((lenr = _connection->receive(_tmpBuff, BUFF_SIZE)) > 0) {
+void Client::checkClosed() {
+  if ((_clientEOF && _requestBuffer.empty()) ||
+      (_remoteEOF && !hasPendingResponse()))
+    _mode = Mode::OFF;
+}
+
+void Client::trackRequests() {
+  std::chrono::steady_clock::time_point now;
+  bool timed = false;
+
+  for (auto &m : _lastMessages) {
+    // the session state the results depend on may change (a function call
+    // can do anything), the client stops using the cache
+    if (_cache != nullptr &&
+        (m.type == 'F' ||
+         ((m.type == 'Q' || m.type == 'P') &&
+          ResultCache::changesSession(
+              QueryStats::extractQuery(m.type, m.body))))) {
+      _cache = nullptr;
+      _capturing = false;
+      _capture.clear();
+    }
+
+    switch (m.type) {
+    case 0:
+      // after the StartupMessage the remote server only sends typed messages
+      // (its answer to an SSLRequest is a single byte)
+      if (!_pooled && !_splice && m.body.size() >= 4) {
+        uint32_t code = readInt32(m.body.data());
+        if (code != SSL_REQUEST_CODE && code != GSSENC_REQUEST_CODE &&
+            code != CANCEL_REQUEST_CODE) {
+          _frameResponses = true;
+          // the result cache is per user and database
+          if (_cache != nullptr)
+            _poolKey = startupKey(m.body.substr(4), _readOnly);
+        }
+      }
+      break;
+    case 'P':
+      if (_keepQueryText) {
+        std::string_view query = QueryStats::extractQuery(m.type, m.body);
+        _parseText.assign(query.data(), std::min(query.size(), QUERY_TEXT_MAX));
+      }
+      break;
+    case 'Q':
+    case 'S':
+    case 'F': {
+      // each simple query, Sync and function call is answered by a
+      // ReadyForQuery, in pooling mode the connection is kept until then
+      if (!timed) {
+        now = std::chrono::steady_clock::now();
+        timed = true;
+      }
+      PendingQuery pending{now, _pendingText.size(), _pendingText.size(),
+                           false};
+      if (_keepQueryText) {
+        std::string_view text;
+        if (m.type == 'Q')
+          text = QueryStats::extractQuery(m.type, m.body);
+        else if (m.type == 'S')
+          text = _parseText;
+        _pendingText.append(text.data(), std::min(text.size(), QUERY_TEXT_MAX));
+        pending.textEnd = _pendingText.size();
+      }
+      if (m.type == 'S')
+        _parseText.clear();
+      _pendingQueries.push_back(pending);
+      if (_pooled)
+        ++_pendingSyncs;
+      break;
+    }
+    default:
+      break;
+    }
+    if (_pooled && m.type != 'X')
+      _releasable = false;
+  }
+}
 
-    // write directly to the client
-    if ((lenw = send(_clientSock, _tmpBuff.data(), lenr, 0)) < 0)
-      throw ClientReadWriteException(strerror(errno));
+void Client::trackResponses(std::string_view data) {
+  std::chrono::steady_clock::time_point now;
+  bool timed = false;
+
+  _responseFramer.feed(data, _responseMessages);
+  if (_capturing) {
+    // a response too big for the cache is not kept
+    if (_capture.size() + data.size() <= _cache->getEntryMax())
+      _capture.append(data);
+    else {
+      _capturing = false;
+      _capture.clear();
+    }
+  }
 
-    // if the data written is less that was read
-    if (lenw < lenr) {
-      // buffering instead
-      _buffer.insert(_buffer.end(), _tmpBuff.begin() + lenw,
-                     _tmpBuff.begin() + lenr);
+  for (auto &m : _responseMessages) {
+    if (_capturing && !ResultCache::isStored(m.type)) {
+      // a notice, a notification or a parameter change is not replayed to
+      // the other sessions
+      _capturing = false;
+      _capture.clear();
+    }
+    if (m.type == 'E' && _handshake != Handshake::AUTH &&
+        _pendingHead < _pendingQueries.size()) {
+      _pendingQueries[_pendingHead].failed = true;
+    } else if (m.type == 'Z') {
+      _status = m.body.empty() ? 0 : m.body[0];
+      if (_handshake == Handshake::AUTH) {
+        _handshake = Handshake::READY;
+      } else if (_pendingHead < _pendingQueries.size()) {
+        if (!timed) {
+          now = std::chrono::steady_clock::now();
+          timed = true;
+        }
+        const PendingQuery &q = _pendingQueries[_pendingHead++];
+        _completedQueries.push_back(QueryTiming{
+            std::string_view(_pendingText)
+                .substr(q.textBegin, q.textEnd - q.textBegin),
+            uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(
+                         now - q.start)
+                         .count()),
+            q.failed});
+        if (_pendingSyncs > 0)
+          --_pendingSyncs;
+        if (_capturing) {
+          // the response is the data since the query, complete if it ends
+          // with this ReadyForQuery
+          if (!q.failed && _status == 'I' && &m == &_responseMessages.back() &&
+              !_responseFramer.hasPartial())
+            _cache->insert(_cacheKey, std::move(_capture));
+          _capturing = false;
+          _capture.clear();
+        }
+      }
+      // the status is 'I' idle, 'T' in a transaction or 'E' failed
+      // transaction
+      _releasable = _pendingSyncs == 0 && !m.body.empty() && m.body[0] == 'I';
+    }
+  }
+}
 
-      // if all the data was read from the server
-      if (lenr < BUFF_SIZE)
-        _mode = Mode::CLIENT_WRITE;
-      else // there is still data to be read from the server
-        receiveResponse();
-      return;
+void Client::compactPending() {
+  _completedQueries.clear();
+
+  if (_pendingHead == _pendingQueries.size()) {
+    _pendingQueries.clear();
+    _pendingText.clear();
+    _pendingHead = 0;
+  } else if (_pendingHead >= 64 && _pendingHead * 2 >= _pendingQueries.size()) {
+    // a client that always has requests in flight
+    std::size_t offset = _pendingQueries[_pendingHead].textBegin;
+    _pendingText.erase(0, offset);
+    _pendingQueries.erase(_pendingQueries.begin(),
+                          _pendingQueries.begin() + _pendingHead);
+    for (auto &q : _pendingQueries) {
+      q.textBegin -= offset;
+      q.textEnd -= offset;
     }
+    _pendingHead = 0;
+  }
+}
 
-    if (lenr < BUFF_SIZE)
+void Client::processPooled() {
+  if (!_pooled && !_routed)
+    return;
+
+  while (_handshake == Handshake::STARTUP && _requestBuffer.size() >= 8) {
+    char header[8];
+    _requestBuffer.copyOut(0, header, sizeof(header));
+    uint32_t len = readInt32(header);
+    uint32_t code = readInt32(header + 4);
+    if (len == 8 && (code == SSL_REQUEST_CODE || code == GSSENC_REQUEST_CODE)) {
+      // the proxy does not encrypt, the client goes on in clear text
+      _requestBuffer.consume(8);
+      _responseBuffer.append("N", 1);
+    } else if (code == CANCEL_REQUEST_CODE && len == 16 && !_pooled) {
+      // the server sends it to each server the session may be on
+      if (_requestBuffer.size() < len)
+        break;
+      _cancelRequest.resize(len);
+      _requestBuffer.copyOut(0, _cancelRequest.data(), len);
+      _requestBuffer.consume(len);
+      break;
+    } else if (code == CANCEL_REQUEST_CODE || len < 8 ||
+               len > MAX_CARRY_SIZE) {
+      _mode = Mode::OFF;
+      throw ClientReadWriteException("unsupported startup message in pooling "
+                                     "or routing mode");
+    } else if (_requestBuffer.size() >= len) {
+      std::string startup(len, '\0');
+      _requestBuffer.copyOut(0, startup.data(), len);
+      _poolKey = startupKey(std::string_view(startup).substr(8), _readOnly);
+      _handshake = Handshake::STARTED;
+    } else
       break;
   }
 
-  if (lenr < 0) {
-    _mode = Mode::OFF;
-    throw Connection::ConnectionException(strerror(errno));
-  } else if (lenr == 0) {
+  // a Terminate would close the shared connection, only close the client.
+  // nothing the client sends after it is forwarded either
+  for (std::size_t i = 0;
+       _pooled && _handshake == Handshake::READY && i < _lastMessages.size();
+       ++i) {
+    if (_lastMessages[i].type != 'X')
+      continue;
+    // the bytes from the Terminate to the end of the buffer, unknown if a
+    // message is cut
+    bool known = !_framer.hasPartial();
+    std::size_t tail = 0;
+    for (std::size_t j = i; j < _lastMessages.size(); ++j) {
+      known = known && !_lastMessages[j].truncated;
+      tail += 5 + _lastMessages[j].body.size();
+    }
+    if (known && tail <= _requestBuffer.size())
+      _requestBuffer.dropBack(tail);
+    else
+      _requestBuffer.consume(_requestBuffer.size());
+    _clientEOF = true;
+    checkClosed();
+    break;
+  }
+
+  // the buffer changed, the last read messages are not valid anymore
+  _lastMessages.clear();
+}
+
+void Client::processCached() {
+  if (_cache == nullptr || _splice || !_frameResponses || _capturing ||
+      _handshake != Handshake::READY || _status != 'I' ||
+      _lastMessages.size() != 1 || _lastMessages[0].type != 'Q' ||
+      _pendingQueries.size() - _pendingHead != 1 || _framer.hasPartial() ||
+      _responseFramer.hasPartial())
+    return;
+
+  // the query is the only request in the buffer
+  const PgMessage &m = _lastMessages[0];
+  if (m.truncated || _requestBuffer.size() != m.body.size() + 5 ||
+      !_cache->makeKey(_poolKey, QueryStats::extractQuery('Q', m.body),
+                       _cacheKey))
+    return;
+
+  ResultCache::Response response = _cache->find(_cacheKey);
+  if (!response) {
+    // stored once relayed (see trackResponses())
+    _capturing = true;
+    _capture.clear();
+    return;
+  }
+
+  // answered by the proxy, the remote server never sees the query
+  _requestBuffer.consume(_requestBuffer.size());
+  _responseBuffer.append(response->data(), response->size());
+  _pendingQueries.pop_back();
+  if (_pooled) {
+    --_pendingSyncs;
+    _releasable = _pendingSyncs == 0;
+  }
+  // the buffer changed, the last read messages are not valid anymore
+  _lastMessages.clear();
+}
+
+const std::string &Client::getCancelRequest() const {
+  return _cancelRequest;
+}
+
+bool Client::needsBackend() const {
+  return (_pooled || _routed) && !_connection &&
+         (_handshake == Handshake::STARTED ||
+          (_handshake == Handshake::READY && !_requestBuffer.empty()));
+}
+
+void Client::attach(Connection::uniq_ptr conn) {
+  _connection = std::move(conn);
+  _watchedRemoteEvents = 0;
+  _releasable = false;
+  if (_handshake == Handshake::STARTED)
+    _handshake = Handshake::AUTH;
+}
+
+Connection::uniq_ptr Client::detach() {
+  _watchedRemoteEvents = 0;
+  _releasable = false;
+  return std::move(_connection);
+}
+
+bool Client::canRelease() const {
+  return _pooled && _connection && _handshake == Handshake::READY &&
+         _releasable && _requestBuffer.empty() && !_framer.hasPartial() &&
+         !_responseFramer.hasPartial();
+}
+
+bool Client::hasConnection() const { return _connection != nullptr; }
+
+bool Client::isConnecting() const {
+  return _connection && _connection->isConnecting();
+}
+
+bool Client::canRestart() const {
+  return (_pooled || _routed) && !_clientEOF &&
+         ((_handshake == Handshake::STARTED && !_connection) ||
+          (_handshake == Handshake::AUTH && isConnecting()));
+}
+
+void Client::restart() {
+  _connection.reset();
+  _watchedRemoteEvents = 0;
+  _releasable = false;
+  _handshake = Handshake::STARTED;
+  // a failed connect turned the client off
+  _mode = Mode::RELAY;
+}
+
+bool Client::finishConnect() {
+  try {
+    if (!_connection->isConnecting())
+      return true;
+    bool connected = _connection->finishConnect();
+    if (connected && _metrics)
+      _metrics->connects.add();
+    return connected;
+  } catch (const Connection::ConnectionException &) {
     _mode = Mode::OFF;
-  } else // all the data was read from the server and written to the client
-    _mode = Mode::CLIENT_READ;
+    _releasable = false;
+    throw;
+  }
+}
+
+const std::string &Client::getPoolKey() const { return _poolKey; }
+
+bool Client::isReadOnly() const { return _readOnly; }
+
+void Client::route(const int backend) {
+  // the sessions of each server have their pools
+  if (_pooled && _backend >= 0)
+    _poolKey.erase(_poolKey.rfind('\0'));
+  _backend = backend;
+  if (_pooled)
+    _poolKey.append(1, '\0').append(std::to_string(backend));
 }
 
-std::string Client::getIP() const { return _localIP; }
+int Client::getBackend() const { return _backend; }
+
+Client::Handshake Client::getHandshake() const { return _handshake; }
+
+bool &Client::waitingBackend() { return _waitingBackend; }
+
+bool &Client::handshakeOnly() { return _handshakeOnly; }
+
+void Client::disconnect() { _mode = Mode::OFF; }
+
+const std::string &Client::getIP() const { return _localIP; }
 
 int Client::getID() const { return _ID; }
 
 void Client::setID(int id) { _ID = id; }
 
+void Client::setMetrics(ServerMetrics *metrics) { _metrics = metrics; }
+
+void Client::setResultCache(ResultCache *cache) {
+  _cache = _splice ? nullptr : cache;
+}
+
+LogState &Client::logState() { return _logState; }
+
+StatementCache &Client::statements() { return _statements; }
+
+const std::vector<QueryTiming> &Client::getCompletedQueries() const {
+  return _completedQueries;
+}
+
+void Client::keepQueryText(const bool keep) { _keepQueryText = keep; }
+
 Client::ClientReadWriteException::ClientReadWriteException()
     : e("Error while reading/writing to client !") {}
 
@@ -1,20 +1,70 @@
 #ifndef __CLIENT_HPP_
 #define __CLIENT_HPP_
 
+#include <chrono>
+#include <cstdint>
 #include <deque>
 #include <memory>
+#include <string_view>
+#include <sys/epoll.h>
 #include <vector>
 
+#include "BufferPool.h"
 #include "Connection.h"
+#include "IOBuffer.h"
+#include "LogPolicy.h"
+#include "MessageFramer.h"
+#include "Metrics.h"
+#include "QueryStats.h"
+#include "ResultCache.h"
+#include "StatementCache.h"
 class Connection;
 
 #define BUFF_SIZE 8192
 
+// a direction stops reading its source once this much data is pending
+#define MAX_PENDING_SIZE (BUFF_SIZE * 128)
+
+// the maximum number of chunks sent by one sendmsg
+#define SEND_IOV_MAX 64
+
+// the text of a query kept for getCompletedQueries() is cut to this size
+#define QUERY_TEXT_MAX (std::size_t(1024))
+
 /*
  * @brief this represents a new connection from a client to the remote server.
  * this class holds amongst other things two sockets, one for the client for
  * proxy-client communication, and another one for proxy-remote server
  * communication.
+ *
+ * the session is full duplex: the requests (client -> remote server) and the
+ * responses (remote server -> client) have their own buffers and are relayed
+ * independently, so a client can pipeline requests while the remote server is
+ * still streaming a response.
+ *
+ * in splice mode the responses are never copied to user space, they are moved
+ * from the connection socket to the client socket with splice() through a
+ * pipe owned by the client. the requests always go through the request buffer
+ * since they are logged.
+ *
+ * in pooling mode the client has no connection of its own: the proxy answers
+ * the SSL requests, the server assigns a connection for the handshake (a new
+ * one of its BackendPool, or one opened only for it when the pool is full) so
+ * the remote server always authenticates the client, then a connection of the
+ * pool for each transaction, and takes it back once the remote server reports
+ * it idle (ReadyForQuery 'I') with nothing pending.
+ *
+ * in routing mode (replicas, see BackendSet) the startup is the same but the
+ * server connects the client to the server its StartupMessage is routed to,
+ * for the whole session.
+ *
+ * the latency of each request is tracked from the Query (or Sync, or
+ * function call) to the ReadyForQuery that answers it, the responses are
+ * framed for that (except in splice mode, they are not read by the proxy).
+ *
+ * with a result cache, a simple query the cache allows is answered by the
+ * proxy when the response is cached, otherwise its response is stored as it
+ * is relayed (see processCached()).
  */
 class Client {
 
@@ -24,114 +74,309 @@ public:
   using raw_ptr = Client *;
 
   enum class Mode {
-    CLIENT_READ,  // read request from the client
-    CLIENT_WRITE, // send response to client
-    REMOTE_READ,  // receive query response from the remote server
-    REMOTE_WRITE, // send query to the remote server
-    OFF           // the client is offline
+    RELAY, // relaying data in both directions
+    OFF    // the client is offline
+  };
+
+  /*
+   * the session startup in pooling mode.
+   */
+  enum class Handshake {
+    STARTUP, // waiting for the StartupMessage
+    STARTED, // the StartupMessage was read, waits for a connection
+    AUTH,    // authenticating through a new connection
+    READY    // the session is established (always the case when not pooled)
   };
 
   /*
    * @brief the client constructor.
    *
    * create connection object and initializes private values,
-   * sets the mode to Client_read and the ID to -1.
+   * sets the mode to Relay and the ID to -1.
    *
    * @param clientSock : the socket fd of the client.
    * @param localIP : the ip (ipv4) address of the client.
    * @param remoteIP : the ip (ipv4) address of the remote server.
    * @param remotePort : the port of the remote server.
+   * @param buffers : the pool the request and response buffers borrow their
+   * chunks from (owned by the server, it outlives the client).
+   * @param splice : relay the responses with splice(), falls back to the
+   * response buffer if the pipe can not be created.
+   * @param pooled : pooling mode, no connection is opened (see attach()),
+   * splice is not used.
+   * @param routed : routing mode (without pooling), the connection is
+   * attached once the StartupMessage is read, splice is not used.
    *
    * @throws connection error on failure.
    */
 
   Client(const int clientSock, const std::string &localIP,
-         const std::string &remoteIP, const int remotePort);
+         const std::string &remoteIP, const int remotePort,
+         BufferPool &buffers, const bool splice = false,
+         const bool pooled = false, const bool routed = false);
 
   /*
-   * closes the client socket and delete the connection object
-   * also delete the buffer if there is still some content
+   * closes the client socket and the splice pipe and delete the connection
+   * object also delete the buffer if there is still some content
    */
   ~Client();
 
   /*
-   * @brief reads the request from the client through the client socket
-   * the request is then saved in the buffer and the mode is changed to
-   * Remote_write on success or off on failure.
+   * @brief reads the requests from the client through the client socket until
+   * the socket is drained (EAGAIN) or MAX_PENDING_SIZE bytes are pending, the
+   * data is appended to the request buffer and split into messages (see
+   * getLastMessages()). the mode is changed to off on
+   * failure, on end of file the session is closed once the pending requests
+   * are sent.
    *
    * @throws ClientReadWriteException on error.
    */
-  void readRequest();
+  void readFromClient();
 
   /*
-   * @brief sends the content of the buffer back to the remote server through
-   * the connection->send() function, the buffer is cleared and the mode is
-   * changed to Remote_read on success or off on failure.
+   * @brief sends the content of the request buffer to the remote server
+   * through the connection->send() function, the sent data is removed from
+   * the buffer. the send never blocks, what could not be sent stays in the
+   * buffer (as well as everything while the connect is in progress). the mode
+   * is changed to off on failure.
    *
-   * @throws ClientReadWriteException on error.
+   * @throws Connection::ConnectionException on error.
    */
-  void sendRequest();
+  void writeToRemote();
 
   /*
-   * @brief reads the response from the remote server through the
-   * connection->receive() function the response is then saved in the buffer the
-   * mode is changed to Client_write on success or off or fail.
+   * @brief reads the responses from the remote server through the
+   * connection->receive() function until the socket is drained or
+   * MAX_PENDING_SIZE bytes are pending, the data is appended to the response
+   * buffer (or spliced to the pipe in splice mode). the mode is changed to off
+   * on failure, on end of file the session is closed once the pending
+   * responses are sent.
    *
    * @throws Connection::ConnectionException on error.
    */
-  void receiveResponse();
+  void readFromRemote();
 
   /*
-   * @brief sends the content of the buffer back to the client through the
-   * client socket and saved to the buffer and the mode is changed to
-   * Client_read on success or off .
+   * @brief sends the content of the response buffer (or of the pipe in splice
+   * mode) to the client through the client socket, the sent data is removed
+   * from the buffer. the send never blocks, what could not be sent stays in
+   * the buffer. the mode is changed to off on failure.
    *
    * @throws ClientReadWriteException on error.
    */
-  void sendResponse();
+  void writeToClient();
 
   /*
-   * @brief reads the incoming response from the connection socket through
-   * connection->receive() then send it directly to the client through
-   * the client socket without saving to buffer.
-   * used when the client socket is ready for writing and the connection socket
-   * is ready for reading simultaneously
-   * in case of received data bigger then the sent data the rest is saved in
-   * buffer then receiveResponse() is called.
+   * @brief completion based I/O (ServerIoUring): the server receives and
+   * sends the data itself, these update the buffers and the state like
+   * readFromClient(), writeToRemote(), readFromRemote() and writeToClient()
+   * do.
    *
-   * the mode is changed to Client_read if all the data is sent, or Client_write
-   * in case of buffering in the case of error off is set.
+   * receivedFromClient() appends the data to the request buffer and splits
+   * it into messages (see getLastMessages()), the views point to data.
+   * clientClosed() and remoteClosed() record an end of file.
+   */
+  void receivedFromClient(std::string_view data);
+  void receivedFromRemote(std::string_view data);
+  void clientClosed();
+  void remoteClosed();
+
+  /*
+   * @brief describes the pending requests (responses) for a sendmsg, the
+   * buffers stay valid until sentToRemote() (sentToClient()) is called.
+   * @return the number of iovecs filled.
+   */
+  int peekRequests(iovec *iov, int max) const;
+  int peekResponses(iovec *iov, int max) const;
+
+  /*
+   * @brief removes len sent bytes from the request (response) buffer.
+   */
+  void sentToRemote(std::size_t len);
+  void sentToClient(std::size_t len);
+
+  /*
+   * @return the number of bytes pending in the request (response) buffer.
+   */
+  std::size_t getPendingRequestSize() const;
+  std::size_t getPendingResponseSize() const;
+
+  /*
+   * @brief completes the connect once the connection socket is writable.
+   * @return false while it is still in progress.
+   *
+   * @throws Connection::ConnectionException if the connect failed.
+   */
+  bool finishConnect();
+
+  /*
+   * @brief pooling or routing mode only, called after the last read requests
+   * were logged: answers the SSL/GSSAPI encryption requests with 'N', parses
+   * the StartupMessage (see getPoolKey() and isReadOnly()) and, in pooling
+   * mode, removes a Terminate message, the client is closed instead of the
+   * shared connection. in routing mode without pooling a CancelRequest is
+   * kept for the server (see getCancelRequest()).
+   *
+   * @throws ClientReadWriteException on an unsupported startup message
+   * (CancelRequest in pooling mode).
+   */
+  void processPooled();
+
+  /*
+   * @return the CancelRequest (16 bytes) read by processPooled() in routing
+   * mode, empty if the client did not send one.
+   */
+  const std::string &getCancelRequest() const;
+
+  /*
+   * @brief called after the last read requests were logged: answers a
+   * simple query from the result cache (the query is removed from the
+   * request buffer and the cached response appended to the response
+   * buffer), or on a miss captures its response for the cache.
    *
-   * @throws ClientReadWriteException or Connection::ConnectionException on
-   * error.
+   * only a query read alone while the session is idle (ReadyForQuery 'I')
+   * with no other request in flight is looked up, so the responses stay in
+   * order and nothing is cached inside a transaction. a response is stored
+   * if it ends with ReadyForQuery 'I' and has no ErrorResponse.
+   */
+  void processCached();
+
+  /*
+   * @return true if the client needs a connection from the pool (or its
+   * routed connection): its StartupMessage was read or it has requests to
+   * send.
+   */
+  bool needsBackend() const;
+
+  /*
+   * @brief assigns a connection to the client, the requests are sent to it.
+   */
+  void attach(Connection::uniq_ptr conn);
+
+  /*
+   * @brief takes the connection back from the client.
+   */
+  Connection::uniq_ptr detach();
+
+  /*
+   * @return true if the connection can go back to the pool: the session is
+   * established, the remote server answered every request with
+   * ReadyForQuery and is not in a transaction, no (partial) request is
+   * pending.
+   */
+  bool canRelease() const;
+
+  /*
+   * @return true if the client has a connection.
+   */
+  bool hasConnection() const;
+
+  /*
+   * @return true while the connection to the remote server is being
+   * established, the requests read meanwhile stay in the request buffer.
+   */
+  bool isConnecting() const;
+
+  /*
+   * @return true if the session can start over with another server: its
+   * connection could not be opened (or is still connecting) so nothing was
+   * exchanged with the remote server yet.
+   */
+  bool canRestart() const;
+
+  /*
+   * @brief drops the connection that could not be opened (the server removed
+   * it from its epoll set and pool first), the session waits for a new one
+   * as after its StartupMessage.
+   */
+  void restart();
+
+  /*
+   * @return the pool the client belongs to (user, database and the other
+   * parameters of its StartupMessage but application_name), also set without
+   * pooling when a result cache is used.
+   */
+  const std::string &getPoolKey() const;
+
+  /*
+   * @return true if the StartupMessage asked for read only transactions
+   * (default_transaction_read_only on, as a parameter or in the options):
+   * the session can be routed to a replica.
    */
-  void relay();
+  bool isReadOnly() const;
 
   /*
-   * @brief the server is ready to read the request from the client.
-   * @return true if mode == Client_read .
+   * @brief the session is served by a server of the BackendSet (its index),
+   * in pooling mode the pool key includes it. called again when the session
+   * moves to another server (see restart()).
    */
-  bool readyForRead() const;
+  void route(const int backend);
 
   /*
-   * @brief the server is ready to write the response to the client.
-   * @return true if mode == Client_write
+   * @return the index set by route(), -1 if the session was not routed.
    */
-  bool readyForWrite() const;
+  int getBackend() const;
+
+  Handshake getHandshake() const;
+
+  /*
+   * @brief true while the client is in the server's queue of the clients
+   * waiting for a connection, bookkeeping for the server.
+   */
+  bool &waitingBackend();
+
+  /*
+   * @brief true while the attached connection was opened outside of the pool
+   * to authenticate the client, it is closed instead of released,
+   * bookkeeping for the server.
+   */
+  bool &handshakeOnly();
+
+  /*
+   * @brief sets the mode to off, the server will close the client.
+   */
+  void disconnect();
+
+  /*
+   * @return true if there are requests waiting to be sent to the remote
+   * server.
+   */
+  bool hasPendingRequest() const;
+
+  /*
+   * @return true if there are responses waiting to be sent to the client.
+   */
+  bool hasPendingResponse() const;
 
   /*
-   * @brief  the server is ready to  write the query to the remote server
-   * through the connection socket.
-   * @return true if mode == Remote_write.
+   * @brief the epoll events to watch on the client socket: EPOLLIN while the
+   * request buffer is not full, EPOLLOUT only while a response is pending.
+   * @return an epoll events mask (0 when the client is off).
    */
-  bool readyToQueryServer() const;
+  uint32_t clientEvents() const;
 
   /*
-   * @brief the server is ready for reading the query response from the
-   * connection socket.
-   * @return true if mode == Remote_read | Client_read.
+   * @brief the epoll events to watch on the connection socket: EPOLLIN while
+   * the response buffer is not full, EPOLLOUT only while a request is pending
+   * or the connect is in progress.
+   * @return an epoll events mask (0 when the client is off).
    */
-  bool readyToReadServerResp() const;
+  uint32_t remoteEvents() const;
+
+  /*
+   * @brief the events currently registered in the epoll set for the client
+   * and the connection sockets, this is bookkeeping for the server so it only
+   * calls epoll_ctl when the interest changes.
+   */
+  uint32_t &watchedClientEvents();
+  uint32_t &watchedRemoteEvents();
+
+  /*
+   * @brief the link of the server's list of disconnected clients (intrusive,
+   * so queueing a client does not allocate) and whether the client is in it.
+   */
+  pointer &nextDead();
+  bool &deadQueued();
 
   /*
    * @brief checks if the client is still connected.
@@ -150,17 +395,45 @@ public:
   int getRemoteSocket() const;
 
   /*
-   * @brief buffer is a vector of chars that holds the incoming data related to
-   * this client.
+   * @brief the protocol messages completed by the last call to
+   * readFromClient(), the bodies are views that are only valid until the next
+   * read or write on this client.
    *
-   * @return _buffer.
+   * @return the messages in the order they were sent.
+   */
+  const std::vector<PgMessage> &getLastMessages() const;
+
+  /*
+   * @return the requests answered (ReadyForQuery) by the last read from the
+   * remote server, in order, with the time since they were read from the
+   * client. the views are valid until the next read from the remote server.
+   */
+  const std::vector<QueryTiming> &getCompletedQueries() const;
+
+  /*
+   * @brief keeps the text of the queries (cut to QUERY_TEXT_MAX bytes) for
+   * getCompletedQueries(), off by default: only the durations are tracked.
+   * for an extended query the text is the one of the last Parse before the
+   * Sync (empty if the statement was prepared earlier).
+   */
+  void keepQueryText(const bool keep);
+
+  /*
+   * @brief the state of the logging policy for this client (sampling and
+   * rate limit), bookkeeping for the logger.
    */
-  const std::vector<char> &getBuffer() const;
+  LogState &logState();
+
+  /*
+   * @brief the prepared statements and portals of the session, tracked by
+   * the logger (see ClientLogger::setStatementTracking()).
+   */
+  StatementCache &statements();
 
   /*
    * @return localIp  (the ip (ipv4) address of the client).
    */
-  std::string getIP() const;
+  const std::string &getIP() const;
 
   /*
    * @brief sets the id of a client.
@@ -173,6 +446,18 @@ public:
    */
   int getID() const;
 
+  /*
+   * @brief sets the metrics the bytes received are counted in (those of the
+   * server thread of the client), none by default.
+   */
+  void setMetrics(ServerMetrics *metrics);
+
+  /*
+   * @brief sets the result cache of the server (see processCached()), none
+   * by default. ignored in splice mode.
+   */
+  void setResultCache(ResultCache *cache);
+
   class ClientReadWriteException : public std::exception {
   private:
     std::string e;
@@ -185,14 +470,103 @@ public:
   };
 
 private:
+  /*
+   * @brief creates the pipe used to splice the responses and sets the sockets
+   * to non blocking (splice has no MSG_DONTWAIT), on failure the client keeps
+   * using the response buffer.
+   */
+  void initSplice();
+
+  /*
+   * @brief splice() versions of readFromRemote() and writeToClient().
+   */
+  void spliceFromRemote();
+  void spliceToClient();
+
+  /*
+   * @brief sets the mode to off when a peer closed its side and all the data
+   * it sent was delivered to the other peer.
+   */
+  void checkClosed();
+
+  /*
+   * @brief counts the requests of getLastMessages() that wait for a
+   * ReadyForQuery (latency, and the release of the connection in pooling
+   * mode).
+   */
+  void trackRequests();
+
+  /*
+   * @brief frames the responses appended to the response buffer, tracks
+   * ReadyForQuery.
+   */
+  void trackResponses(std::string_view data);
+
+  /*
+   * @brief drops the answered requests before a read from the remote server,
+   * the memory is kept so the steady state does not allocate.
+   */
+  void compactPending();
+
   int _clientSock = -1;
   std::string _localIP;
   std::string _remoteIP;
   int _remotePort;
   Mode _mode = Mode::OFF;
   Connection::uniq_ptr _connection;
-  std::vector<char> _buffer, _tmpBuff;
+  IOBuffer _requestBuffer;  // client -> remote server
+  IOBuffer _responseBuffer; // remote server -> client
+  bool _splice = false;
+  int _pipe[2] = {-1, -1};   // splice pipe, read end / write end
+  std::size_t _pipeSize = 0; // number of response bytes in the pipe
+  MessageFramer _framer;
+  std::vector<PgMessage> _lastMessages;
+  bool _clientEOF = false;
+  bool _remoteEOF = false;
   int _ID;
+  uint32_t _watchedClientEvents = 0;
+  uint32_t _watchedRemoteEvents = 0;
+  pointer _nextDead;
+  bool _deadQueued = false;
+  ServerMetrics *_metrics = nullptr;
+  LogState _logState;
+  StatementCache _statements;
+
+  // latency: the requests waiting for their ReadyForQuery, in order
+  struct PendingQuery {
+    std::chrono::steady_clock::time_point start;
+    std::size_t textBegin, textEnd; // in _pendingText
+    bool failed;
+  };
+  bool _frameResponses = false; // the responses are typed messages from now on
+  bool _keepQueryText = false;
+  std::vector<PendingQuery> _pendingQueries;
+  std::size_t _pendingHead = 0; // the first request not answered
+  std::string _pendingText;
+  std::string _parseText; // the query of the last Parse before a Sync
+  std::vector<QueryTiming> _completedQueries;
+  char _status = 0; // of the last ReadyForQuery
+
+  // result cache
+  ResultCache *_cache = nullptr;
+  std::string _cacheKey;
+  bool _capturing = false; // the response of the query is kept in _capture
+  std::string _capture;
+
+  // pooling mode
+  bool _pooled = false;
+  bool _routed = false;
+  bool _readOnly = false;
+  int _backend = -1;
+  Handshake _handshake = Handshake::READY;
+  std::string _poolKey;
+  std::string _cancelRequest;
+  MessageFramer _responseFramer{false};
+  std::vector<PgMessage> _responseMessages;
+  std::size_t _pendingSyncs = 0; // requests waiting for a ReadyForQuery
+  bool _releasable = false;
+  bool _waitingBackend = false;
+  bool _handshakeOnly = false;
 };
 
 #endif //__CLIENT_HPP_
@@ -0,0 +1,200 @@
+#include "Compression.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cstring>
+
+namespace {
+
+constexpr std::size_t MIN_MATCH = 4;
+// the last bytes of a block are literals and no match starts in the last
+// MATCH_LIMIT bytes (the format of LZ4, a decoder can copy by words)
+constexpr std::size_t LAST_LITERALS = 5;
+constexpr std::size_t MATCH_LIMIT = 12;
+constexpr std::size_t MAX_OFFSET = 65535;
+constexpr int HASH_BITS = 14;
+static_assert((1 << HASH_BITS) == COMPRESS_TABLE_SIZE, "hash table size");
+
+inline uint32_t read32(const char *p) {
+  uint32_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline uint64_t read64(const char *p) {
+  uint64_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline uint32_t hash(uint32_t sequence) {
+  // Knuth's multiplicative hash, the high bits index the table
+  return (sequence * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// a length of 15 or more continues in bytes of 255 and a last one below
+inline char *writeLength(char *op, std::size_t len) {
+  for (; len >= 255; len -= 255)
+    *op++ = static_cast<char>(255);
+  *op++ = static_cast<char>(len);
+  return op;
+}
+
+inline bool readLength(const uint8_t *&ip, const uint8_t *end,
+                       std::size_t &len) {
+  uint8_t byte;
+  do {
+    if (ip == end)
+      return false;
+    byte = *ip++;
+    len += byte;
+  } while (byte == 255);
+  return true;
+}
+
+char *writeSequence(char *op, const char *literals, std::size_t literalLen,
+                    std::size_t offset, std::size_t matchLen) {
+  char *token = op++;
+  *token = static_cast<char>(std::min<std::size_t>(literalLen, 15) << 4);
+  if (literalLen >= 15)
+    op = writeLength(op, literalLen - 15);
+  std::memcpy(op, literals, literalLen);
+  op += literalLen;
+  if (offset == 0)
+    return op; // the last sequence only has literals
+
+  *op++ = static_cast<char>(offset & 0xff);
+  *op++ = static_cast<char>(offset >> 8);
+  matchLen -= MIN_MATCH;
+  *token |= static_cast<char>(std::min<std::size_t>(matchLen, 15));
+  if (matchLen >= 15)
+    op = writeLength(op, matchLen - 15);
+  return op;
+}
+
+} // namespace
+
+std::size_t compressBlock(const char *src, std::size_t n, char *dst,
+                          uint32_t *table) {
+  const char *ip = src;
+  const char *anchor = src; // the first literal not written
+  const char *end = src + n;
+  char *op = dst;
+
+  if (n > MATCH_LIMIT) {
+    std::fill(table, table + COMPRESS_TABLE_SIZE, 0);
+    const char *limit = end - MATCH_LIMIT;
+    const char *matchEnd = end - LAST_LITERALS;
+
+    while (ip < limit) {
+      uint32_t sequence = read32(ip);
+      uint32_t &entry = table[hash(sequence)];
+      const char *ref = src + entry;
+      entry = static_cast<uint32_t>(ip - src);
+      if (ref >= ip || static_cast<std::size_t>(ip - ref) > MAX_OFFSET ||
+          read32(ref) != sequence) {
+        // the longer without a match the bigger the steps (incompressible
+        // data is skipped quickly)
+        ip += 1 + ((ip - anchor) >> 6);
+        continue;
+      }
+
+      while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+        --ip;
+        --ref;
+      }
+      const char *mp = ip + MIN_MATCH;
+      const char *mr = ref + MIN_MATCH;
+      while (mp + 8 <= matchEnd && read64(mp) == read64(mr)) {
+        mp += 8;
+        mr += 8;
+      }
+      while (mp < matchEnd && *mp == *mr) {
+        ++mp;
+        ++mr;
+      }
+
+      op = writeSequence(op, anchor, ip - anchor, ip - ref, mp - ip);
+      ip = anchor = mp;
+      // the end of a match is often the start of the next one
+      if (ip < limit)
+        table[hash(read32(ip - 2))] = static_cast<uint32_t>(ip - 2 - src);
+    }
+  }
+
+  return writeSequence(op, anchor, end - anchor, 0, 0) - dst;
+}
+
+bool decompressBlock(const char *src, std::size_t n, char *dst,
+                     std::size_t rawSize) {
+  const uint8_t *ip = reinterpret_cast<const uint8_t *>(src);
+  const uint8_t *end = ip + n;
+  char *op = dst;
+  char *outEnd = dst + rawSize;
+
+  while (ip < end) {
+    uint8_t token = *ip++;
+    std::size_t literalLen = token >> 4;
+    if (literalLen == 15 && !readLength(ip, end, literalLen))
+      return false;
+    if (literalLen > static_cast<std::size_t>(end - ip) ||
+        literalLen > static_cast<std::size_t>(outEnd - op))
+      return false;
+    std::memcpy(op, ip, literalLen);
+    op += literalLen;
+    ip += literalLen;
+    if (ip == end)
+      break; // the last sequence
+
+    if (end - ip < 2)
+      return false;
+    std::size_t offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    std::size_t matchLen = token & 15;
+    if (matchLen == 15 && !readLength(ip, end, matchLen))
+      return false;
+    matchLen += MIN_MATCH;
+    if (offset == 0 || offset > static_cast<std::size_t>(op - dst) ||
+        matchLen > static_cast<std::size_t>(outEnd - op))
+      return false;
+
+    const char *match = op - offset;
+    if (offset >= matchLen) {
+      std::memcpy(op, match, matchLen);
+      op += matchLen;
+    } else {
+      // the match overlaps what it writes (a repeated pattern)
+      for (std::size_t i = 0; i < matchLen; ++i)
+        *op++ = *match++;
+    }
+  }
+  return op == outEnd;
+}
+
+bool decompressFrame(const char *&p, const char *end, std::string &out) {
+  if (end - p < COMPRESSED_FRAME_HEADER ||
+      std::memcmp(p, COMPRESSED_LOG_MAGIC, 4) != 0)
+    return false;
+
+  uint32_t rawSize, storedSize;
+  std::memcpy(&rawSize, p + 4, 4);
+  std::memcpy(&storedSize, p + 8, 4);
+  rawSize = ntohl(rawSize);
+  storedSize = ntohl(storedSize);
+  bool raw = (storedSize & COMPRESSED_BLOCK_RAW) != 0;
+  storedSize &= ~COMPRESSED_BLOCK_RAW;
+  const char *data = p + COMPRESSED_FRAME_HEADER;
+  if (static_cast<std::size_t>(end - data) < storedSize ||
+      rawSize > COMPRESS_BLOCK_SIZE || (raw && storedSize != rawSize))
+    return false;
+
+  std::size_t offset = out.size();
+  out.resize(offset + rawSize);
+  if (raw)
+    std::memcpy(&out[offset], data, rawSize);
+  else if (!decompressBlock(data, storedSize, &out[offset], rawSize)) {
+    out.resize(offset);
+    return false;
+  }
+  p = data + storedSize;
+  return true;
+}
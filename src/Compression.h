@@ -0,0 +1,70 @@
+#ifndef __COMPRESSION_HPP_
+#define __COMPRESSION_HPP_
+
+/*
+ * a dependency free block compressor for the query logs, LZ4 style: the
+ * block is a sequence of literals and matches (offset in the previous 64 KiB
+ * of the block, at least 4 bytes) found with a hash table of 4 byte
+ * sequences, no entropy coding. it trades ratio for speed, the log text is
+ * very repetitive (dates, ips, query shapes) so it still compresses well.
+ *
+ * a compressed log is a sequence of frames, each one holds a block and is
+ * decoded on its own (no dictionary is shared between the blocks):
+ *   magic "PQLZ", raw size (4 bytes), stored size (4 bytes), stored data
+ * the sizes are in network order, the high bit of the stored size is set when
+ * the block is stored as is (it did not compress). a block holds at most
+ * COMPRESS_BLOCK_SIZE raw bytes.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#define COMPRESSED_LOG_MAGIC "PQLZ"
+#define COMPRESSED_FRAME_HEADER 12
+#define COMPRESSED_BLOCK_RAW 0x80000000u
+
+// the maximum raw size of a block
+#define COMPRESS_BLOCK_SIZE (256 * 1024)
+
+// the largest frame (a full block that did not compress, stored as is)
+#define COMPRESSED_FRAME_MAX (COMPRESSED_FRAME_HEADER + COMPRESS_BLOCK_SIZE)
+
+// the number of entries of the hash table compressBlock() works with
+#define COMPRESS_TABLE_SIZE (1 << 14)
+
+/*
+ * @return the maximum size of the compressed block of n bytes.
+ */
+inline std::size_t compressBound(std::size_t n) { return n + n / 255 + 16; }
+
+/*
+ * @brief compresses the n bytes of src to dst.
+ *
+ * @param dst : compressBound(n) bytes.
+ * @param table : COMPRESS_TABLE_SIZE entries, reset by the call (kept by the
+ * caller so the compression does not allocate).
+ *
+ * @return the size of the compressed block.
+ */
+std::size_t compressBlock(const char *src, std::size_t n, char *dst,
+                          uint32_t *table);
+
+/*
+ * @brief decompresses the block of n bytes of src to the rawSize bytes of
+ * dst.
+ *
+ * @return false if the block is corrupted or does not decompress to exactly
+ * rawSize bytes.
+ */
+bool decompressBlock(const char *src, std::size_t n, char *dst,
+                     std::size_t rawSize);
+
+/*
+ * @brief decodes the frame at p, appends its raw data to out and advances p.
+ *
+ * @return false if the frame is truncated or corrupted.
+ */
+bool decompressFrame(const char *&p, const char *end, std::string &out);
+
+#endif // __COMPRESSION_HPP_
@@ -1,5 +1,6 @@
 #include "Connection.h"
 #include <arpa/inet.h>
+#include <cerrno>
 #include <string>
 #include <sys/socket.h>
 
@@ -10,19 +11,26 @@ Connection::Connection(const std::string &connIP, const int connPort)
   _connAddr.sin_family = AF_INET;
   if (!inet_aton(_connIP.c_str(), &_connAddr.sin_addr))
     throw ConnectionException(strerror(errno));
-  if ((_connSock = socket(AF_INET, SOCK_STREAM, 0)) < 0)
-    throw ConnectionException(strerror(errno));
-  int flags = fcntl(_connSock, F_GETFD);
-  flags |= O_NONBLOCK;
-  fcntl(_connSock, F_SETFD, flags);
-  if (connect(_connSock, (const sockaddr *)&_connAddr, sizeof(_connAddr)) < 0)
+  if ((_connSock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                          0)) < 0)
     throw ConnectionException(strerror(errno));
+  // the event loop never waits for the connect, it watches EPOLLOUT
+  if (connect(_connSock, (const sockaddr *)&_connAddr, sizeof(_connAddr)) <
+      0) {
+    if (errno != EINPROGRESS) {
+      close(_connSock);
+      _connSock = -1;
+      throw ConnectionException(strerror(errno));
+    }
+    _connecting = true;
+  }
 }
 
 Connection::Connection(Connection &&other)
     : _connIP(std::move(other._connIP)), _connPort(other._connPort),
       _connSock(other._connSock), _connAddr(std::move(other._connAddr)) {
   other._connSock = -1;
+  _connecting = other._connecting;
 }
 
 Connection::~Connection() {
@@ -30,17 +38,52 @@ Connection::~Connection() {
     close(_connSock);
 }
 
-long Connection::send(const std::vector<char> &buff) const {
-  long out = ::send(_connSock, buff.data(), buff.size(), 0);
+long Connection::send(const iovec *iov, int count) const {
+  msghdr msg{};
+  msg.msg_iov = const_cast<iovec *>(iov);
+  msg.msg_iovlen = count;
+  long out = sendmsg(_connSock, &msg, MSG_DONTWAIT);
   return out;
 };
 
-long Connection::receive(std::vector<char> &buff, size_t maxLen) const {
-  buff.resize(maxLen);
-  long out = recv(_connSock, buff.data(), maxLen, 0);
+long Connection::receive(char *buff, size_t maxLen) const {
+  long out = recv(_connSock, buff, maxLen, MSG_DONTWAIT);
   return out;
 }
 
+bool Connection::isConnecting() const { return _connecting; }
+
+bool Connection::finishConnect() {
+  if (!_connecting)
+    return true;
+
+  int err = 0;
+  socklen_t len = sizeof(err);
+  if (getsockopt(_connSock, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+    err = errno;
+  if (err == EINPROGRESS || err == EALREADY)
+    return false;
+  if (err != 0)
+    throw ConnectionException(strerror(err));
+
+  // SO_ERROR is 0 as well before the connect is over
+  sockaddr_in peer;
+  len = sizeof(peer);
+  if (getpeername(_connSock, (sockaddr *)&peer, &len) < 0) {
+    if (errno == ENOTCONN)
+      return false;
+    throw ConnectionException(strerror(errno));
+  }
+  _connecting = false;
+  return true;
+}
+
+bool Connection::isIdle() const {
+  char byte;
+  long out = recv(_connSock, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+  return out < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
 int Connection::getConnectionSocket() const { return _connSock; }
 
 Connection::ConnectionException::ConnectionException() {
@@ -8,6 +8,7 @@
 #include <memory>
 #include <netinet/in.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <vector>
 
@@ -17,7 +18,9 @@ public:
   using raw_ptr = Connection *;
   using uniq_ptr = std::unique_ptr<Connection>;
   /*
-   * @brief opens a socket to connect to the remote server.
+   * @brief opens a non blocking socket and starts connecting to the remote
+   * server, the connection is usually still in progress when the constructor
+   * returns (see isConnecting()).
    *
    * @param connIP: is the ip (ipv4) of the remote server.
    * @param connPort: is the remote server port.
@@ -42,31 +45,58 @@ public:
   ~Connection();
 
   /*
-   * @brief send a buffer of chars through the socket.
+   * @brief send buffers of chars through the socket.
    *
-   * tries to write buff.size() bytes from buff to the socket using send
-   * function from <sys/socket.h>
+   * tries to write the content of the iovecs to the socket using sendmsg
+   * function from <sys/socket.h> (scatter-gather, one call for several
+   * buffers), the call never blocks (MSG_DONTWAIT).
    *
-   * @param buff vector or chars is the buffer which content is to be written
+   * @param iov is the buffers which content is to be written
+   * @param count is the number of buffers
    *
    * returns the number of bytes sent, or -1 on error
    */
-  long send(const std::vector<char> &buff) const;
+  long send(const iovec *iov, int count) const;
 
   /*
    * @brief receives data from the server socket and writes it to buff.
    *
-   * tries to read at most maxlen bytes of data using recv and writes it to the
-   * buff, note that this functions does not change the size of the vector nor
-   * it does allocate memory for the content, this should be the responsibility
-   * of the caller.
+   * tries to read at most maxlen bytes of data using recv (MSG_DONTWAIT) and
+   * writes it to the buff, note that this functions does not allocate memory
+   * for the content, this should be the responsibility of the caller.
    *
    * @param buff: is the buffer to which content will be written
    * @param maxLen: is the maximum number to read from the socket
    *
    * returns the number of bytes received, or -1 on error
    */
-  long receive(std::vector<char> &buff, size_t maxLen) const;
+  long receive(char *buff, size_t maxLen) const;
+
+  /*
+   * @return true while the connect is in progress, the socket becomes
+   * writable (EPOLLOUT) when it is over.
+   */
+  bool isConnecting() const;
+
+  /*
+   * @brief checks the result of the connect (SO_ERROR) once the socket is
+   * writable.
+   *
+   * @return true if the connection is established, false if it is still in
+   * progress.
+   *
+   * throws ConnectionException if the connect failed.
+   */
+  bool finishConnect();
+
+  /*
+   * @brief checks an idle connection without reading it (recv MSG_PEEK).
+   *
+   * @return false if the remote server closed it or sent something while it
+   * was idle (a FATAL ErrorResponse, a notification ...), it can't be used
+   * anymore.
+   */
+  bool isIdle() const;
 
   /*
    * returns _connSock
@@ -94,6 +124,7 @@ private:
   int _connPort;
   int _connSock = -1;
   sockaddr_in _connAddr;
+  bool _connecting = false;
 };
 
 #endif //__CONNECTION_HPP_
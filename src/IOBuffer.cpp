@@ -0,0 +1,143 @@
+#include "IOBuffer.h"
+#include <algorithm>
+#include <cstring>
+
+IOBuffer::IOBuffer(BufferPool &pool) : _pool(pool) {}
+
+IOBuffer::~IOBuffer() { clear(); }
+
+std::size_t IOBuffer::size() const { return _size; }
+
+bool IOBuffer::empty() const { return _size == 0; }
+
+std::size_t IOBuffer::chunkEnd(const BufferChunk *chunk) const {
+  return chunk == _tail ? _tailUsed : BufferChunk::DATA_SIZE;
+}
+
+char *IOBuffer::writeSpace(std::size_t &len) {
+  if (_tail == nullptr) {
+    _head = _tail = _pool.acquire();
+    _headOffset = _tailUsed = 0;
+  } else if (_tailUsed == BufferChunk::DATA_SIZE) {
+    _tail->next = _pool.acquire();
+    _tail = _tail->next;
+    _tailUsed = 0;
+  }
+  len = BufferChunk::DATA_SIZE - _tailUsed;
+  return _tail->data + _tailUsed;
+}
+
+void IOBuffer::commit(std::size_t len) {
+  _tailUsed += len;
+  _size += len;
+}
+
+void IOBuffer::append(const char *data, std::size_t len) {
+  while (len > 0) {
+    std::size_t space;
+    char *p = writeSpace(space);
+    std::size_t n = std::min(len, space);
+    std::memcpy(p, data, n);
+    commit(n);
+    data += n;
+    len -= n;
+  }
+}
+
+int IOBuffer::peek(iovec *iov, int max) const {
+  int count = 0;
+  if (_size == 0)
+    return 0;
+
+  const BufferChunk *chunk = _head;
+  std::size_t start = _headOffset;
+  while (chunk != nullptr && count < max) {
+    iov[count].iov_base = const_cast<char *>(chunk->data) + start;
+    iov[count++].iov_len = chunkEnd(chunk) - start;
+    chunk = chunk == _tail ? nullptr : chunk->next;
+    start = 0;
+  }
+  return count;
+}
+
+void IOBuffer::consume(std::size_t len) {
+  len = std::min(len, _size);
+  _size -= len;
+  while (len > 0) {
+    std::size_t n = std::min(len, chunkEnd(_head) - _headOffset);
+    _headOffset += n;
+    len -= n;
+    if (_headOffset == chunkEnd(_head) && _head != _tail) {
+      BufferChunk *next = _head->next;
+      _pool.release(_head);
+      _head = next;
+      _headOffset = 0;
+    }
+  }
+  // an empty buffer holds no memory
+  if (_size == 0)
+    clear();
+}
+
+void IOBuffer::dropBack(std::size_t len) {
+  len = std::min(len, _size);
+  _size -= len;
+  while (len > 0) {
+    std::size_t start = _tail == _head ? _headOffset : 0;
+    std::size_t n = std::min(len, _tailUsed - start);
+    _tailUsed -= n;
+    len -= n;
+    if (_tailUsed == start && _tail != _head) {
+      // the chain is singly linked, find the chunk before the tail
+      BufferChunk *prev = _head;
+      while (prev->next != _tail)
+        prev = prev->next;
+      _pool.release(_tail);
+      prev->next = nullptr;
+      _tail = prev;
+      _tailUsed = BufferChunk::DATA_SIZE;
+    }
+  }
+  if (_size == 0)
+    clear();
+}
+
+std::size_t IOBuffer::copyOut(std::size_t offset, char *dst,
+                              std::size_t len) const {
+  std::size_t copied = 0;
+  const BufferChunk *chunk = _head;
+  std::size_t start = _headOffset;
+
+  if (_size == 0)
+    return 0;
+  while (chunk != nullptr && copied < len) {
+    std::size_t avail = chunkEnd(chunk) - start;
+    if (offset >= avail) {
+      offset -= avail;
+    } else {
+      std::size_t n = std::min(len - copied, avail - offset);
+      std::memcpy(dst + copied, chunk->data + start + offset, n);
+      copied += n;
+      offset = 0;
+    }
+    chunk = chunk == _tail ? nullptr : chunk->next;
+    start = 0;
+  }
+  return copied;
+}
+
+void IOBuffer::trim() {
+  if (_size == 0)
+    clear();
+}
+
+void IOBuffer::clear() {
+  while (_head != nullptr) {
+    BufferChunk *next = _head == _tail ? nullptr : _head->next;
+    _pool.release(_head);
+    _head = next;
+  }
+  _head = _tail = nullptr;
+  _headOffset = _tailUsed = 0;
+  _size = 0;
+}
@@ -0,0 +1,105 @@
+#ifndef __IO_BUFFER_HPP_
+#define __IO_BUFFER_HPP_
+
+#include <cstddef>
+#include <sys/uio.h>
+
+#include "BufferPool.h"
+
+/*
+ * @brief a fifo of bytes made of a chain of chunks borrowed from a
+ * BufferPool.
+ *
+ * the data is written at the tail (directly by recv() through writeSpace()
+ * and commit()) and consumed from the head, consuming only moves a cursor and
+ * gives the emptied chunks back to the pool (a partial send costs the same
+ * whatever the amount queued), an empty buffer holds no chunk.
+ */
+class IOBuffer {
+
+public:
+  IOBuffer(BufferPool &pool);
+
+  /*
+   * @brief gives the chunks back to the pool.
+   */
+  ~IOBuffer();
+
+  IOBuffer(const IOBuffer &other) = delete;
+  IOBuffer &operator=(const IOBuffer &other) = delete;
+
+  /*
+   * @return the number of bytes in the buffer.
+   */
+  std::size_t size() const;
+
+  bool empty() const;
+
+  /*
+   * @brief the free space at the tail, a chunk is borrowed if the tail one is
+   * full.
+   *
+   * @param len : set to the size of the space.
+   * @return where the next bytes can be written, commit() adds them.
+   */
+  char *writeSpace(std::size_t &len);
+
+  /*
+   * @brief adds len bytes written to the space given by writeSpace().
+   */
+  void commit(std::size_t len);
+
+  /*
+   * @brief copies data at the tail.
+   */
+  void append(const char *data, std::size_t len);
+
+  /*
+   * @brief describes the data from the head, one iovec per chunk, for a
+   * scatter-gather send (writev/sendmsg) of several chunks at once.
+   *
+   * @param iov : filled with the chunks.
+   * @param max : the size of iov.
+   * @return the number of iovecs filled.
+   */
+  int peek(iovec *iov, int max) const;
+
+  /*
+   * @brief removes len bytes from the head.
+   */
+  void consume(std::size_t len);
+
+  /*
+   * @brief removes len bytes from the tail.
+   */
+  void dropBack(std::size_t len);
+
+  /*
+   * @brief copies len bytes from offset (from the head) to dst.
+   * @return the number of bytes copied (less if the buffer is shorter).
+   */
+  std::size_t copyOut(std::size_t offset, char *dst, std::size_t len) const;
+
+  /*
+   * @brief gives the chunks back to the pool if the buffer is empty (a chunk
+   * borrowed by writeSpace() and not used).
+   */
+  void trim();
+
+  void clear();
+
+private:
+  /*
+   * @return where the data of the chunk ends.
+   */
+  std::size_t chunkEnd(const BufferChunk *chunk) const;
+
+  BufferPool &_pool;
+  BufferChunk *_head = nullptr;
+  BufferChunk *_tail = nullptr;
+  std::size_t _headOffset = 0; // the first byte in the head chunk
+  std::size_t _tailUsed = 0;   // the bytes written in the tail chunk
+  std::size_t _size = 0;
+};
+
+#endif // __IO_BUFFER_HPP_
@@ -1,8 +1,49 @@
 #ifndef __I_SERVER_HPP_
 #define __I_SERVER_HPP_
 
+#include "BackendSet.h"
 #include "Logger.h"
+#include "Metrics.h"
+#include "ResultCache.h"
+#include <cstddef>
 #include <string>
+#include <vector>
+
+/*
+ * optional settings of a server, the defaults give a single threaded server
+ * relaying both directions through user space buffers.
+ */
+struct ServerOptions {
+  // set SO_REUSEPORT on the listening socket (one server per thread)
+  bool reusePort = false;
+  // relay the responses (remote server -> client) with splice()
+  bool splice = false;
+  // share this many connections per user/database between the clients,
+  // assigned per transaction (0: one connection per client)
+  std::size_t poolSize = 0;
+  // close the clients whose connection to the remote server is not
+  // established after this many milliseconds (0: no timeout)
+  long connectTimeout = 10000;
+  // back the session buffers with huge pages
+  bool hugePages = false;
+  // the length of the accept queue of the listening socket (capped by
+  // net.core.somaxconn)
+  int backlog = 4096;
+  // the number of clients served at once, per thread (0: no limit)
+  std::size_t maxClients = 0;
+  // the number of connections accepted per loop iteration, so a connection
+  // storm can not starve the established clients
+  std::size_t acceptBatch = 64;
+  // beyond maxClients, accept and close the new connections with a "too many
+  // connections" error instead of leaving them in the accept queue
+  bool rejectOverLimit = false;
+  // answer the allowed read only queries from this cache (shared by the
+  // threads), none by default. not used in splice mode
+  ResultCache::pointer resultCache;
+  // route the read only sessions to these replicas of the remote server
+  // (shared by the threads), none by default. not used in splice mode
+  BackendSet::pointer backends;
+};
 
 class IServer {
 
@@ -13,13 +54,15 @@ public:
    * @param remoteIP : the ip (ipv4) address of the remote server
    * @param remotePort : the port of the remote server
    * @param clientLogger : the object responsible of logging the client
+   * @param options : the optional settings of the server
    */
 
   IServer(const std::string &localIP, const int localPort,
           const std::string &remoteIP, const int remotePort,
-          const ClientLogger::pointer &logger)
+          const ClientLogger::pointer &logger,
+          const ServerOptions &options = ServerOptions())
       : _localIP(localIP), _localPort(localPort), _remoteIP(remoteIP),
-        _remotePort(remotePort), _logger(logger) {}
+        _remotePort(remotePort), _logger(logger), _options(options) {}
 
   /*
    * destructor for the server
@@ -41,12 +84,19 @@ public:
    */
   virtual void stop() = 0;
 
+  /*
+   * the metrics of each event loop thread of the server, valid for the
+   * lifetime of the server (after init())
+   */
+  virtual std::vector<const ServerMetrics *> getMetrics() const { return {}; }
+
 protected:
   std::string _localIP;
   uint32_t _localPort;
   std::string _remoteIP;
   uint32_t _remotePort;
   ClientLogger::pointer _logger;
+  ServerOptions _options;
 };
 
 #endif // __I_SERVER_HPP_
@@ -0,0 +1,13 @@
+#include "LogFormat.h"
+
+void fillMessageTypes(std::array<std::string, 256> &types) {
+  types['Q'] = "simple query";
+  types['B'] = "extended query bind";
+  types['P'] = "extended query parse";
+  types['D'] = "extended query describe";
+  types['E'] = "extended query execute";
+  types['C'] = "extended query close";
+  types['F'] = "extended function call";
+  types[(unsigned char)LOG_ERROR_TYPE] = "error";
+  types[(unsigned char)LOG_EXECUTE_TYPE] = "execute";
+}
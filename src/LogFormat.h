@@ -0,0 +1,97 @@
+#ifndef __LOG_FORMAT_HPP_
+#define __LOG_FORMAT_HPP_
+
+/*
+ * the formats of the query log.
+ *
+ * text: one line per query message
+ *   date \t time \t\t - \t IP: ip \t - \t client id: (type) \t\t query \n
+ *
+ * binary: a sequence of records, each one starts with a one byte tag
+ *   'H' magic "PQLG", version (1 byte): starts a log or a segment, resets
+ *       the sessions and the timestamp base (0).
+ *   'S' client id (varint), ip length (varint), ip: written when the session
+ *       starts and again after each 'H' while it lasts.
+ *   'M' timestamp delta in microseconds from the previous 'M' record (zigzag
+ *       varint, the absolute timestamp after an 'H'), client id (varint),
+ *       message type (1 byte), query length (varint), query: one per query
+ *       message.
+ * the integers are LEB128 varints. each segment of a binary log starts with
+ * an 'H' so it can be decoded on its own, unless a batch bigger than a
+ * segment spans it and the previous one.
+ */
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#define BINARY_LOG_MAGIC "PQLG"
+#define BINARY_LOG_VERSION 1
+#define BINARY_LOG_HEADER 'H'
+#define BINARY_LOG_SESSION 'S'
+#define BINARY_LOG_MESSAGE 'M'
+
+// not a message of the protocol: the type of the queries that failed, logged
+// by a logging policy that drops messages (see LogPolicy)
+#define LOG_ERROR_TYPE '!'
+
+// not a message of the protocol either: an Execute logged with the query of
+// its statement and its parameters (see StatementCache)
+#define LOG_EXECUTE_TYPE '='
+
+// the maximum size of an encoded varint
+#define MAX_VARINT_SIZE 10
+
+enum class LogFormat {
+  TEXT,  // human readable lines
+  BINARY // compact records, decoded by LogDecoder
+};
+
+/*
+ * @brief fills types with the description of the message types that are
+ * logged (an empty string for the messages that are not logged).
+ * https://www.postgresql.org/docs/current/protocol-message-formats.html
+ * we can add more entries to this function to log other messages (commands,
+ * copy ...)
+ */
+void fillMessageTypes(std::array<std::string, 256> &types);
+
+/*
+ * @brief writes v as a LEB128 varint.
+ * @return the number of bytes written (at most MAX_VARINT_SIZE).
+ */
+inline std::size_t putVarint(char *out, uint64_t v) {
+  std::size_t n = 0;
+  while (v >= 0x80) {
+    out[n++] = static_cast<char>(v | 0x80);
+    v >>= 7;
+  }
+  out[n++] = static_cast<char>(v);
+  return n;
+}
+
+/*
+ * @brief reads a LEB128 varint and advances p.
+ * @return false if the varint is truncated or too long.
+ */
+inline bool getVarint(const char *&p, const char *end, uint64_t &v) {
+  v = 0;
+  for (int shift = 0; p < end && shift < 64; shift += 7) {
+    uint8_t byte = static_cast<uint8_t>(*p++);
+    v |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0)
+      return true;
+  }
+  return false;
+}
+
+inline uint64_t zigzag(int64_t v) {
+  return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+}
+
+inline int64_t unzigzag(uint64_t v) {
+  return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+}
+
+#endif // __LOG_FORMAT_HPP_
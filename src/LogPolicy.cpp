@@ -0,0 +1,207 @@
+#include "LogPolicy.h"
+#include "LogFormat.h"
+#include "QueryStats.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+constexpr int64_t NANOS_PER_SECOND = 1000000000;
+
+// the rate in messages per second as nanoseconds per token (0 for no limit)
+int64_t toInterval(double rate) {
+  if (rate <= 0)
+    return 0;
+  return std::max<int64_t>(1, std::llround(NANOS_PER_SECOND / rate));
+}
+
+// xorshift64*, one generator per event loop thread
+uint64_t random64() {
+  thread_local uint64_t state =
+      0x9E3779B97F4A7C15ULL ^
+      std::chrono::steady_clock::now().time_since_epoch().count();
+  state ^= state >> 12;
+  state ^= state << 25;
+  state ^= state >> 27;
+  return state * 0x2545F4914F6CDD1DULL;
+}
+
+} // namespace
+
+LogPolicy::LogPolicy(const LogPolicyOptions &options)
+    : _sampleEvery(options.sampleEvery), _alwaysDDL(options.alwaysDDL),
+      _alwaysErrors(options.alwaysErrors) {
+  if (options.sampleEvery == 0)
+    throw LogPolicyException("the sampling must log 1 request in N >= 1");
+  if (!(options.sampleRate > 0 && options.sampleRate <= 1))
+    throw LogPolicyException("the sampling rate must be in ]0, 1]");
+  if (options.rate < 0 || options.clientRate < 0)
+    throw LogPolicyException("the log rates can not be negative");
+
+  std::array<std::string, 256> names;
+  fillMessageTypes(names);
+  for (std::size_t i = 0; i < names.size(); ++i) {
+    if (names[i].empty() || i == static_cast<unsigned char>(LOG_ERROR_TYPE))
+      _types[i] = Type::IGNORED;
+    else
+      _types[i] = options.types.empty() ? Type::LOGGED : Type::DISABLED;
+  }
+  for (char c : options.types) {
+    Type &type = _types[static_cast<unsigned char>(c)];
+    if (type == Type::IGNORED)
+      throw LogPolicyException(
+          (std::string("not a query message type: ") + c).c_str());
+    type = Type::LOGGED;
+  }
+
+  _sampleThreshold =
+      static_cast<uint64_t>(std::ldexp(options.sampleRate, 32));
+  _interval = toInterval(options.rate);
+  _clientInterval = toInterval(options.clientRate);
+  _passAll = std::none_of(_types.begin(), _types.end(),
+                          [](Type t) { return t == Type::DISABLED; }) &&
+             _sampleEvery == 1 && options.sampleRate >= 1 && _interval == 0 &&
+             _clientInterval == 0;
+}
+
+bool LogPolicy::decide(const PgMessage &m, LogState &s, Tally &t,
+                       std::string_view query) {
+  if (!s.inRequest) {
+    // the first message of a request decides for the whole request
+    s.inRequest = true;
+    s.sampled = s.requests++ % _sampleEvery == 0 &&
+                (_sampleThreshold >= (uint64_t(1) << 32) ||
+                 (random64() >> 32) < _sampleThreshold);
+  }
+  if (m.type == 'Q' || m.type == 'F')
+    s.inRequest = false;
+
+  Reason reason = s.sampled ? limit(s) : SAMPLED;
+  if (reason == REASONS)
+    return true;
+
+  // the overrides only count the messages they saved
+  if (query.empty())
+    query = QueryStats::extractQuery(m.type, m.body);
+  if (_alwaysDDL && isDDL(query)) {
+    ++t.forced;
+    return true;
+  }
+  ++t.dropped[reason];
+  return false;
+}
+
+LogPolicy::Reason LogPolicy::limit(LogState &s) {
+  if (_interval == 0 && _clientInterval == 0)
+    return REASONS;
+
+  int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch())
+                    .count();
+  if (_clientInterval > 0 && !take(s.tat, now, _clientInterval))
+    return CLIENT_RATE;
+  if (_interval > 0 && !takeGlobal(now))
+    return RATE;
+  return REASONS;
+}
+
+bool LogPolicy::take(int64_t &tat, int64_t now, int64_t interval) const {
+  // the bucket holds one second of tokens (at least one)
+  int64_t next = std::max(tat, now) + interval;
+  if (next - now > std::max(NANOS_PER_SECOND, interval))
+    return false;
+  tat = next;
+  return true;
+}
+
+bool LogPolicy::takeGlobal(int64_t now) {
+  int64_t tat = _tat.load(std::memory_order_relaxed);
+  int64_t next;
+  do {
+    next = tat;
+    if (!take(next, now, _interval))
+      return false;
+  } while (!_tat.compare_exchange_weak(tat, next, std::memory_order_relaxed));
+  return true;
+}
+
+void LogPolicy::commit(const Tally &t) {
+  for (int i = 0; i < REASONS; ++i)
+    if (t.dropped[i] > 0)
+      _dropped[i].fetch_add(t.dropped[i], std::memory_order_relaxed);
+  if (t.forced > 0)
+    _forced.fetch_add(t.forced, std::memory_order_relaxed);
+}
+
+bool LogPolicy::logsErrors() const { return _alwaysErrors && !_passAll; }
+
+void LogPolicy::setBypass(const bool bypass) { _bypass = bypass; }
+
+bool LogPolicy::isBypassed() const { return _bypass; }
+
+bool LogPolicy::toggleBypass() {
+  bool bypass = _bypass.load();
+  while (!_bypass.compare_exchange_weak(bypass, !bypass))
+    ;
+  return !bypass;
+}
+
+std::size_t LogPolicy::getDropped(const Reason reason) const {
+  return _dropped[reason].load(std::memory_order_relaxed);
+}
+
+std::size_t LogPolicy::getForced() const {
+  return _forced.load(std::memory_order_relaxed);
+}
+
+const char *LogPolicy::reasonName(const Reason reason) {
+  switch (reason) {
+  case TYPE:
+    return "type";
+  case SAMPLED:
+    return "sampled";
+  case CLIENT_RATE:
+    return "client_rate";
+  case RATE:
+    return "rate";
+  default:
+    return "unknown";
+  }
+}
+
+bool LogPolicy::isDDL(std::string_view query) {
+  std::size_t start = query.find_first_not_of(" \t\r\n(");
+  if (start == std::string_view::npos)
+    return false;
+  query.remove_prefix(start);
+
+  for (const char *command :
+       {"CREATE", "ALTER", "DROP", "TRUNCATE", "GRANT", "REVOKE", "COMMENT"}) {
+    std::size_t len = std::strlen(command);
+    if (query.size() < len)
+      continue;
+    bool match = true;
+    for (std::size_t i = 0; i < len && match; ++i)
+      match = std::toupper(static_cast<unsigned char>(query[i])) == command[i];
+    // a whole word, not e.g. a function named created_at()
+    if (match && (query.size() == len ||
+                  (!std::isalnum(static_cast<unsigned char>(query[len])) &&
+                   query[len] != '_')))
+      return true;
+  }
+  return false;
+}
+
+LogPolicy::LogPolicyException::LogPolicyException()
+    : e("Invalid logging policy !") {}
+
+LogPolicy::LogPolicyException::LogPolicyException(const char *e) : e(e) {}
+
+LogPolicy::LogPolicyException::~LogPolicyException() throw() {}
+
+const char *LogPolicy::LogPolicyException::what() const throw() {
+  return e.c_str();
+}
@@ -0,0 +1,207 @@
+#ifndef __LOG_POLICY_HPP_
+#define __LOG_POLICY_HPP_
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "MessageFramer.h"
+
+/*
+ * @brief the logging state of one client, owned by the client and only
+ * touched by its event loop thread.
+ */
+struct LogState {
+  int64_t tat = 0;        // the client token bucket (see LogPolicy::take())
+  bool inRequest = false; // a request was started and not ended
+  bool sampled = false;   // the sampling decision of that request
+  uint32_t requests = 0;  // the requests seen, for the 1 in N sampling
+};
+
+/*
+ * @brief the configuration of a LogPolicy, the default logs everything.
+ */
+struct LogPolicyOptions {
+  std::string types;        // the message types logged, empty for all
+  uint32_t sampleEvery = 1; // log 1 request in N
+  double sampleRate = 1;    // log a request with this probability
+  double rate = 0;          // messages per second for all the clients
+  double clientRate = 0;    // messages per second per client
+  bool alwaysDDL = true;    // log the DDL statements whatever the sampling
+  bool alwaysErrors = true; // log the queries that failed
+};
+
+/*
+ * @brief decides which query messages are logged, before anything is copied
+ * or formatted. the checks are, in order:
+ *
+ *   - the message type: only the enabled types are logged.
+ *   - the sampling: 1 request in N of each client and / or each request with
+ *     a probability, a request is all the messages up to its Query, Sync or
+ *     function call so an extended query is kept or dropped as a whole.
+ *   - the rate limits: a token bucket per client and one for all the clients,
+ *     in messages per second with a burst of one second.
+ *   - the overrides: the DDL statements the sampling or the rates dropped
+ *     are logged anyway.
+ *
+ * the dropped messages are counted per reason. with a policy that drops
+ * messages the queries that failed (ErrorResponse) are also logged, with
+ * the "error" type, once they are answered (see ClientLogger::logCompleted()).
+ *
+ * setBypass() turns the policy off at run time (everything is logged, e.g.
+ * during an incident) and back on.
+ *
+ * allow() is called from all the event loop threads: the global bucket is a
+ * single atomic, the counters are added once per call of the logger (see
+ * Tally).
+ */
+class LogPolicy {
+
+public:
+  using uniq_ptr = std::unique_ptr<LogPolicy>;
+
+  enum Reason {
+    TYPE,        // the type is not enabled
+    SAMPLED,     // not in the sample
+    CLIENT_RATE, // over the rate of the client
+    RATE,        // over the global rate
+    REASONS
+  };
+
+  /*
+   * @brief the counts of one call of a logger, added to the policy at once
+   * by commit().
+   */
+  struct Tally {
+    std::size_t dropped[REASONS] = {};
+    std::size_t forced = 0;
+  };
+
+  /*
+   * @brief builds a policy, the default one logs every query message.
+   *
+   * @throws LogPolicyException if a type is not a query message or a value
+   * is out of range.
+   */
+  explicit LogPolicy(const LogPolicyOptions &options = LogPolicyOptions());
+
+  /*
+   * @return true if the message m read from a client with the state s is
+   * logged, the decision is counted in t.
+   *
+   * @param query : the query of the message for the DDL override if it is
+   * not in its body (an Execute, see StatementCache).
+   */
+  bool allow(const PgMessage &m, LogState &s, Tally &t,
+             std::string_view query = std::string_view()) {
+    Type type = _types[static_cast<unsigned char>(m.type)];
+    if (type != Type::LOGGED) {
+      if (type == Type::DISABLED)
+        ++t.dropped[TYPE];
+      if (m.type == 'S' || m.type == 'Q' || m.type == 'F')
+        s.inRequest = false;
+      return false;
+    }
+    if (_passAll || _bypass.load(std::memory_order_relaxed))
+      return true;
+    return decide(m, s, t, query);
+  }
+
+  /*
+   * @brief adds the counts of t to the counters of the policy.
+   */
+  void commit(const Tally &t);
+
+  /*
+   * @return true if the queries that failed have to be logged: the policy
+   * may drop messages and the errors override is on.
+   */
+  bool logsErrors() const;
+
+  /*
+   * @brief logs everything while on, the counters stay as they are.
+   */
+  void setBypass(const bool bypass);
+  bool isBypassed() const;
+
+  /*
+   * @brief switches the bypass, lock free so a signal handler can call it.
+   * @return true if the policy is bypassed now.
+   */
+  bool toggleBypass();
+
+  std::size_t getDropped(const Reason reason) const;
+
+  /*
+   * @return the number of messages logged by an override (DDL, errors).
+   */
+  std::size_t getForced() const;
+
+  /*
+   * @return the name of a reason for the metrics ("type", "sampled" ...).
+   */
+  static const char *reasonName(const Reason reason);
+
+  /*
+   * @return true if the query starts with a DDL command (CREATE, ALTER,
+   * DROP, TRUNCATE, GRANT, REVOKE, COMMENT).
+   */
+  static bool isDDL(std::string_view query);
+
+  class LogPolicyException : public std::exception {
+  private:
+    std::string e;
+
+  public:
+    LogPolicyException();
+    LogPolicyException(const char *e);
+    virtual ~LogPolicyException() throw();
+    virtual const char *what() const throw();
+  };
+
+private:
+  enum class Type : uint8_t {
+    IGNORED,  // not a query message, never logged
+    DISABLED, // a query message the configuration does not log
+    LOGGED
+  };
+
+  /*
+   * @brief the overrides, the sampling and the rate limits.
+   */
+  bool decide(const PgMessage &m, LogState &s, Tally &t,
+              std::string_view query);
+
+  /*
+   * @brief takes a token from the client bucket then the global one.
+   * @return the reason the message is dropped, REASONS if it is not.
+   */
+  Reason limit(LogState &s);
+
+  /*
+   * @brief takes a token from a bucket (GCRA: tat is the time the bucket
+   * would be full again, in nanoseconds).
+   * @return false if the bucket is empty.
+   */
+  bool take(int64_t &tat, int64_t now, int64_t interval) const;
+  bool takeGlobal(int64_t now);
+
+  std::array<Type, 256> _types;
+  bool _passAll;
+  uint32_t _sampleEvery;
+  uint64_t _sampleThreshold; // a request is kept if its random is below
+  int64_t _interval = 0;     // nanoseconds per token of the global bucket
+  int64_t _clientInterval = 0;
+  bool _alwaysDDL;
+  bool _alwaysErrors;
+  std::atomic<bool> _bypass{false};
+
+  alignas(64) std::atomic<int64_t> _tat{0};
+  alignas(64) std::atomic<std::size_t> _dropped[REASONS] = {};
+  std::atomic<std::size_t> _forced{0};
+};
+
+#endif // __LOG_POLICY_HPP_
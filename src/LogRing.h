@@ -0,0 +1,111 @@
+#ifndef __LOG_RING_HPP_
+#define __LOG_RING_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+/*
+ * @brief a bounded lock-free multi producer / single consumer ring.
+ *
+ * each slot has a sequence number telling whether it is free for the producer
+ * of a given position or ready for the consumer (Vyukov's bounded queue). the
+ * producers reserve a position with a CAS, fill the slot in place then
+ * publish it. the consumer reads the ready slots in place and releases them,
+ * so the items (and the memory they own) are reused instead of reallocated.
+ *
+ * @tparam T : the item type, it must be default constructible.
+ */
+template <typename T> class LogRing {
+
+public:
+  /*
+   * @param capacity : the number of slots, rounded up to a power of two.
+   */
+  LogRing(std::size_t capacity) {
+    _capacity = 1;
+    while (_capacity < capacity)
+      _capacity <<= 1;
+    _mask = _capacity - 1;
+    _slots = std::make_unique<Slot[]>(_capacity);
+    for (std::size_t i = 0; i < _capacity; ++i)
+      _slots[i].seq.store(i, std::memory_order_relaxed);
+  }
+
+  LogRing(const LogRing &other) = delete;
+
+  /*
+   * @brief reserves a free slot (producer side, thread safe).
+   * @return the item to fill then publish(), or nullptr if the ring is full.
+   */
+  T *reserve(std::size_t &pos) {
+    pos = _enqueuePos.load(std::memory_order_relaxed);
+    for (;;) {
+      Slot &slot = _slots[pos & _mask];
+      std::size_t seq = slot.seq.load(std::memory_order_acquire);
+      long diff = (long)seq - (long)pos;
+      if (diff == 0) {
+        if (_enqueuePos.compare_exchange_weak(pos, pos + 1,
+                                              std::memory_order_relaxed))
+          return &slot.item;
+      } else if (diff < 0)
+        return nullptr; // full
+      else
+        pos = _enqueuePos.load(std::memory_order_relaxed);
+    }
+  }
+
+  /*
+   * @brief makes a reserved slot visible to the consumer.
+   */
+  void publish(std::size_t pos) {
+    _slots[pos & _mask].seq.store(pos + 1, std::memory_order_release);
+  }
+
+  /*
+   * @brief the i-th ready item after the consumer position (consumer side).
+   * @return the item or nullptr if it is not published yet.
+   */
+  T *peek(std::size_t i) {
+    std::size_t pos = _dequeuePos.load(std::memory_order_relaxed) + i;
+    Slot &slot = _slots[pos & _mask];
+    if (slot.seq.load(std::memory_order_acquire) != pos + 1)
+      return nullptr;
+    return &slot.item;
+  }
+
+  /*
+   * @brief gives the first count peeked items back to the producers.
+   */
+  void release(std::size_t count) {
+    std::size_t pos = _dequeuePos.load(std::memory_order_relaxed);
+    for (std::size_t i = 0; i < count; ++i, ++pos)
+      _slots[pos & _mask].seq.store(pos + _capacity,
+                                    std::memory_order_release);
+    _dequeuePos.store(pos, std::memory_order_relaxed);
+  }
+
+  /*
+   * @return an approximation of the number of items in the ring.
+   */
+  std::size_t size() const {
+    std::size_t head = _dequeuePos.load(std::memory_order_relaxed);
+    return _enqueuePos.load(std::memory_order_relaxed) - head;
+  }
+
+  std::size_t capacity() const { return _capacity; }
+
+private:
+  struct Slot {
+    std::atomic<std::size_t> seq;
+    T item;
+  };
+
+  std::size_t _capacity;
+  std::size_t _mask;
+  std::unique_ptr<Slot[]> _slots;
+  alignas(64) std::atomic<std::size_t> _enqueuePos{0};
+  alignas(64) std::atomic<std::size_t> _dequeuePos{0};
+};
+
+#endif // __LOG_RING_HPP_
@@ -0,0 +1,245 @@
+#include "LogSink.h"
+#include "Compression.h"
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <ios>
+#include <iostream>
+#include <sys/mman.h>
+#include <unistd.h>
+
+FileSink::FileSink(const std::string &filePath, const bool append) {
+  int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC);
+  if ((_fd = open(filePath.c_str(), flags, 0644)) < 0)
+    throw std::ios_base::failure(strerror(errno));
+}
+
+FileSink::~FileSink() {
+  if (_fd != -1)
+    close(_fd);
+}
+
+bool FileSink::write(iovec *iov, int count) {
+  while (count > 0) {
+    long len = writev(_fd, iov, count);
+    if (len < 0 && errno == EINTR)
+      continue;
+    if (len < 0)
+      return false;
+
+    // skip what was written
+    while (count > 0 && static_cast<std::size_t>(len) >= iov->iov_len) {
+      len -= iov->iov_len;
+      ++iov;
+      --count;
+    }
+    if (count > 0) {
+      iov->iov_base = static_cast<char *>(iov->iov_base) + len;
+      iov->iov_len -= len;
+    }
+  }
+  return true;
+}
+
+SegmentSink::SegmentSink(const std::string &basePath,
+                         const std::size_t segmentSize,
+                         const time_t rollInterval)
+    : _basePath(basePath), _segmentSize(segmentSize),
+      _rollInterval(rollInterval) {
+  if (_segmentSize == 0 || !roll())
+    throw std::ios_base::failure(strerror(errno));
+}
+
+SegmentSink::~SegmentSink() { closeSegment(); }
+
+bool SegmentSink::write(iovec *iov, int count) {
+  std::size_t total = 0;
+  for (int i = 0; i < count; ++i)
+    total += iov[i].iov_len;
+
+  // the last roll failed, try again
+  if (_map == nullptr && !roll())
+    return false;
+
+  // keep the batch in one segment when it fits in an empty one
+  if (_used > 0 && (_used + total > _segmentSize || isExpired()))
+    if (!roll())
+      return false;
+
+  for (int i = 0; i < count; ++i) {
+    const char *data = static_cast<const char *>(iov[i].iov_base);
+    std::size_t len = iov[i].iov_len;
+    while (len > 0) {
+      // only a batch bigger than a segment gets here with a full segment
+      if (_used == _segmentSize && !roll())
+        return false;
+      std::size_t n = std::min(len, _segmentSize - _used);
+      std::memcpy(_map + _used, data, n);
+      _used += n;
+      data += n;
+      len -= n;
+    }
+  }
+  return true;
+}
+
+bool SegmentSink::flush() {
+  if (_map == nullptr || !isExpired())
+    return true;
+  return roll();
+}
+
+bool SegmentSink::startSegment(std::size_t bytes) {
+  if ((_map == nullptr || (_used > 0 && !fits(bytes))) && !roll())
+    return false;
+  return _used == 0;
+}
+
+bool SegmentSink::fits(std::size_t bytes) const {
+  return _map != nullptr && _used + bytes <= _segmentSize && !isExpired();
+}
+
+bool SegmentSink::isExpired() const {
+  return _used > 0 && _rollInterval > 0 &&
+         time(nullptr) >= _openedAt + _rollInterval;
+}
+
+bool SegmentSink::roll() {
+  closeSegment();
+
+  char date[32];
+  _openedAt = time(nullptr);
+  std::tm tm_now;
+  localtime_r(&_openedAt, &tm_now);
+  std::strftime(date, sizeof(date), "%Y%m%d-%H%M%S", &tm_now);
+  std::string path = _basePath + "." + date + "." + std::to_string(_index++);
+
+  if ((_fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  0644)) < 0)
+    return false;
+
+  // reserve the blocks now (fallocate) so the copies never hit ENOSPC as a
+  // SIGBUS
+  int err = posix_fallocate(_fd, 0, _segmentSize);
+  if (err != 0) {
+    close(_fd);
+    _fd = -1;
+    errno = err;
+    return false;
+  }
+
+  void *map = mmap(nullptr, _segmentSize, PROT_WRITE, MAP_SHARED, _fd, 0);
+  if (map == MAP_FAILED) {
+    close(_fd);
+    _fd = -1;
+    return false;
+  }
+  _map = static_cast<char *>(map);
+  _used = 0;
+  return true;
+}
+
+void SegmentSink::closeSegment() {
+  if (_map != nullptr) {
+    munmap(_map, _segmentSize);
+    _map = nullptr;
+  }
+  if (_fd != -1) {
+    // drop the preallocated space that was not used
+    if (ftruncate(_fd, _used) < 0)
+      std::cerr << "could not truncate the log segment: " << strerror(errno)
+                << std::endl;
+    close(_fd);
+    _fd = -1;
+  }
+  _used = 0;
+}
+
+CompressedSink::CompressedSink(LogSink::uniq_ptr sink)
+    : _sink(std::move(sink)), _table(COMPRESS_TABLE_SIZE) {
+  _block.reserve(COMPRESS_BLOCK_SIZE);
+  _frame.resize(COMPRESSED_FRAME_HEADER + compressBound(COMPRESS_BLOCK_SIZE));
+}
+
+CompressedSink::~CompressedSink() {
+  if (!flush())
+    std::cerr << "could not write the last log block: " << strerror(errno)
+              << std::endl;
+}
+
+bool CompressedSink::write(iovec *iov, int count) {
+  for (int i = 0; i < count; ++i) {
+    const char *data = static_cast<const char *>(iov[i].iov_base);
+    std::size_t len = iov[i].iov_len;
+    _rawBytes += len;
+    while (len > 0) {
+      std::size_t n = std::min(len, COMPRESS_BLOCK_SIZE - _block.size());
+      if (n == COMPRESS_BLOCK_SIZE) {
+        // a whole block, no need to gather it
+        if (!writeBlock(data, n))
+          return false;
+      } else {
+        _block.append(data, n);
+        if (_block.size() == COMPRESS_BLOCK_SIZE && !flush())
+          return false;
+      }
+      data += n;
+      len -= n;
+    }
+  }
+  return true;
+}
+
+bool CompressedSink::flush() {
+  if (_block.empty())
+    return _sink->flush();
+  bool written = writeBlock(_block.data(), _block.size());
+  // on error the block is dropped like the batches of the other sinks
+  _block.clear();
+  return written && _sink->flush();
+}
+
+bool CompressedSink::startSegment(std::size_t bytes) {
+  if (!_block.empty()) {
+    if (_sink->fits(frameBound(bytes)))
+      return false;
+    // the partial block ends the current segment
+    if (!flush())
+      return false;
+  }
+  return _sink->startSegment(frameBound(bytes));
+}
+
+bool CompressedSink::fits(std::size_t bytes) const {
+  return _sink->fits(frameBound(bytes));
+}
+
+std::size_t CompressedSink::frameBound(std::size_t bytes) const {
+  std::size_t raw = _block.size() + bytes;
+  return (raw / COMPRESS_BLOCK_SIZE + 1) * COMPRESSED_FRAME_HEADER +
+         compressBound(raw);
+}
+
+bool CompressedSink::writeBlock(const char *data, std::size_t len) {
+  char *compressed = &_frame[COMPRESSED_FRAME_HEADER];
+  std::size_t stored = compressBlock(data, len, compressed, _table.data());
+  // a block that did not compress is written as is
+  bool raw = stored >= len;
+  if (raw)
+    stored = len;
+
+  uint32_t sizes[2] = {htonl(uint32_t(len)),
+                       htonl(uint32_t(stored) | (raw ? COMPRESSED_BLOCK_RAW
+                                                     : 0))};
+  std::memcpy(&_frame[0], COMPRESSED_LOG_MAGIC, 4);
+  std::memcpy(&_frame[4], sizes, sizeof(sizes));
+  iovec iov[2] = {{&_frame[0], COMPRESSED_FRAME_HEADER},
+                  {raw ? const_cast<char *>(data) : compressed, stored}};
+  _writtenBytes += COMPRESSED_FRAME_HEADER + stored;
+  return _sink->write(iov, 2);
+}
+
+uint64_t CompressedSink::getRawBytes() const { return _rawBytes; }
+
+uint64_t CompressedSink::getWrittenBytes() const { return _writtenBytes; }
@@ -0,0 +1,227 @@
+#ifndef __LOG_SINK_HPP_
+#define __LOG_SINK_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <sys/uio.h>
+#include <vector>
+
+/*
+ * @brief where the writer thread of the asynchronous logger writes the
+ * formatted batches. a sink is only used by one thread.
+ */
+class LogSink {
+
+public:
+  using uniq_ptr = std::unique_ptr<LogSink>;
+
+  LogSink() = default;
+  virtual ~LogSink() = default;
+
+  /*
+   * @brief writes all the iovecs (a batch of whole records).
+   *
+   * @param iov : the buffers to write, they may be modified.
+   * @param count : the number of buffers.
+   *
+   * @return false on error (errno is set).
+   */
+  virtual bool write(iovec *iov, int count) = 0;
+
+  /*
+   * @brief writes what the sink buffered, called when the writer thread has
+   * nothing left to write. does nothing by default.
+   *
+   * @return false on error (errno is set).
+   */
+  virtual bool flush() { return true; }
+
+  /*
+   * @brief called before a batch of bytes is written: a segmented sink rolls
+   * now if the batch does not fit in the current segment (or the segment is
+   * too old) so the caller can begin the new segment with what makes it
+   * readable on its own. a single file never starts a segment.
+   *
+   * @return true if the batch will be written at the start of a segment.
+   */
+  virtual bool startSegment(std::size_t) { return false; }
+
+  /*
+   * @return true if bytes fit in the current segment (which is not too old),
+   * always the case for a single file.
+   */
+  virtual bool fits(std::size_t) const { return true; }
+};
+
+/*
+ * @brief writes to a single file with writev.
+ */
+class FileSink : public LogSink {
+
+public:
+  /*
+   * @param filePath : the path of the log file.
+   * @param append : append to the file instead of truncating it.
+   *
+   * @throws std::ios_base::failure if the file failed to open.
+   */
+  FileSink(const std::string &filePath, const bool append = true);
+
+  /*
+   * @brief closes the file.
+   */
+  ~FileSink();
+
+  /*
+   * @brief writev until everything is written (handles the partial writes).
+   */
+  bool write(iovec *iov, int count) override;
+
+private:
+  int _fd = -1;
+};
+
+/*
+ * @brief writes to memory mapped segment files.
+ *
+ * each segment is preallocated with fallocate and mapped, the records are
+ * copied to the mapping so writing does not need any system call. the sink
+ * rolls to a new segment (path.YYYYmmdd-HHMMSS.N) when a batch does not fit in
+ * the current one or when the segment is older than the roll interval, the
+ * segment that is left is truncated to the size of its content.
+ */
+class SegmentSink : public LogSink {
+
+public:
+  /*
+   * @param basePath : the path the segment names are made from.
+   * @param segmentSize : the size of a segment in bytes.
+   * @param rollInterval : the maximum age of a segment in seconds, 0 to only
+   * roll on size.
+   *
+   * @throws std::ios_base::failure if the first segment can't be created.
+   */
+  SegmentSink(const std::string &basePath, const std::size_t segmentSize,
+              const time_t rollInterval = 0);
+
+  /*
+   * @brief unmaps and truncates the last segment.
+   */
+  ~SegmentSink();
+
+  /*
+   * @brief copies the iovecs to the mapping, rolls first if needed.
+   */
+  bool write(iovec *iov, int count) override;
+
+  /*
+   * @brief rolls a segment that is not empty and older than the roll
+   * interval, so an idle logger still closes one segment per interval.
+   */
+  bool flush() override;
+
+  bool startSegment(std::size_t bytes) override;
+  bool fits(std::size_t bytes) const override;
+
+private:
+  /*
+   * @return true if the current segment has records and is older than the
+   * roll interval.
+   */
+  bool isExpired() const;
+
+  /*
+   * @brief closes the current segment and opens the next one.
+   * @return false on error.
+   */
+  bool roll();
+
+  /*
+   * @brief unmaps the current segment, truncates it to its content and closes
+   * it.
+   */
+  void closeSegment();
+
+  std::string _basePath;
+  std::size_t _segmentSize;
+  time_t _rollInterval;
+  unsigned int _index = 0;
+  int _fd = -1;
+  char *_map = nullptr;
+  std::size_t _used = 0;
+  time_t _openedAt = 0;
+};
+
+/*
+ * @brief compresses the batches before another sink writes them.
+ *
+ * the batches are gathered into blocks of COMPRESS_BLOCK_SIZE bytes, each
+ * block is compressed on its own (see Compression.h) and written to the
+ * sink as one frame. over a SegmentSink a frame never spans two segments as
+ * long as a segment can hold the largest frame (COMPRESSED_FRAME_MAX), the
+ * smaller segment sizes are refused by the command line, and a segment
+ * started by startSegment() begins with a new block. a partial block
+ * is written by flush(), when the logger is idle, so the log is readable
+ * without waiting for a full block. `LogDecompress` restores the log.
+ */
+class CompressedSink : public LogSink {
+
+public:
+  /*
+   * @param sink : the sink the frames are written to (FileSink,
+   * SegmentSink).
+   */
+  explicit CompressedSink(LogSink::uniq_ptr sink);
+
+  /*
+   * @brief writes the partial block.
+   */
+  ~CompressedSink();
+
+  /*
+   * @brief appends the iovecs to the block, writes the full blocks.
+   */
+  bool write(iovec *iov, int count) override;
+
+  bool flush() override;
+
+  /*
+   * @brief the frames of the batch are bounded (compressBound()): when they
+   * may not fit, the partial block is written to the current segment first
+   * so the batch starts the next one in a new block.
+   */
+  bool startSegment(std::size_t bytes) override;
+  bool fits(std::size_t bytes) const override;
+
+  /*
+   * @return the bytes received and the bytes written to the sink (headers
+   * included).
+   */
+  uint64_t getRawBytes() const;
+  uint64_t getWrittenBytes() const;
+
+private:
+  /*
+   * @brief compresses len bytes of data (at most COMPRESS_BLOCK_SIZE) and
+   * writes the frame, as is if it does not compress.
+   */
+  bool writeBlock(const char *data, std::size_t len);
+
+  /*
+   * @return the most the frames of the partial block and of bytes more can
+   * take.
+   */
+  std::size_t frameBound(std::size_t bytes) const;
+
+  LogSink::uniq_ptr _sink;
+  std::string _block; // the raw data of the block being gathered
+  std::string _frame;
+  std::vector<uint32_t> _table;
+  uint64_t _rawBytes = 0;
+  uint64_t _writtenBytes = 0;
+};
+
+#endif // __LOG_SINK_HPP_
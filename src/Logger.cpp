@@ -7,8 +7,60 @@
 #include <string>
 #include <vector>
 
-FileQueryLogger::FileQueryLogger(const std::string &filePath, const bool append)
-    : _filePath(filePath) {
+ClientLogger::ClientLogger(QueryStats::uniq_ptr stats, const bool rawLines)
+    : _stats(std::move(stats)), _rawLines(rawLines),
+      _policy(std::make_unique<LogPolicy>()) {
+  fillMessageTypes(_messageTypes);
+}
+
+void ClientLogger::connect(const Client::pointer &) {}
+
+void ClientLogger::disconnect(const Client::pointer &) {}
+
+void ClientLogger::logCompleted(const Client::pointer &c) {
+  if (_slowLog)
+    _slowLog->log(c);
+  // while the policy is bypassed the failed queries were logged anyway
+  if (_policy->logsErrors() && !_policy->isBypassed())
+    logErrors(c);
+}
+
+void ClientLogger::setSlowQueryLog(SlowQueryLog::uniq_ptr slowLog) {
+  _slowLog = std::move(slowLog);
+}
+
+const SlowQueryLog *ClientLogger::getSlowQueryLog() const {
+  return _slowLog.get();
+}
+
+void ClientLogger::setLogPolicy(LogPolicy::uniq_ptr policy) {
+  _policy = std::move(policy);
+}
+
+LogPolicy &ClientLogger::getLogPolicy() const { return *_policy; }
+
+void ClientLogger::setStatementTracking(const bool track) {
+  _trackStatements = track;
+}
+
+bool ClientLogger::track(const Client::pointer &c, const PgMessage &m,
+                         const StatementCache::Portal *&portal) {
+  portal = nullptr;
+  if (!_trackStatements)
+    return true;
+  portal = c->statements().track(m);
+  return portal != nullptr ||
+         (m.type != 'P' && m.type != 'B' && m.type != 'D' && m.type != 'C');
+}
+
+bool ClientLogger::needsQueryText() const {
+  return _slowLog != nullptr || _policy->logsErrors();
+}
+
+FileQueryLogger::FileQueryLogger(const std::string &filePath, const bool append,
+                                 QueryStats::uniq_ptr stats,
+                                 const bool rawLines)
+    : ClientLogger(std::move(stats), rawLines), _filePath(filePath) {
 
   if (append)
     _outStream.open(_filePath, std::ios_base::app);
@@ -17,47 +69,87 @@ FileQueryLogger::FileQueryLogger(const std::string &filePath, const bool append)
 
   if (!_outStream.is_open() || _outStream.fail())
     throw std::ios_base::failure(strerror(errno));
-
-  fillMessageTypes();
 }
 
 void FileQueryLogger::log(const Client::pointer &c) {
 
-  if (c->getBuffer().empty())
+  // the messages read from the client in this iteration, the lock is only
+  // taken (and the time only read) for the first one the policy keeps
+  auto &messages = c->getLastMessages();
+  LogPolicy::Tally tally;
+  std::unique_lock<std::mutex> lock(_streamMutex, std::defer_lock);
+  time_t in_time_t = 0;
+  std::tm tm_now;
+
+  for (auto &m : messages) {
+    const StatementCache::Portal *portal;
+    if (!track(c, m, portal) ||
+        !_policy->allow(m, c->logState(), tally,
+                        portal ? *portal->query : std::string_view()))
+      continue;
+
+    if (!lock.owns_lock()) {
+      in_time_t = std::chrono::system_clock::to_time_t(
+          std::chrono::system_clock::now());
+      localtime_r(&in_time_t, &tm_now);
+      lock.lock();
+    }
+
+    char type = m.type;
+    std::string_view body = m.body;
+    if (portal) {
+      _execute.clear();
+      StatementCache::describe(*portal, _execute);
+      type = LOG_EXECUTE_TYPE;
+      body = _execute;
+    }
+
+    if (_stats)
+      _stats->record(type, body, in_time_t);
+    if (_rawLines)
+      writeLine(c, tm_now, _messageTypes[(unsigned char)type], body);
+  }
+  _policy->commit(tally);
+
+  if (!lock.owns_lock())
     return;
 
-  auto &tmp = c->getBuffer();
-  auto qtype = _messageTypes.find(tmp[0]);
+  if (_stats)
+    _stats->maybeDump(in_time_t);
 
-  if (qtype == _messageTypes.end())
+  if (_outStream.fail())
+    throw std::ios_base::failure(strerror(errno));
+}
+
+void FileQueryLogger::logErrors(const Client::pointer &c) {
+  LogPolicy::Tally tally;
+  for (auto &q : c->getCompletedQueries())
+    tally.forced += q.failed;
+  if (tally.forced == 0 || !_rawLines)
     return;
 
-  auto now = std::chrono::system_clock::now();
-  auto in_time_t = std::chrono::system_clock::to_time_t(now);
+  auto in_time_t =
+      std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+  std::tm tm_now;
+  localtime_r(&in_time_t, &tm_now);
 
-  _outStream << std::put_time(std::localtime(&in_time_t), "%Y-%m-%d\t%X")
-             << "\t\t-\tIP: " << c->getIP() << "\t-\tclient " << c->getID()
-             << ": (" << qtype->second << ")\t\t"
-             << std::string(tmp.begin() + 5, tmp.end()) << "\n";
+  std::lock_guard<std::mutex> lock(_streamMutex);
+  for (auto &q : c->getCompletedQueries())
+    if (q.failed)
+      writeLine(c, tm_now, _messageTypes[(unsigned char)LOG_ERROR_TYPE],
+                q.query);
+  _policy->commit(tally);
 
   if (_outStream.fail())
     throw std::ios_base::failure(strerror(errno));
 }
 
-std::string FileQueryLogger::getFilePath() const { return _filePath; }
-
-void FileQueryLogger::fillMessageTypes() {
-  _messageTypes.insert(std::make_pair<char, std::string>('Q', "simple query"));
-  _messageTypes.insert(
-      std::make_pair<char, std::string>('B', "extended query bind"));
-  _messageTypes.insert(
-      std::make_pair<char, std::string>('P', "extended query parse"));
-  _messageTypes.insert(
-      std::make_pair<char, std::string>('D', "extended query describe"));
-  _messageTypes.insert(
-      std::make_pair<char, std::string>('E', "extended query execute"));
-  _messageTypes.insert(
-      std::make_pair<char, std::string>('C', "extended query close"));
-  _messageTypes.insert(
-      std::make_pair<char, std::string>('F', "extended function call"));
+void FileQueryLogger::writeLine(const Client::pointer &c, const std::tm &tm_now,
+                                const std::string &qtype,
+                                std::string_view query) {
+  _outStream << std::put_time(&tm_now, "%Y-%m-%d\t%X")
+             << "\t\t-\tIP: " << c->getIP() << "\t-\tclient " << c->getID()
+             << ": (" << qtype << ")\t\t" << query << "\n";
 }
+
+std::string FileQueryLogger::getFilePath() const { return _filePath; }
@@ -2,11 +2,17 @@
 #define __LOGGER_HPP_
 
 #include "Client.h"
+#include "LogFormat.h"
+#include "LogPolicy.h"
+#include "QueryStats.h"
+#include "SlowQueryLog.h"
+#include <array>
 #include <chrono>
 #include <fstream>
 #include <iomanip>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <unistd.h>
 #include <vector>
@@ -17,16 +23,114 @@ public:
   using pointer = std::shared_ptr<ClientLogger>;
   using uniq_ptr = std::unique_ptr<ClientLogger>;
 
-  ClientLogger() = default;
+  /*
+   * @param stats : if not null the queries are also aggregated per
+   * fingerprint and dumped periodically.
+   * @param rawLines : false to only keep the stats and not write the queries.
+   */
+  ClientLogger(QueryStats::uniq_ptr stats = nullptr,
+               const bool rawLines = true);
   virtual ~ClientLogger() = default;
 
+  /*
+   * @brief logs the requests read from the client (Client::getLastMessages()).
+   *
+   * @note implementations must be thread safe, the multi reactor server calls
+   * it from all of its event loop threads.
+   */
   virtual void log(const Client::pointer &c) = 0;
+
+  /*
+   * @brief called once when a client is added to the server (after its id is
+   * set) and once when it is removed, does nothing by default.
+   */
+  virtual void connect(const Client::pointer &c);
+  virtual void disconnect(const Client::pointer &c);
+
+  /*
+   * @brief called after a read from the remote server that answered some
+   * requests (Client::getCompletedQueries()), writes the slow ones to the
+   * slow query log if there is one and the failed ones to the log if the
+   * logging policy asks for it (LogPolicy::logsErrors()).
+   */
+  void logCompleted(const Client::pointer &c);
+
+  /*
+   * @brief sets the slow query log, before the server starts.
+   */
+  void setSlowQueryLog(SlowQueryLog::uniq_ptr slowLog);
+
+  /*
+   * @return the slow query log or nullptr if there is none.
+   */
+  const SlowQueryLog *getSlowQueryLog() const;
+
+  /*
+   * @brief sets the logging policy, before the server starts. the default
+   * one logs every query message.
+   */
+  void setLogPolicy(LogPolicy::uniq_ptr policy);
+  LogPolicy &getLogPolicy() const;
+
+  /*
+   * @brief tracks the prepared statements and the portals of the clients
+   * (Client::statements()), before the server starts: each Execute is then
+   * logged once with the query of its statement and the parameters of its
+   * Bind (LOG_EXECUTE_TYPE) instead of the Parse, Bind, Describe, Close and
+   * Execute messages. off by default.
+   */
+  void setStatementTracking(const bool track);
+
+  /*
+   * @return true if the clients have to keep the text of their queries (for
+   * the slow query log and the failed queries).
+   */
+  bool needsQueryText() const;
+
+  /*
+   * @return the number of records dropped (0 for a synchronous logger).
+   */
+  virtual std::size_t getDropped() const { return 0; }
+
+  /*
+   * @return the number of records waiting to be written (0 for a synchronous
+   * logger).
+   */
+  virtual std::size_t getQueueDepth() const { return 0; }
+
+protected:
+  /*
+   * @brief writes the queries of Client::getCompletedQueries() that failed,
+   * with the LOG_ERROR_TYPE type, whatever the policy.
+   */
+  virtual void logErrors(const Client::pointer &c) = 0;
+
+  /*
+   * @brief updates the statements of the client with a message when they
+   * are tracked, portal is set to what an Execute runs (nullptr if unknown).
+   * @return false if the message is not logged on its own (part of the
+   * record of an Execute).
+   */
+  bool track(const Client::pointer &c, const PgMessage &m,
+             const StatementCache::Portal *&portal);
+
+  /*
+   * messageTypes contains a char which is the first bite of a received request
+   * from the client and maps it to a string used in logging (an empty string
+   * for the messages that are not logged), see fillMessageTypes().
+   */
+  std::array<std::string, 256> _messageTypes;
+  QueryStats::uniq_ptr _stats;
+  bool _rawLines;
+  SlowQueryLog::uniq_ptr _slowLog;
+  LogPolicy::uniq_ptr _policy;
+  bool _trackStatements = false;
 };
 
 /*
  * This is an implementation for the client logger interface
- * that reads the content of the buffer inside the client and
- * determines if it is a query to then be written to a file.
+ * that reads the messages framed by the client and
+ * determines if they are queries to then be written to a file.
  *
  */
 
@@ -38,11 +142,15 @@ public:
    *
    * @param filePath a const string representing the path to the logging file.
    * @param append a const boolean determining the mode of opening the file.
+   * @param stats if not null the queries are also aggregated per fingerprint.
+   * @param rawLines false to only keep the stats.
    *
    * @thorws std::ios_base::failure if the file stream failed to open or write.
    *
    */
-  FileQueryLogger(const std::string &filePath, const bool append = true);
+  FileQueryLogger(const std::string &filePath, const bool append = true,
+                  QueryStats::uniq_ptr stats = nullptr,
+                  const bool rawLines = true);
 
   /*
    * default desctructor.
@@ -50,11 +158,13 @@ public:
   ~FileQueryLogger() = default;
 
   /*
-   * @brief writes the query from the client buffer to the log file.
+   * @brief writes each query message read from the client to the log file,
+   * one line per message.
    *
    * this log function uses std::ofstream to write to the file, it works in
    * the same thread (does not handle the logging in a separate thread and does
-   * not use async).
+   * not use async), the writes (and the stats) are serialized with a mutex.
+   * the messages the logging policy drops are not even timestamped.
    *
    * @param c a pointer (shared pointer) to a client.
    *
@@ -70,20 +180,20 @@ public:
    */
   std::string getFilePath() const;
 
+protected:
+  void logErrors(const Client::pointer &c) override;
+
 private:
   /*
-   * messageTypes contains a char which is the first bite of a received request
-   * from the client and maps it to a string used in logging this function fills
-   * messageTypes map with predefined char values and their meaning
-   * https://www.postgresql.org/docs/current/protocol-message-formats.html
-   * we can add more entries to this function to log other messages (commands,
-   * copy ...)
+   * @brief writes the line of one message, the caller holds the mutex.
    */
-  void fillMessageTypes();
+  void writeLine(const Client::pointer &c, const std::tm &tm_now,
+                 const std::string &qtype, std::string_view query);
 
   std::string _filePath;
   std::ofstream _outStream;
-  std::map<char, std::string> _messageTypes;
+  std::mutex _streamMutex;
+  std::string _execute; // the record of an Execute, under the mutex
 };
 
 #endif // !__LOGGER_HPP_
@@ -0,0 +1,121 @@
+#include "MessageFramer.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cstring>
+
+MessageFramer::MessageFramer(const bool startup, const std::size_t maxCarry)
+    : _startup(startup), _maxCarry(maxCarry) {}
+
+bool MessageFramer::isBroken() const { return _broken; }
+
+bool MessageFramer::hasPartial() const {
+  return _inMessage || !_header.empty();
+}
+
+void MessageFramer::feed(std::string_view data, std::vector<PgMessage> &out) {
+  out.clear();
+  // the messages of the previous feed are not referenced anymore
+  _completedCount = 0;
+  feedMore(data, out);
+}
+
+void MessageFramer::feedMore(std::string_view data,
+                             std::vector<PgMessage> &out) {
+  if (_broken)
+    return;
+
+  // first complete the message split between the previous feed and this one
+  if (_inMessage) {
+    std::size_t n = std::min(data.size(), _bodyLen - _bodyRead);
+    if (_carry.size() < _maxCarry)
+      _carry.append(data.data(), std::min(n, _maxCarry - _carry.size()));
+    _bodyRead += n;
+    data.remove_prefix(n);
+    if (_bodyRead < _bodyLen)
+      return;
+
+    // a deque so the views on the previous completed messages stay valid
+    _inMessage = false;
+    if (_completedCount == _completed.size())
+      _completed.emplace_back();
+    std::string &completed = _completed[_completedCount++];
+    completed.swap(_carry);
+    _carry.clear();
+    emit(std::string_view(completed), _bodyLen > _maxCarry, out);
+  }
+
+  while (!data.empty()) {
+    std::size_t n = parseHeader(data);
+    data.remove_prefix(n);
+    if (_broken || !_header.empty())
+      return; // invalid length or the header is not complete yet
+
+    if (data.size() >= _bodyLen) {
+      // the whole message is in data, no copy
+      emit(data.substr(0, _bodyLen), false, out);
+      data.remove_prefix(_bodyLen);
+    } else {
+      // keep the beginning of the message until the rest is fed
+      _inMessage = true;
+      _bodyRead = data.size();
+      _carry.assign(data.data(), std::min(data.size(), _maxCarry));
+      return;
+    }
+  }
+}
+
+std::size_t MessageFramer::parseHeader(std::string_view data) {
+  std::size_t headerLen = _startup ? 4 : 5;
+  std::size_t consumed = 0;
+  const char *header = data.data();
+
+  if (!_header.empty() || data.size() < headerLen) {
+    // the header is split between feeds
+    consumed = std::min(headerLen - _header.size(), data.size());
+    _header.append(data.data(), consumed);
+    if (_header.size() < headerLen)
+      return consumed;
+    header = _header.data();
+  } else
+    consumed = headerLen;
+
+  uint32_t len;
+  std::memcpy(&len, header + headerLen - 4, sizeof(len));
+  len = ntohl(len);
+  _type = _startup ? 0 : header[0];
+  _header.clear();
+
+  if (len < 4)
+    _broken = true;
+  else
+    _bodyLen = len - 4;
+  return consumed;
+}
+
+void MessageFramer::emit(std::string_view body, const bool truncated,
+                         std::vector<PgMessage> &out) {
+  out.push_back(PgMessage{_type, body, truncated});
+
+  if (_startup && body.size() >= 4) {
+    uint32_t code;
+    std::memcpy(&code, body.data(), sizeof(code));
+    code = ntohl(code);
+    // SSLRequest and GSSENCRequest are followed by another startup message
+    if (code != SSL_REQUEST_CODE && code != GSSENC_REQUEST_CODE)
+      _startup = false;
+  }
+}
+
+std::string makeErrorResponse(const char *code, const char *message) {
+  std::string fields;
+  fields.append("SFATAL", 7);
+  fields.append("VFATAL", 7);
+  fields.append("C").append(code).push_back('\0');
+  fields.append("M").append(message).push_back('\0');
+  fields.push_back('\0');
+
+  uint32_t len = htonl(uint32_t(fields.size() + 4));
+  std::string msg("E");
+  msg.append(reinterpret_cast<const char *>(&len), sizeof(len));
+  return msg + fields;
+}
@@ -0,0 +1,120 @@
+#ifndef __MESSAGE_FRAMER_HPP_
+#define __MESSAGE_FRAMER_HPP_
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// messages longer than this are not kept whole when split between reads
+#define MAX_CARRY_SIZE (std::size_t(1024 * 1024))
+
+// the protocol codes of the untyped startup messages
+#define CANCEL_REQUEST_CODE 80877102
+#define SSL_REQUEST_CODE 80877103
+#define GSSENC_REQUEST_CODE 80877104
+
+/*
+ * @brief a postgresql protocol message, the body is a view on the data that
+ * was fed to the framer (or on the framer's carry buffer for the messages
+ * that were split between two reads).
+ * https://www.postgresql.org/docs/current/protocol-message-formats.html
+ */
+struct PgMessage {
+  char type;             // the first byte, 0 for the untyped startup messages
+  std::string_view body; // the content after the length field
+  bool truncated;        // the body was cut to the carry size of the framer
+};
+
+/*
+ * @brief splits a postgresql stream into messages incrementally.
+ *
+ * the frontend stream starts with an untyped message (StartupMessage,
+ * SSLRequest, GSSENCRequest or CancelRequest: 4 bytes length + body), after a
+ * StartupMessage every message is a 1 byte type + 4 bytes length + body. the
+ * backend stream only has typed messages.
+ *
+ * the messages that are complete inside the fed data are returned as views on
+ * it without copying, only a message split between two feeds is copied to the
+ * carry buffer until it is complete.
+ */
+class MessageFramer {
+
+public:
+  /*
+   * @param startup : true for a frontend stream (starts with an untyped
+   * message), false for a backend stream.
+   * @param maxCarry : the number of bytes kept of a message split between
+   * feeds, a stream only framed for the message types needs few.
+   */
+  MessageFramer(const bool startup = true,
+                const std::size_t maxCarry = MAX_CARRY_SIZE);
+
+  /*
+   * @brief frames the data read from the socket.
+   *
+   * @param data : the bytes that follow the previously fed ones.
+   * @param out : cleared then filled with the messages completed by data, the
+   * views are valid until the next feed and as long as data is.
+   */
+  void feed(std::string_view data, std::vector<PgMessage> &out);
+
+  /*
+   * @brief same as feed() for the data read in several pieces: the messages
+   * are appended to out and the views of the previous feed()/feedMore() stay
+   * valid (as long as the data they point to is).
+   */
+  void feedMore(std::string_view data, std::vector<PgMessage> &out);
+
+  /*
+   * @return true if an invalid length was found, the stream is not framed
+   * anymore after that.
+   */
+  bool isBroken() const;
+
+  /*
+   * @return true if the data fed so far ends inside a message.
+   */
+  bool hasPartial() const;
+
+private:
+  /*
+   * @brief reads the header of the next message from the beginning of data,
+   * a header split between feeds is kept in _header until it is complete.
+   * @return the number of bytes of data consumed.
+   */
+  std::size_t parseHeader(std::string_view data);
+
+  /*
+   * @brief adds a complete message to out, a StartupMessage ends the startup
+   * phase of the stream.
+   */
+  void emit(std::string_view body, const bool truncated,
+            std::vector<PgMessage> &out);
+
+  bool _startup;
+  std::size_t _maxCarry;
+  bool _broken = false;
+
+  // the message being completed across feeds
+  bool _inMessage = false;
+  char _type = 0;
+  std::size_t _bodyLen = 0;  // the full length of the body
+  std::size_t _bodyRead = 0; // how much of the body was fed so far
+  std::string _header;       // partial header split between feeds
+  std::string _carry;
+  std::deque<std::string> _completed; // the carried messages since feed()
+  std::size_t _completedCount = 0;
+};
+
+/*
+ * @brief builds a backend ErrorResponse of severity FATAL, for a connection
+ * the proxy refuses itself.
+ *
+ * @param code : the SQLSTATE (5 characters).
+ * @param message : the primary message.
+ */
+std::string makeErrorResponse(const char *code, const char *message);
+
+#endif // __MESSAGE_FRAMER_HPP_
@@ -0,0 +1,191 @@
+#ifndef __METRICS_HPP_
+#define __METRICS_HPP_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "MessageFramer.h"
+
+// the number of buckets of a histogram, bucket i counts the values up to 2^i
+#define METRICS_HISTOGRAM_BUCKETS 24
+
+// a latency histogram splits each power of 2 in 2^LATENCY_SUB_BITS linear
+// buckets (a relative error under 1/2^LATENCY_SUB_BITS, about 3%), up to
+// 2^LATENCY_MAX_BITS microseconds (19 hours), the last bucket also holds the
+// longer durations
+#define LATENCY_SUB_BITS 5
+#define LATENCY_MAX_BITS 36
+#define LATENCY_BUCKETS                                                        \
+  ((LATENCY_MAX_BITS - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS)
+
+/*
+ * @brief a counter written by a single thread (the reactor that owns it) and
+ * read by the metrics thread: the update is a relaxed load and store, so the
+ * hot path has no locked instruction and no shared cache line with the other
+ * reactors.
+ */
+class MetricCounter {
+
+public:
+  void add(uint64_t n = 1) {
+    _value.store(_value.load(std::memory_order_relaxed) + n,
+                 std::memory_order_relaxed);
+  }
+
+  void sub(uint64_t n = 1) {
+    _value.store(_value.load(std::memory_order_relaxed) - n,
+                 std::memory_order_relaxed);
+  }
+
+  uint64_t get() const { return _value.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<uint64_t> _value{0};
+};
+
+/*
+ * @brief a histogram with power of 2 bounds (single writer like
+ * MetricCounter), recording a value is a few instructions.
+ */
+class MetricHistogram {
+
+public:
+  void record(uint64_t value) {
+    // the index of the smallest power of 2 >= value
+    std::size_t i =
+        value <= 1 ? 0 : 64 - std::size_t(__builtin_clzll(value - 1));
+    _buckets[i < METRICS_HISTOGRAM_BUCKETS ? i : METRICS_HISTOGRAM_BUCKETS - 1]
+        .add();
+    _sum.add(value);
+  }
+
+  /*
+   * @return the number of values in bucket i (not cumulative), the last
+   * bucket also holds the values over its bound.
+   */
+  uint64_t getBucket(std::size_t i) const { return _buckets[i].get(); }
+
+  uint64_t getSum() const { return _sum.get(); }
+
+  static uint64_t getBound(std::size_t i) { return uint64_t(1) << i; }
+
+private:
+  std::array<MetricCounter, METRICS_HISTOGRAM_BUCKETS> _buckets;
+  MetricCounter _sum;
+};
+
+/*
+ * @brief an HDR style histogram of durations in microseconds (single writer
+ * like MetricCounter): the buckets are linear inside each power of 2, so the
+ * percentiles keep the same relative precision from microseconds to hours,
+ * recording a value is a few instructions and never allocates. the
+ * histograms of several threads merge exactly by adding their buckets.
+ */
+class LatencyHistogram {
+
+public:
+  void record(uint64_t micros) {
+    _buckets[getIndex(micros)].add();
+    _sum.add(micros);
+  }
+
+  uint64_t getBucket(std::size_t i) const { return _buckets[i].get(); }
+
+  uint64_t getSum() const { return _sum.get(); }
+
+  /*
+   * @return the bucket of a value, the values below 2^(LATENCY_SUB_BITS+1)
+   * have a bucket each.
+   */
+  static std::size_t getIndex(uint64_t value) {
+    constexpr uint64_t linear = uint64_t(2) << LATENCY_SUB_BITS;
+    if (value < linear)
+      return value;
+    std::size_t shift = 63 - __builtin_clzll(value) - LATENCY_SUB_BITS;
+    std::size_t i = (shift << LATENCY_SUB_BITS) + (value >> shift);
+    return i < LATENCY_BUCKETS ? i : LATENCY_BUCKETS - 1;
+  }
+
+  /*
+   * @return the highest value of bucket i.
+   */
+  static uint64_t getBound(std::size_t i) {
+    constexpr std::size_t linear = std::size_t(2) << LATENCY_SUB_BITS;
+    if (i < linear)
+      return i;
+    std::size_t shift = (i >> LATENCY_SUB_BITS) - 1;
+    uint64_t sub =
+        (i & ((1 << LATENCY_SUB_BITS) - 1)) + (1 << LATENCY_SUB_BITS);
+    return ((sub + 1) << shift) - 1;
+  }
+
+private:
+  std::array<MetricCounter, LATENCY_BUCKETS> _buckets;
+  MetricCounter _sum;
+};
+
+/*
+ * @brief a query answered by the remote server (ReadyForQuery): its text
+ * (empty unless the client keeps it, see Client::keepQueryText()) and the
+ * time from the request to the answer.
+ */
+struct QueryTiming {
+  std::string_view query;
+  uint64_t micros;
+  bool failed; // the remote server answered with an ErrorResponse
+};
+
+/*
+ * @brief the metrics of one server (event loop thread), aligned so that the
+ * reactors never write to the same cache line.
+ */
+struct alignas(64) ServerMetrics {
+  MetricCounter sessionsAccepted;
+  MetricCounter sessionsRejected; // over the admission limit
+  MetricCounter sessionsFailed;   // remote connect or read/write failure
+  MetricCounter sessionsActive;   // a gauge
+  MetricCounter requestBytes;     // received from the clients
+  MetricCounter responseBytes;    // received from the remote server
+  MetricCounter sentBytes;        // written to the clients and remote servers
+  MetricCounter connects;         // remote connects completed
+  std::array<MetricCounter, 256> messages; // the requests by message type
+  MetricCounter wakeups;
+  MetricCounter spuriousWakeups; // no socket io and nothing accepted/closed
+  MetricCounter events;
+  MetricHistogram eventsPerWakeup;
+  MetricHistogram loopMicroseconds; // the time spent handling a wakeup
+  LatencyHistogram queryMicroseconds; // from a Query/Sync to ReadyForQuery
+
+  /*
+   * @brief counts the requests framed by the last read of a client.
+   */
+  void countMessages(const std::vector<PgMessage> &msgs) {
+    for (const auto &m : msgs)
+      messages[static_cast<unsigned char>(m.type)].add();
+  }
+
+  /*
+   * @brief records the queries answered by the last read of a remote server.
+   */
+  void recordQueries(const std::vector<QueryTiming> &queries) {
+    for (const auto &q : queries)
+      queryMicroseconds.record(q.micros);
+  }
+
+  /*
+   * @return a value that changes whenever a wakeup did something (accepted,
+   * rejected or closed a client, received or sent bytes, completed a
+   * connect).
+   */
+  uint64_t getProgress() const {
+    return sessionsAccepted.get() + sessionsRejected.get() +
+           sessionsActive.get() + requestBytes.get() + responseBytes.get() +
+           sentBytes.get() + connects.get();
+  }
+};
+
+#endif // __METRICS_HPP_
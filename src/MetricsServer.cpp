@@ -0,0 +1,395 @@
+#include "MetricsServer.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <cmath>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sstream>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+// the label of a message type: the character when it is printable
+std::string typeLabel(unsigned char type) {
+  if (type == 0)
+    return "startup";
+  if (std::isalnum(type))
+    return std::string(1, char(type));
+  char hex[8];
+  snprintf(hex, sizeof(hex), "0x%02x", type);
+  return hex;
+}
+
+// an integer as is, or divided by unit (microseconds to seconds) with the
+// shortest exact representation instead of the 6 digits of the stream
+void value(std::ostringstream &out, uint64_t v, uint64_t unit) {
+  if (unit == 1) {
+    out << v;
+    return;
+  }
+  char buf[32];
+  auto end = std::to_chars(buf, buf + sizeof(buf), double(v) / unit).ptr;
+  out.write(buf, end - buf);
+}
+
+void header(std::ostringstream &out, const char *name, const char *type,
+            const char *help) {
+  out << "# HELP " << name << ' ' << help << '\n'
+      << "# TYPE " << name << ' ' << type << '\n';
+}
+
+} // namespace
+
+MetricsServer::MetricsServer(const std::string &address,
+                             std::vector<const ServerMetrics *> metrics,
+                             const ClientLogger::pointer &logger,
+                             const ResultCache::pointer &cache,
+                             const BackendSet::pointer &backends)
+    : _address(address), _metrics(std::move(metrics)), _logger(logger),
+      _cache(cache), _backends(backends) {}
+
+MetricsServer::~MetricsServer() {
+  if (_thread.joinable()) {
+    uint64_t one = 1;
+    if (write(_wakeFd, &one, sizeof(one)) == sizeof(one))
+      _thread.join();
+    else
+      _thread.detach();
+  }
+  if (_sock != -1) {
+    close(_sock);
+    if (_address[0] == '/')
+      unlink(_address.c_str());
+  }
+  if (_wakeFd != -1)
+    close(_wakeFd);
+}
+
+void MetricsServer::start() {
+  if (_address.empty())
+    throw InitException((char *)"Invalid metrics address !");
+
+  if (_address[0] == '/') {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (_address.size() >= sizeof(addr.sun_path))
+      throw InitException((char *)"The metrics socket path is too long !");
+    std::strcpy(addr.sun_path, _address.c_str());
+    if ((_sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+      throw InitException(strerror(errno));
+    // a socket file left by a previous run
+    unlink(_address.c_str());
+    if (bind(_sock, (const sockaddr *)&addr, sizeof(addr)) < 0)
+      throw InitException(strerror(errno));
+  } else {
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(atoi(_address.c_str()));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if ((_sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+      throw InitException(strerror(errno));
+    int on = 1;
+    if (setsockopt(_sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0 ||
+        bind(_sock, (const sockaddr *)&addr, sizeof(addr)) < 0)
+      throw InitException(strerror(errno));
+  }
+  if (listen(_sock, 16) < 0)
+    throw InitException(strerror(errno));
+  if ((_wakeFd = eventfd(0, EFD_CLOEXEC)) < 0)
+    throw InitException(strerror(errno));
+
+  // the termination signals stay for the main thread
+  sigset_t set, old;
+  sigemptyset(&set);
+  sigaddset(&set, SIGINT);
+  sigaddset(&set, SIGTERM);
+  sigaddset(&set, SIGQUIT);
+  pthread_sigmask(SIG_BLOCK, &set, &old);
+  _thread = std::thread(&MetricsServer::run, this);
+  pthread_sigmask(SIG_SETMASK, &old, nullptr);
+}
+
+void MetricsServer::run() {
+  pollfd fds[2] = {{_sock, POLLIN, 0}, {_wakeFd, POLLIN, 0}};
+
+  while (true) {
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      std::cerr << "metrics : " << strerror(errno) << std::endl;
+      return;
+    }
+    if (fds[1].revents != 0)
+      return;
+    if ((fds[0].revents & POLLIN) == 0)
+      continue;
+
+    int fd = accept4(_sock, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0)
+      continue;
+    serve(fd);
+    close(fd);
+  }
+}
+
+void MetricsServer::serve(int fd) {
+  // a slow client can only delay the next scrape
+  timeval timeout{1, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+  // the request line is enough, whatever the path
+  char request[1024];
+  if (recv(fd, request, sizeof(request), 0) <= 0)
+    return;
+
+  std::string body = render();
+  std::string response = "HTTP/1.0 200 OK\r\n"
+                         "Content-Type: text/plain; version=0.0.4\r\n"
+                         "Content-Length: " +
+                         std::to_string(body.size()) +
+                         "\r\nConnection: close\r\n\r\n" + body;
+
+  const char *p = response.data();
+  std::size_t left = response.size();
+  while (left > 0) {
+    ssize_t len = send(fd, p, left, MSG_NOSIGNAL);
+    if (len <= 0)
+      return;
+    p += len;
+    left -= len;
+  }
+}
+
+std::string MetricsServer::render() const {
+  std::ostringstream out;
+
+  // the counters and gauges, one series per server thread
+  struct Series {
+    const char *name;
+    const char *type;
+    const char *help;
+    const MetricCounter ServerMetrics::*counter;
+  };
+  static const Series series[] = {
+      {"pgproxy_sessions_accepted_total", "counter",
+       "Client connections accepted.", &ServerMetrics::sessionsAccepted},
+      {"pgproxy_sessions_rejected_total", "counter",
+       "Client connections rejected over the admission limit.",
+       &ServerMetrics::sessionsRejected},
+      {"pgproxy_sessions_failed_total", "counter",
+       "Sessions closed by a remote connect or read/write failure.",
+       &ServerMetrics::sessionsFailed},
+      {"pgproxy_sessions_active", "gauge", "Sessions currently served.",
+       &ServerMetrics::sessionsActive},
+      {"pgproxy_wakeups_total", "counter", "Event loop wakeups.",
+       &ServerMetrics::wakeups},
+      {"pgproxy_spurious_wakeups_total", "counter",
+       "Event loop wakeups that did no socket io and accepted or closed "
+       "nothing.",
+       &ServerMetrics::spuriousWakeups},
+      {"pgproxy_sent_bytes_total", "counter",
+       "Bytes sent to the clients and the remote servers.",
+       &ServerMetrics::sentBytes},
+      {"pgproxy_connects_total", "counter",
+       "Connects to the remote servers completed.", &ServerMetrics::connects},
+      {"pgproxy_events_total", "counter", "Events handled by the event loop.",
+       &ServerMetrics::events},
+  };
+  for (const auto &s : series) {
+    header(out, s.name, s.type, s.help);
+    for (std::size_t t = 0; t < _metrics.size(); ++t)
+      out << s.name << "{thread=\"" << t << "\"} "
+          << (_metrics[t]->*s.counter).get() << '\n';
+  }
+
+  header(out, "pgproxy_bytes_total", "counter",
+         "Bytes received, by direction.");
+  for (std::size_t t = 0; t < _metrics.size(); ++t) {
+    out << "pgproxy_bytes_total{thread=\"" << t
+        << "\",direction=\"request\"} " << _metrics[t]->requestBytes.get()
+        << '\n';
+    out << "pgproxy_bytes_total{thread=\"" << t
+        << "\",direction=\"response\"} " << _metrics[t]->responseBytes.get()
+        << '\n';
+  }
+
+  header(out, "pgproxy_messages_total", "counter",
+         "Frontend messages, by PostgreSQL message type.");
+  for (std::size_t t = 0; t < _metrics.size(); ++t)
+    for (std::size_t type = 0; type < 256; ++type) {
+      uint64_t count = _metrics[t]->messages[type].get();
+      if (count > 0)
+        out << "pgproxy_messages_total{thread=\"" << t << "\",type=\""
+            << typeLabel(type) << "\"} " << count << '\n';
+    }
+
+  // the histograms, cumulative buckets as Prometheus expects
+  struct Histogram {
+    const char *name;
+    const char *help;
+    const MetricHistogram ServerMetrics::*histogram;
+    uint64_t unit; // the recorded units in one exposed unit
+  };
+  static const Histogram histograms[] = {
+      {"pgproxy_events_per_wakeup", "Events returned by one wakeup.",
+       &ServerMetrics::eventsPerWakeup, 1},
+      {"pgproxy_loop_duration_seconds", "Time spent handling one wakeup.",
+       &ServerMetrics::loopMicroseconds, 1000000},
+  };
+  for (const auto &h : histograms) {
+    header(out, h.name, "histogram", h.help);
+    for (std::size_t t = 0; t < _metrics.size(); ++t) {
+      const MetricHistogram &hist = _metrics[t]->*h.histogram;
+      uint64_t cumulative = 0;
+      for (std::size_t i = 0; i < METRICS_HISTOGRAM_BUCKETS; ++i) {
+        cumulative += hist.getBucket(i);
+        if (i + 1 < METRICS_HISTOGRAM_BUCKETS) {
+          out << h.name << "_bucket{thread=\"" << t << "\",le=\"";
+          value(out, MetricHistogram::getBound(i), h.unit);
+          out << "\"} " << cumulative << '\n';
+        }
+      }
+      out << h.name << "_bucket{thread=\"" << t << "\",le=\"+Inf\"} "
+          << cumulative << '\n';
+      out << h.name << "_sum{thread=\"" << t << "\"} ";
+      value(out, hist.getSum(), h.unit);
+      out << '\n';
+      out << h.name << "_count{thread=\"" << t << "\"} " << cumulative
+          << '\n';
+    }
+  }
+
+  // the query latency, the threads are merged (exact for these histograms)
+  header(out, "pgproxy_query_duration_seconds", "summary",
+         "Time from a Query/Sync to its ReadyForQuery.");
+  std::vector<uint64_t> buckets(LATENCY_BUCKETS, 0);
+  uint64_t count = 0, sum = 0;
+  for (const auto *m : _metrics) {
+    for (std::size_t i = 0; i < LATENCY_BUCKETS; ++i)
+      buckets[i] += m->queryMicroseconds.getBucket(i);
+    sum += m->queryMicroseconds.getSum();
+  }
+  for (uint64_t b : buckets)
+    count += b;
+  for (double q : {0.5, 0.9, 0.99, 0.999}) {
+    // the highest value of the bucket holding the quantile
+    uint64_t rank = std::max<uint64_t>(1, std::ceil(q * count));
+    uint64_t cumulative = 0;
+    std::size_t i = 0;
+    while (i + 1 < LATENCY_BUCKETS && cumulative + buckets[i] < rank)
+      cumulative += buckets[i++];
+    out << "pgproxy_query_duration_seconds{quantile=\"" << q << "\"} ";
+    value(out, count > 0 ? LatencyHistogram::getBound(i) : 0, 1000000);
+    out << '\n';
+  }
+  out << "pgproxy_query_duration_seconds_sum ";
+  value(out, sum, 1000000);
+  out << '\n';
+  out << "pgproxy_query_duration_seconds_count " << count << '\n';
+
+  header(out, "pgproxy_log_queue_depth", "gauge",
+         "Records waiting for the async log writer.");
+  out << "pgproxy_log_queue_depth " << _logger->getQueueDepth() << '\n';
+  header(out, "pgproxy_log_dropped_total", "counter",
+         "Log records dropped (async log queue full or write error).");
+  out << "pgproxy_log_dropped_total " << _logger->getDropped() << '\n';
+  if (const SlowQueryLog *slowLog = _logger->getSlowQueryLog()) {
+    header(out, "pgproxy_slow_query_log_dropped_total", "counter",
+           "Slow query lines dropped (too many waiting or write error).");
+    out << "pgproxy_slow_query_log_dropped_total " << slowLog->getDropped()
+        << '\n';
+  }
+
+  const LogPolicy &policy = _logger->getLogPolicy();
+  header(out, "pgproxy_log_policy_dropped_total", "counter",
+         "Query messages the logging policy did not log, by reason.");
+  for (int i = 0; i < LogPolicy::REASONS; ++i) {
+    auto reason = static_cast<LogPolicy::Reason>(i);
+    out << "pgproxy_log_policy_dropped_total{reason=\""
+        << LogPolicy::reasonName(reason) << "\"} "
+        << policy.getDropped(reason) << '\n';
+  }
+  header(out, "pgproxy_log_policy_forced_total", "counter",
+         "Messages logged by an override of the policy (DDL, errors).");
+  out << "pgproxy_log_policy_forced_total " << policy.getForced() << '\n';
+  header(out, "pgproxy_log_policy_bypass", "gauge",
+         "1 while the logging policy is bypassed (everything is logged).");
+  out << "pgproxy_log_policy_bypass " << policy.isBypassed() << '\n';
+
+  if (_cache) {
+    header(out, "pgproxy_result_cache_hits_total", "counter",
+           "Queries answered from the result cache.");
+    out << "pgproxy_result_cache_hits_total " << _cache->getHits() << '\n';
+    header(out, "pgproxy_result_cache_misses_total", "counter",
+           "Cacheable queries sent to the remote server.");
+    out << "pgproxy_result_cache_misses_total " << _cache->getMisses()
+        << '\n';
+    header(out, "pgproxy_result_cache_inserts_total", "counter",
+           "Responses stored in the result cache.");
+    out << "pgproxy_result_cache_inserts_total " << _cache->getInserts()
+        << '\n';
+    header(out, "pgproxy_result_cache_evictions_total", "counter",
+           "Entries removed from the result cache, by reason.");
+    out << "pgproxy_result_cache_evictions_total{reason=\"size\"} "
+        << _cache->getEvictions() << '\n';
+    out << "pgproxy_result_cache_evictions_total{reason=\"expired\"} "
+        << _cache->getExpired() << '\n';
+    header(out, "pgproxy_result_cache_bytes", "gauge",
+           "Memory held by the result cache entries.");
+    out << "pgproxy_result_cache_bytes " << _cache->getBytes() << '\n';
+    header(out, "pgproxy_result_cache_entries", "gauge",
+           "Entries in the result cache.");
+    out << "pgproxy_result_cache_entries " << _cache->getEntries() << '\n';
+  }
+
+  if (_backends) {
+    auto labels = [this](std::size_t i) {
+      const auto &b = _backends->get(i);
+      return "{backend=\"" + b.ip + ":" + std::to_string(b.port) +
+             "\",role=\"" + BackendSet::roleName(b.role) + "\"} ";
+    };
+    header(out, "pgproxy_backend_up", "gauge",
+           "Whether the server passes its health checks.");
+    for (std::size_t i = 0; i < _backends->size(); ++i)
+      out << "pgproxy_backend_up" << labels(i) << _backends->isUp(i) << '\n';
+    header(out, "pgproxy_backend_sessions", "gauge",
+           "Sessions routed to the server.");
+    for (std::size_t i = 0; i < _backends->size(); ++i)
+      out << "pgproxy_backend_sessions" << labels(i)
+          << _backends->getSessions(i) << '\n';
+    header(out, "pgproxy_backend_sessions_total", "counter",
+           "Sessions routed to the server since the start.");
+    for (std::size_t i = 0; i < _backends->size(); ++i)
+      out << "pgproxy_backend_sessions_total" << labels(i)
+          << _backends->getSessionsTotal(i) << '\n';
+    header(out, "pgproxy_backend_ejections_total", "counter",
+           "Times the server was ejected after failed health checks.");
+    for (std::size_t i = 0; i < _backends->size(); ++i)
+      out << "pgproxy_backend_ejections_total" << labels(i)
+          << _backends->getEjections(i) << '\n';
+  }
+
+  return out.str();
+}
+
+MetricsServer::InitException::InitException() {
+  e = std::string("An Error occurred while starting the metrics server!");
+}
+MetricsServer::InitException::InitException(const char *e) : e(e) {}
+
+MetricsServer::InitException::~InitException() throw(){};
+
+const char *MetricsServer::InitException::what() const throw() {
+  return e.c_str();
+}
@@ -0,0 +1,97 @@
+#ifndef __METRICS_SERVER_HPP_
+#define __METRICS_SERVER_HPP_
+
+#include <exception>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Logger.h"
+#include "Metrics.h"
+#include "BackendSet.h"
+#include "ResultCache.h"
+
+/*
+ * @brief serves the metrics of the servers in the Prometheus text format from
+ * its own thread, so the event loops never wait for a scrape: each
+ * connection gets one HTTP response and is closed.
+ *
+ * it listens on a unix socket (an address starting with '/') or on a port of
+ * the loopback interface, e.g. `curl --unix-socket /tmp/proxy.sock
+ * http://localhost/metrics` or `curl http://127.0.0.1:9187/metrics`.
+ */
+class MetricsServer {
+
+public:
+  using uniq_ptr = std::unique_ptr<MetricsServer>;
+
+  /*
+   * @param address : the path of the unix socket or the loopback port.
+   * @param metrics : the metrics of each server (thread), they must outlive
+   * the metrics server.
+   * @param logger : for the depth of the async log queue and the drops.
+   * @param cache : the result cache of the servers, if any.
+   * @param backends : the primary and the replicas, if any.
+   */
+  MetricsServer(const std::string &address,
+                std::vector<const ServerMetrics *> metrics,
+                const ClientLogger::pointer &logger,
+                const ResultCache::pointer &cache = nullptr,
+                const BackendSet::pointer &backends = nullptr);
+
+  /*
+   * @brief stops the thread, closes the socket (and removes the unix socket
+   * file).
+   */
+  ~MetricsServer();
+
+  MetricsServer(const MetricsServer &other) = delete;
+  MetricsServer &operator=(const MetricsServer &other) = delete;
+
+  /*
+   * @brief opens the listening socket and starts the thread.
+   *
+   * @throws InitException on error.
+   */
+  void start();
+
+  /*
+   * @return the metrics in the Prometheus text exposition format.
+   */
+  std::string render() const;
+
+  class InitException : public std::exception {
+  private:
+    std::string e;
+
+  public:
+    InitException();
+    InitException(const char *e);
+    virtual ~InitException() throw();
+    virtual const char *what() const throw();
+  };
+
+private:
+  /*
+   * @brief answers the connections until the wake up eventfd is written.
+   */
+  void run();
+
+  /*
+   * @brief reads the request (best effort, it is not parsed) and writes the
+   * response.
+   */
+  void serve(int fd);
+
+  std::string _address;
+  std::vector<const ServerMetrics *> _metrics;
+  ClientLogger::pointer _logger;
+  ResultCache::pointer _cache;
+  BackendSet::pointer _backends;
+  int _sock = -1;
+  int _wakeFd = -1;
+  std::thread _thread;
+};
+
+#endif // __METRICS_SERVER_HPP_
@@ -0,0 +1,210 @@
+#include "QueryStats.h"
+#include "LogFormat.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <iostream>
+#include <vector>
+
+// chars that are part of a token, a space is kept between two of them
+static bool isWord(char c) {
+  return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '?' ||
+         c == '$' || c == '"' || c == '.' ||
+         static_cast<unsigned char>(c) >= 0x80;
+}
+
+QueryStats::QueryStats(const std::string &filePath, const time_t interval)
+    : _filePath(filePath), _interval(interval), _lastDump(time(nullptr)) {
+  _other.query = "<other>";
+}
+
+QueryStats::~QueryStats() {
+  if (!dump())
+    std::cerr << "could not write the query stats" << std::endl;
+}
+
+std::string_view QueryStats::extractQuery(char type, std::string_view body) {
+  if (type == 'P') {
+    // the statement name comes first
+    std::size_t name = body.find('\0');
+    if (name == std::string_view::npos)
+      return std::string_view();
+    body.remove_prefix(name + 1);
+  } else if (type != 'Q' && type != LOG_EXECUTE_TYPE)
+    return std::string_view();
+
+  return body.substr(0, body.find('\0'));
+}
+
+void QueryStats::record(char type, std::string_view body, time_t now) {
+  std::string_view query = extractQuery(type, body);
+  if (query.empty())
+    return;
+
+  uint64_t fingerprint = normalize(query, _normalized);
+  Entry *e;
+  auto it = _table.find(fingerprint);
+  if (it != _table.end())
+    e = &it->second;
+  else if (_table.size() < MAX_FINGERPRINTS) {
+    e = &_table[fingerprint];
+    e->query = _normalized;
+  } else
+    e = &_other;
+
+  if (e->count++ == 0)
+    e->firstSeen = now;
+  e->lastSeen = now;
+  e->totalBytes += query.size();
+  e->minBytes = std::min<uint64_t>(e->minBytes, query.size());
+  e->maxBytes = std::max<uint64_t>(e->maxBytes, query.size());
+}
+
+void QueryStats::maybeDump(time_t now) {
+  if (now < _lastDump + _interval)
+    return;
+  _lastDump = now;
+  if (!dump())
+    std::cerr << "could not write the query stats" << std::endl;
+}
+
+bool QueryStats::dump() {
+  std::vector<std::pair<uint64_t, const Entry *>> entries;
+  entries.reserve(_table.size() + 1);
+  for (auto &e : _table)
+    entries.emplace_back(e.first, &e.second);
+  if (_other.count > 0)
+    entries.emplace_back(0, &_other);
+  std::sort(entries.begin(), entries.end(), [](auto &a, auto &b) {
+    return a.second->count > b.second->count;
+  });
+
+  std::string tmpPath = _filePath + ".tmp";
+  std::FILE *out = std::fopen(tmpPath.c_str(), "w");
+  if (out == nullptr)
+    return false;
+
+  std::fprintf(out, "# fingerprint\tcount\ttotal_bytes\tmin_bytes\tmax_bytes"
+                    "\tfirst_seen\tlast_seen\tquery\n");
+  for (auto &[fingerprint, e] : entries) {
+    char first[32], last[32];
+    std::tm tm_time;
+    localtime_r(&e->firstSeen, &tm_time);
+    std::strftime(first, sizeof(first), "%Y-%m-%d %X", &tm_time);
+    localtime_r(&e->lastSeen, &tm_time);
+    std::strftime(last, sizeof(last), "%Y-%m-%d %X", &tm_time);
+
+    std::fprintf(out, "%016llx\t%llu\t%llu\t%llu\t%llu\t%s\t%s\t%s\n",
+                 static_cast<unsigned long long>(fingerprint),
+                 static_cast<unsigned long long>(e->count),
+                 static_cast<unsigned long long>(e->totalBytes),
+                 static_cast<unsigned long long>(e->minBytes),
+                 static_cast<unsigned long long>(e->maxBytes), first, last,
+                 e->query.c_str());
+  }
+
+  bool ok = std::fflush(out) == 0;
+  ok = std::fclose(out) == 0 && ok;
+  return ok && std::rename(tmpPath.c_str(), _filePath.c_str()) == 0;
+}
+
+uint64_t QueryStats::normalize(std::string_view q, std::string &out) {
+  std::size_t i = 0, n = q.size();
+  bool space = false; // whitespace was skipped since the last output char
+
+  out.clear();
+
+  // appends a token char, with a space only between two word chars
+  auto put = [&](char c) {
+    if (space && !out.empty() && isWord(out.back()) && isWord(c))
+      out.push_back(' ');
+    out.push_back(c);
+    space = false;
+  };
+
+  while (i < n) {
+    char c = q[i];
+
+    if (std::isspace(static_cast<unsigned char>(c))) {
+      space = true;
+      ++i;
+    } else if (c == '-' && i + 1 < n && q[i + 1] == '-') {
+      // -- comment
+      while (i < n && q[i] != '\n')
+        ++i;
+      space = true;
+    } else if (c == '/' && i + 1 < n && q[i + 1] == '*') {
+      // /* comment */
+      std::size_t end = q.find("*/", i + 2);
+      i = end == std::string_view::npos ? n : end + 2;
+      space = true;
+    } else if (c == '\'') {
+      // string literal, E'' strings have backslash escapes
+      bool escapes = !out.empty() && (out.back() == 'e') &&
+                     (out.size() == 1 || !isWord(out[out.size() - 2]));
+      if (escapes)
+        out.pop_back();
+      for (++i; i < n; ++i) {
+        if (escapes && q[i] == '\\')
+          ++i;
+        else if (q[i] == '\'' && i + 1 < n && q[i + 1] == '\'')
+          ++i;
+        else if (q[i] == '\'')
+          break;
+      }
+      ++i;
+      put('?');
+    } else if (c == '$' && i + 1 < n &&
+               !std::isdigit(static_cast<unsigned char>(q[i + 1])) &&
+               (out.empty() || !isWord(out.back()) || space)) {
+      // $tag$ dollar quoted string
+      std::size_t tagEnd = q.find('$', i + 1);
+      if (tagEnd == std::string_view::npos) {
+        put(c);
+        ++i;
+        continue;
+      }
+      std::string_view tag = q.substr(i, tagEnd - i + 1);
+      std::size_t end = q.find(tag, tagEnd + 1);
+      i = end == std::string_view::npos ? n : end + tag.size();
+      put('?');
+    } else if (std::isdigit(static_cast<unsigned char>(c)) &&
+               (out.empty() || space || !isWord(out.back()))) {
+      // numeric literal
+      while (i < n && (std::isalnum(static_cast<unsigned char>(q[i])) ||
+                       q[i] == '.' ||
+                       ((q[i] == '+' || q[i] == '-') &&
+                        (q[i - 1] == 'e' || q[i - 1] == 'E'))))
+        ++i;
+      put('?');
+    } else if (c == '"') {
+      // quoted identifier, kept as is
+      std::size_t end = q.find('"', i + 1);
+      end = end == std::string_view::npos ? n : end + 1;
+      put('"');
+      out.append(q.data() + i + 1, end - i - 1);
+      i = end;
+    } else if (c == ')') {
+      // collapse a list made only of literals: (?,?,?) -> (...)
+      std::size_t open = out.find_last_of('(');
+      if (open != std::string::npos && open + 1 < out.size() &&
+          out.find_first_not_of("?,", open + 1) == std::string::npos) {
+        out.resize(open + 1);
+        out.append("...");
+      }
+      put(')');
+      ++i;
+    } else {
+      put(static_cast<char>(std::tolower(static_cast<unsigned char>(c))));
+      ++i;
+    }
+  }
+
+  // FNV-1a
+  uint64_t hash = 14695981039346656037ULL;
+  for (char c : out) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
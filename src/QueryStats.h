@@ -0,0 +1,100 @@
+#ifndef __QUERY_STATS_HPP_
+#define __QUERY_STATS_HPP_
+
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// the fingerprints seen after the table is full are counted together
+#define MAX_FINGERPRINTS 10000
+
+/*
+ * @brief aggregated statistics per query fingerprint (pg_stat_statements
+ * style).
+ *
+ * each query is normalized (literals replaced by ?, comments and whitespace
+ * removed, identifiers lower cased, lists of literals like IN lists collapsed
+ * to (...)) and hashed (FNV-1a) into a fingerprint, the table keeps the count,
+ * total/min/max bytes and first/last seen time of each fingerprint and is
+ * dumped periodically to a file.
+ *
+ * this class is not thread safe, the loggers call it from their writing
+ * thread (or under their lock).
+ */
+class QueryStats {
+
+public:
+  using uniq_ptr = std::unique_ptr<QueryStats>;
+
+  struct Entry {
+    std::string query; // the normalized query
+    uint64_t count = 0;
+    uint64_t totalBytes = 0;
+    uint64_t minBytes = UINT64_MAX;
+    uint64_t maxBytes = 0;
+    time_t firstSeen = 0;
+    time_t lastSeen = 0;
+  };
+
+  /*
+   * @param filePath : the file the snapshots are written to (replaced at each
+   * snapshot).
+   * @param interval : the number of seconds between two snapshots.
+   */
+  QueryStats(const std::string &filePath, const time_t interval = 60);
+
+  /*
+   * @brief writes a last snapshot.
+   */
+  ~QueryStats();
+
+  /*
+   * @brief records a message if it holds a query ('Q' simple query, 'P'
+   * parse or an execute record), the other messages are ignored.
+   *
+   * @param type : the type of the message.
+   * @param body : the body of the message.
+   * @param now : the time the message was read.
+   */
+  void record(char type, std::string_view body, time_t now);
+
+  /*
+   * @brief writes a snapshot if the interval elapsed since the last one.
+   */
+  void maybeDump(time_t now);
+
+  /*
+   * @brief writes the table sorted by count to a temporary file then renames
+   * it to the snapshot file.
+   * @return false on error.
+   */
+  bool dump();
+
+  /*
+   * @brief normalizes a query.
+   *
+   * @param query : the sql text.
+   * @param out : cleared then filled with the normalized query.
+   * @return the fingerprint of the normalized query.
+   */
+  static uint64_t normalize(std::string_view query, std::string &out);
+
+  /*
+   * @return the sql text of a 'Q' or 'P' message body or of a
+   * LOG_EXECUTE_TYPE record (empty for the other types).
+   */
+  static std::string_view extractQuery(char type, std::string_view body);
+
+private:
+  std::string _filePath;
+  time_t _interval;
+  time_t _lastDump;
+  std::unordered_map<uint64_t, Entry> _table;
+  Entry _other; // the fingerprints that did not fit in the table
+  std::string _normalized;
+};
+
+#endif // __QUERY_STATS_HPP_
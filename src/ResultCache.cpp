@@ -0,0 +1,378 @@
+#include "ResultCache.h"
+#include <algorithm>
+#include <functional>
+
+namespace {
+
+// chars of a token, a space is only kept between two of them (ascii, the
+// key does not depend on the locale)
+inline bool isWord(char c) {
+  unsigned char u = c;
+  return (u >= 'a' && u <= 'z') || (u >= 'A' && u <= 'Z') ||
+         (u >= '0' && u <= '9') || u == '_' || u == '.' || u == '\'' ||
+         u == '"' || u >= 0x80;
+}
+
+inline bool isSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' ||
+         c == '\v';
+}
+
+/*
+ * @brief the next token of a normalized query from pos: a word (with its
+ * quoted parts) or a punctuation char.
+ * @return false at the end of the query.
+ */
+bool nextToken(std::string_view q, std::size_t &pos, std::string_view &token) {
+  while (pos < q.size() && q[pos] == ' ')
+    ++pos;
+  if (pos == q.size())
+    return false;
+
+  std::size_t start = pos;
+  if (!isWord(q[pos])) {
+    token = q.substr(pos++, 1);
+    return true;
+  }
+  while (pos < q.size() && isWord(q[pos])) {
+    char c = q[pos++];
+    if (c != '\'' && c != '"')
+      continue;
+    // the normalized quotes are balanced, a doubled quote is an escape
+    while (pos < q.size() && q[pos] != c)
+      ++pos;
+    ++pos;
+  }
+  token = q.substr(start, pos - start);
+  return true;
+}
+
+// a SELECT that can not change anything or lock rows
+bool isPlainSelect(std::string_view q) {
+  std::size_t pos = 0;
+  std::string_view token;
+  if (!nextToken(q, pos, token) || token != "select")
+    return false;
+  while (nextToken(q, pos, token))
+    for (const char *word : {"into", "update", "share", "nextval", "setval"})
+      if (token == word)
+        return false;
+  return true;
+}
+
+std::string_view unqualified(std::string_view name) {
+  std::size_t dot = name.rfind('.');
+  return dot == std::string_view::npos ? name : name.substr(dot + 1);
+}
+
+} // namespace
+
+ResultCache::ResultCache(const ResultCacheOptions &options)
+    : _ttl(std::chrono::milliseconds(options.ttl)),
+      _shardBytes(std::max<std::size_t>(options.maxBytes / RESULT_CACHE_SHARDS,
+                                        1)) {
+  std::string normalized;
+  for (const auto &table : options.tables) {
+    normalize(table, normalized);
+    normalized.erase(std::remove(normalized.begin(), normalized.end(), '"'),
+                     normalized.end());
+    if (!normalized.empty())
+      _tables.push_back(normalized);
+  }
+  for (const auto &prefix : options.prefixes)
+    if (normalize(prefix, normalized))
+      _prefixes.push_back(normalized);
+}
+
+bool ResultCache::normalize(std::string_view q, std::string &out) {
+  std::size_t n = q.size();
+  bool space = false; // whitespace or a comment since the last output char
+
+  out.clear();
+  for (std::size_t i = 0; i < n; ++i) {
+    char c = q[i];
+    if (isSpace(c)) {
+      space = true;
+      continue;
+    }
+    if (c == '-' && i + 1 < n && q[i + 1] == '-') {
+      i = std::min(q.find('\n', i), n);
+      space = true;
+      continue;
+    }
+    if (c == '/' && i + 1 < n && q[i + 1] == '*') {
+      std::size_t end = q.find("*/", i + 2);
+      if (end == std::string_view::npos)
+        return false;
+      i = end + 1;
+      space = true;
+      continue;
+    }
+    if (c == '$')
+      return false;
+    if (c == ';') {
+      // only a trailing semicolon
+      if (q.find_first_not_of(" \t\r\n;", i) != std::string_view::npos)
+        return false;
+      break;
+    }
+
+    if (space && !out.empty() && isWord(out.back()) && isWord(c))
+      out.push_back(' ');
+    space = false;
+    if (c == '\'' || c == '"') {
+      // a string or a quoted identifier, as is ('' or "" is an escape)
+      std::size_t end = i + 1;
+      while ((end = q.find(c, end)) != std::string_view::npos &&
+             end + 1 < n && q[end + 1] == c)
+        end += 2;
+      if (end == std::string_view::npos)
+        return false;
+      out.append(q.substr(i, end + 1 - i));
+      i = end;
+    } else
+      out.push_back(c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c);
+  }
+  return !out.empty();
+}
+
+bool ResultCache::changesSession(std::string_view q) {
+  static const std::string_view words[] = {"set", "reset", "discard"};
+  static const std::string_view call = "set_config";
+  std::size_t n = q.size();
+  bool start = true; // at the beginning of a statement
+
+  for (std::size_t i = 0; i < n; ++i) {
+    char c = q[i];
+    if (isSpace(c))
+      continue;
+    if (c == '-' && i + 1 < n && q[i + 1] == '-') {
+      i = std::min(q.find('\n', i), n);
+      continue;
+    }
+    if (c == '/' && i + 1 < n && q[i + 1] == '*') {
+      i = std::min(q.find("*/", i + 2), n) + 1;
+      continue;
+    }
+    if (c == ';') {
+      // the quotes are not skipped, a semicolon in a string only costs the
+      // cache of the session
+      start = true;
+      continue;
+    }
+    if (!isWord(c)) {
+      start = false;
+      continue;
+    }
+
+    std::size_t end = i;
+    while (end < n && isWord(q[end]))
+      ++end;
+    std::string_view word = q.substr(i, end - i);
+    auto equals = [word](std::string_view w) {
+      if (word.size() != w.size())
+        return false;
+      for (std::size_t k = 0; k < w.size(); ++k)
+        if ((word[k] >= 'A' && word[k] <= 'Z' ? word[k] - 'A' + 'a'
+                                              : word[k]) != w[k])
+          return false;
+      return true;
+    };
+    if (equals(call))
+      return true;
+    if (start)
+      for (auto w : words)
+        if (equals(w))
+          return true;
+    start = false;
+    i = end - 1;
+  }
+  return false;
+}
+
+bool ResultCache::readsAllowedTables(std::string_view q) const {
+  std::size_t pos = 0, found = 0;
+  std::string_view token;
+  bool inFrom = false; // in a FROM list, a comma is followed by a table
+  bool expectTable = false;
+
+  while (nextToken(q, pos, token)) {
+    if (token == "from" || token == "join") {
+      inFrom = token == "from";
+      expectTable = true;
+    } else if (expectTable) {
+      if (token == "only" || token == "lateral")
+        continue;
+      expectTable = false;
+      // a subquery, its own FROM is checked
+      if (token == "(")
+        continue;
+
+      std::string_view name = token;
+      std::string unquoted;
+      if (token.find('"') != std::string_view::npos) {
+        unquoted.assign(token);
+        unquoted.erase(std::remove(unquoted.begin(), unquoted.end(), '"'),
+                       unquoted.end());
+        name = unquoted;
+      }
+      bool allowed = false;
+      for (const auto &table : _tables) {
+        if (name == table ||
+            ((name.find('.') == std::string_view::npos ||
+              table.find('.') == std::string::npos) &&
+             unqualified(name) == unqualified(table))) {
+          allowed = true;
+          break;
+        }
+      }
+      if (!allowed)
+        return false;
+      ++found;
+    } else if (token == "," && inFrom) {
+      expectTable = true;
+    } else if (token == ")" || token == "where" || token == "group" ||
+               token == "order" || token == "limit" || token == "offset" ||
+               token == "having" || token == "union" || token == "window" ||
+               token == "intersect" || token == "except" || token == "on" ||
+               token == "using" || token == "select") {
+      inFrom = false;
+    }
+  }
+  return found > 0;
+}
+
+bool ResultCache::makeKey(std::string_view session, std::string_view query,
+                          std::string &key) const {
+  if (!normalize(query, key) || !isPlainSelect(key))
+    return false;
+
+  bool allowed = false;
+  for (const auto &prefix : _prefixes) {
+    if (key.compare(0, prefix.size(), prefix) == 0) {
+      allowed = true;
+      break;
+    }
+  }
+  if (!allowed && (_tables.empty() || !readsAllowedTables(key)))
+    return false;
+
+  key.insert(0, 1, '\0');
+  key.insert(0, session);
+  return true;
+}
+
+ResultCache::Shard &ResultCache::getShard(const std::string &key) {
+  // the high bits, the maps of the shards use the low ones
+  std::size_t h = std::hash<std::string>{}(key);
+  return _shards[(h >> 32) % RESULT_CACHE_SHARDS];
+}
+
+ResultCache::Response ResultCache::find(const std::string &key) {
+  Shard &s = getShard(key);
+  std::lock_guard<std::mutex> lock(s.mutex);
+
+  auto it = s.index.find(key);
+  if (it == s.index.end()) {
+    s.misses.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+  }
+  if (it->second->expires <= Clock::now()) {
+    erase(s, it->second);
+    s.expired.fetch_add(1, std::memory_order_relaxed);
+    s.misses.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+  }
+  s.entries.splice(s.entries.begin(), s.entries, it->second);
+  s.hits.fetch_add(1, std::memory_order_relaxed);
+  return it->second->response;
+}
+
+void ResultCache::insert(const std::string &key, std::string response) {
+  if (response.size() > getEntryMax())
+    return;
+
+  Shard &s = getShard(key);
+  // allocated before the lock
+  auto value = std::make_shared<const std::string>(std::move(response));
+  std::lock_guard<std::mutex> lock(s.mutex);
+
+  // another client may have stored the same query meanwhile
+  auto it = s.index.find(key);
+  if (it != s.index.end())
+    erase(s, it->second);
+
+  s.entries.push_front(Entry{key, std::move(value), Clock::now() + _ttl});
+  s.index.emplace(s.entries.front().key, s.entries.begin());
+  s.bytes += bytes(s.entries.front());
+  s.inserts.fetch_add(1, std::memory_order_relaxed);
+
+  while (s.bytes > _shardBytes && s.entries.size() > 1) {
+    erase(s, std::prev(s.entries.end()));
+    s.evictions.fetch_add(1, std::memory_order_relaxed);
+  }
+  s.bytesGauge.store(s.bytes, std::memory_order_relaxed);
+  s.entriesGauge.store(s.entries.size(), std::memory_order_relaxed);
+}
+
+void ResultCache::erase(Shard &s, std::list<Entry>::iterator it) {
+  // the key of the index is a view on the entry
+  s.index.erase(it->key);
+  s.bytes -= bytes(*it);
+  s.entries.erase(it);
+  s.bytesGauge.store(s.bytes, std::memory_order_relaxed);
+  s.entriesGauge.store(s.entries.size(), std::memory_order_relaxed);
+}
+
+std::size_t ResultCache::getEntryMax() const {
+  return std::min(RESULT_CACHE_ENTRY_MAX, _shardBytes);
+}
+
+uint64_t ResultCache::getHits() const {
+  uint64_t n = 0;
+  for (const auto &s : _shards)
+    n += s.hits.load(std::memory_order_relaxed);
+  return n;
+}
+
+uint64_t ResultCache::getMisses() const {
+  uint64_t n = 0;
+  for (const auto &s : _shards)
+    n += s.misses.load(std::memory_order_relaxed);
+  return n;
+}
+
+uint64_t ResultCache::getInserts() const {
+  uint64_t n = 0;
+  for (const auto &s : _shards)
+    n += s.inserts.load(std::memory_order_relaxed);
+  return n;
+}
+
+uint64_t ResultCache::getEvictions() const {
+  uint64_t n = 0;
+  for (const auto &s : _shards)
+    n += s.evictions.load(std::memory_order_relaxed);
+  return n;
+}
+
+uint64_t ResultCache::getExpired() const {
+  uint64_t n = 0;
+  for (const auto &s : _shards)
+    n += s.expired.load(std::memory_order_relaxed);
+  return n;
+}
+
+std::size_t ResultCache::getBytes() const {
+  std::size_t n = 0;
+  for (const auto &s : _shards)
+    n += s.bytesGauge.load(std::memory_order_relaxed);
+  return n;
+}
+
+std::size_t ResultCache::getEntries() const {
+  std::size_t n = 0;
+  for (const auto &s : _shards)
+    n += s.entriesGauge.load(std::memory_order_relaxed);
+  return n;
+}
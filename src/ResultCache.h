@@ -0,0 +1,175 @@
+#ifndef __RESULT_CACHE_HPP_
+#define __RESULT_CACHE_HPP_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// the cache is split in shards with their own lock and LRU list, the share of
+// the memory cap of a shard is maxBytes / RESULT_CACHE_SHARDS
+#define RESULT_CACHE_SHARDS 16
+
+// the largest response stored (also bounded by the share of a shard)
+#define RESULT_CACHE_ENTRY_MAX (std::size_t(1024 * 1024))
+
+// the bookkeeping of an entry counted in the memory cap with its key and
+// response
+#define RESULT_CACHE_ENTRY_OVERHEAD 128
+
+struct ResultCacheOptions {
+  // the tables (lower case, "name" or "schema.name") a query may read
+  std::vector<std::string> tables;
+  // the beginnings of the cached queries (normalized, see normalize())
+  std::vector<std::string> prefixes;
+  long ttl = 5000; // milliseconds
+  std::size_t maxBytes = 64 * 1024 * 1024;
+};
+
+/*
+ * @brief the responses of the read only simple queries, served by the proxy
+ * without the remote server.
+ *
+ * a query is cached when it is a single SELECT that only reads the allowed
+ * tables (each table after a FROM or a JOIN is in the list) or starts with
+ * one of the allowed prefixes. the key is the session (user and database) and
+ * the normalized text: comments removed, whitespace collapsed and lower case
+ * outside of the quotes, the literals are kept. the value is the whole
+ * response, RowDescription to ReadyForQuery, stored for the ttl.
+ *
+ * the entries are in RESULT_CACHE_SHARDS shards (by hash of the key), each
+ * with a mutex, an LRU list and its share of the memory cap. the clients of
+ * all the threads share the cache, a response is kept alive by the clients
+ * copying it while it is evicted.
+ *
+ * the cache does not know about the writes: a change of an allowed table is
+ * seen once the entries expire, the ttl is the staleness accepted.
+ *
+ * the key holds the settings of the StartupMessage but not the ones changed
+ * during the session: a client stops using the cache once it sent a query
+ * that can change them (see changesSession()). only the responses made of
+ * RowDescription, DataRow, CommandComplete, EmptyQueryResponse and
+ * ReadyForQuery are stored, never the asynchronous messages (notices,
+ * notifications, parameter changes).
+ */
+class ResultCache {
+
+public:
+  using pointer = std::shared_ptr<ResultCache>;
+  using Response = std::shared_ptr<const std::string>;
+
+  explicit ResultCache(const ResultCacheOptions &options);
+
+  /*
+   * @brief builds the key of a query if it can be cached.
+   *
+   * @param session : the user and database of the client.
+   * @param query : the text of a simple query.
+   * @param key : cleared then filled with the key.
+   * @return false if the query is not cached.
+   */
+  bool makeKey(std::string_view session, std::string_view query,
+               std::string &key) const;
+
+  /*
+   * @return the response of the key, nullptr on a miss (or an expired entry,
+   * removed).
+   */
+  Response find(const std::string &key);
+
+  /*
+   * @brief stores the response of the key for the ttl, the least recently
+   * used entries of the shard are evicted to make room. a response over
+   * getEntryMax() is not stored.
+   */
+  void insert(const std::string &key, std::string response);
+
+  /*
+   * @return the size of the largest response stored.
+   */
+  std::size_t getEntryMax() const;
+
+  uint64_t getHits() const;
+  uint64_t getMisses() const;
+  uint64_t getInserts() const;
+  uint64_t getEvictions() const; // to stay under the memory cap
+  uint64_t getExpired() const;
+  std::size_t getBytes() const;
+  std::size_t getEntries() const;
+
+  /*
+   * @brief normalizes a query for the key: comments removed, whitespace
+   * collapsed and lower case outside of the quotes, no trailing semicolon.
+   *
+   * @return false if the query has several statements or a dollar sign
+   * (parameters or dollar quoting).
+   */
+  static bool normalize(std::string_view query, std::string &out);
+
+  /*
+   * @return true if a query may change the state of the session the results
+   * depend on: a statement starting with SET, RESET or DISCARD (SET ROLE,
+   * search_path, the settings of the row level security policies...) or a
+   * call of set_config(). errs on the side of true.
+   */
+  static bool changesSession(std::string_view query);
+
+  /*
+   * @return true if a message of this type can be part of a stored response.
+   */
+  static bool isStored(char type) {
+    return type == 'T' || type == 'D' || type == 'C' || type == 'I' ||
+           type == 'Z';
+  }
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Entry {
+    std::string key;
+    Response response;
+    Clock::time_point expires;
+  };
+
+  struct alignas(64) Shard {
+    std::mutex mutex;
+    std::list<Entry> entries; // the most recently used first
+    std::unordered_map<std::string_view, std::list<Entry>::iterator> index;
+    std::size_t bytes = 0;
+    std::atomic<uint64_t> hits{0}, misses{0}, inserts{0}, evictions{0},
+        expired{0};
+    std::atomic<std::size_t> bytesGauge{0}, entriesGauge{0};
+  };
+
+  Shard &getShard(const std::string &key);
+
+  /*
+   * @brief removes an entry, the shard is locked.
+   */
+  void erase(Shard &shard, std::list<Entry>::iterator it);
+
+  /*
+   * @return true if a normalized SELECT only reads allowed tables.
+   */
+  bool readsAllowedTables(std::string_view query) const;
+
+  static std::size_t bytes(const Entry &e) {
+    return e.key.size() + e.response->size() + RESULT_CACHE_ENTRY_OVERHEAD;
+  }
+
+  std::vector<std::string> _tables;
+  std::vector<std::string> _prefixes;
+  Clock::duration _ttl;
+  std::size_t _shardBytes;
+  std::array<Shard, RESULT_CACHE_SHARDS> _shards;
+};
+
+#endif // __RESULT_CACHE_HPP_
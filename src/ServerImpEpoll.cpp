@@ -1,21 +1,32 @@
 #include "ServerImpEpoll.h"
 #include "IServer.h"
+#include <algorithm>
 #include <ctime>
 #include <string>
 
+std::atomic<int> ServerEpoll::_last_id{0};
+
 ServerEpoll::ServerEpoll(const std::string &localIp, const int localPort,
                          const std::string &remoteIp, const int remotePort,
-                         const ClientLogger::pointer &logger)
-    : IServer(localIp, localPort, remoteIp, remotePort, logger), _servAddr{} {
+                         const ClientLogger::pointer &logger,
+                         const ServerOptions &options)
+    : IServer(localIp, localPort, remoteIp, remotePort, logger, options),
+      _buffers(options.hugePages), _servAddr{} {
   std::cout << "Epoll server !" << std::endl;
-  _last_id = 0;
   _looping = true;
   _logger = logger;
+  if (_options.poolSize > 0)
+    _pool = std::make_unique<BackendPool>(_remoteIP, _remotePort,
+                                          _options.poolSize);
 };
 
 ServerEpoll::~ServerEpoll() {
   if (_epfd != -1)
     close(_epfd);
+  if (_wakeFd != -1)
+    close(_wakeFd);
+  if (_servSock != -1)
+    close(_servSock);
 }
 
 void ServerEpoll::init() {
@@ -25,15 +36,21 @@ void ServerEpoll::init() {
   _servAddr.sin_family = AF_INET;
   if (!inet_aton(_localIP.c_str(), &_servAddr.sin_addr))
     throw InitException((char *)"Invalid localIP address !\n");
-  if ((_servSock = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+  if ((_servSock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                          0)) < 0)
+    throw InitException(strerror(errno));
+  int on = 1;
+  // restart right away, even with connections of the previous run in
+  // TIME_WAIT
+  if (setsockopt(_servSock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0)
+    throw InitException(strerror(errno));
+  if (_options.reusePort &&
+      setsockopt(_servSock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0)
     throw InitException(strerror(errno));
-  int flags = fcntl(_servSock, F_GETFD);
-  flags |= O_NONBLOCK;
-  fcntl(_servSock, F_SETFD, flags);
   if (bind(_servSock, (const struct sockaddr *)&_servAddr, sizeof(_servAddr)) <
       0)
     throw InitException(strerror(errno));
-  if (listen(_servSock, 0) < 0)
+  if (listen(_servSock, _options.backlog) < 0)
     throw InitException(strerror(errno));
 
   // epoll
@@ -46,11 +63,31 @@ void ServerEpoll::init() {
   if (epoll_ctl(_epfd, EPOLL_CTL_ADD, _servSock, &ev) < 0)
     throw InitException(strerror(errno));
 
+  // wake up fd for stop()
+  if ((_wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+    throw InitException(strerror(errno));
+  ev.events = EPOLLIN;
+  ev.data.fd = _wakeFd;
+  if (epoll_ctl(_epfd, EPOLL_CTL_ADD, _wakeFd, &ev) < 0)
+    throw InitException(strerror(errno));
+
   // allocate memory for epoll events
   _ep_events.resize(MAX_EVENTS);
 }
 
-void ServerEpoll::stop() { _looping = false; }
+void ServerEpoll::stop() {
+  _looping = false;
+  // write is async-signal-safe, the loop will be woken up from epoll_wait
+  if (_wakeFd != -1) {
+    uint64_t one = 1;
+    if (write(_wakeFd, &one, sizeof(one)) < 0)
+      return;
+  }
+}
+
+std::vector<const ServerMetrics *> ServerEpoll::getMetrics() const {
+  return {&_metrics};
+}
 
 void ServerEpoll::loop() {
   int nfds = 0;
@@ -58,127 +95,618 @@ void ServerEpoll::loop() {
   while (_looping) {
 
     // poll the sockets
-    if ((nfds = epoll_wait(_epfd, _ep_events.data(), MAX_EVENTS, -1)) < 0)
+    int timeout = checkConnectTimeouts();
+    int retry = checkAcceptRetry();
+    if (retry >= 0 && (timeout < 0 || retry < timeout))
+      timeout = retry;
+    if ((nfds = epoll_wait(_epfd, _ep_events.data(), MAX_EVENTS, timeout)) <
+        0) {
+      if (errno == EINTR)
+        continue;
       throw ProcessingException(strerror(errno));
+    }
+    auto start = std::chrono::steady_clock::now();
+    uint64_t progress = _metrics.getProgress();
+    _metrics.wakeups.add();
+    _metrics.events.add(nfds);
+    _metrics.eventsPerWakeup.record(nfds);
 
     for (int i = 0; i < nfds; ++i) {
+      // if the server was asked to stop
+      if (_ep_events[i].data.fd == _wakeFd)
+        break;
+
       // if there is an event from the proxy server socket
       if (_ep_events[i].data.fd == _servSock) {
         if ((_ep_events[i].events & EPOLLIN) == EPOLLIN)
-          acceptNewClient();
+          acceptClients();
         else if ((_ep_events[i].events & (EPOLLRDHUP | EPOLLERR | EPOLLHUP)) ==
                  (EPOLLRDHUP | EPOLLERR | EPOLLHUP))
           throw ProcessingException("Server socket error !");
 
       } else {
         // the event is either from a client or the remote server
-        if ((_ep_events[i].events & EPOLLIN) == EPOLLIN) {
-          // if the socket is ready to read
-          std::unordered_map<int, Client::pointer>::iterator it;
-          int fd = _ep_events[i].data.fd;
-
-          if ((it = _fdClientMap.find(fd)) != _fdClientMap.end() &&
-              it->second->readyForRead()) {
-            // if the event came from a client socket
-            it->second->readRequest();
-            _logger->log(it->second);
-
-          } else if ((it = _connClientMap.find(fd)) != _connClientMap.end() &&
-                     it->second->readyToReadServerResp()) {
-            // else if event came from a remote server's socket
-            it->second->receiveResponse();
+        int fd = _ep_events[i].data.fd;
+        uint32_t events = _ep_events[i].events;
+
+        // errors and hang ups are reported by the next read/write
+        if ((events & (EPOLLERR | EPOLLHUP)) != 0)
+          events |= EPOLLIN | EPOLLOUT;
+
+        if (fd < 0 || std::size_t(fd) >= _fdTable.size() ||
+            !_fdTable[fd].client)
+          continue;
+
+        // a copy since releasing the connection (or attaching one, which
+        // can grow the table) changes the entry
+        auto c = _fdTable[fd].client;
+        if (!_fdTable[fd].remote) {
+          // if the event came from a client socket
+          try {
+            if ((events & EPOLLIN) == EPOLLIN) {
+              c->readFromClient();
+              _logger->log(c);
+              _metrics.countMessages(c->getLastMessages());
+              c->processCached();
+              if (_pool)
+                servePooled(c);
+              else if (_options.backends)
+                serveRouted(c);
+            }
+            // a response of the proxy itself (cached) goes right away too
+            if ((events & EPOLLOUT) == EPOLLOUT ||
+                (c->hasPendingResponse() &&
+                 (c->watchedClientEvents() & EPOLLOUT) == 0))
+              c->writeToClient();
+
+            // forward the requests right away, EPOLLOUT is only watched on
+            // the connection socket when it could not take all of them
+            if (c->hasPendingRequest() &&
+                (c->watchedRemoteEvents() & EPOLLOUT) == 0)
+              c->writeToRemote();
+            updateEvents(c);
+          } catch (const Client::ClientReadWriteException &e) {
+            std::cerr << "client " << c->getID() << " : " << e.what()
+                      << std::endl;
+            _metrics.sessionsFailed.add();
+          } catch (const Connection::ConnectionException &e) {
+            std::cerr << "client " << c->getID() << " : " << e.what()
+                      << std::endl;
+            // the connect failed, a read only session can use the primary
+            if (!c->isConnecting() || !rerouteFailed(c))
+              _metrics.sessionsFailed.add();
           }
 
-        } else if ((_ep_events[i].events & EPOLLOUT) == EPOLLOUT) {
-          // if the socket is ready to write
-          std::unordered_map<int, Client::pointer>::iterator it;
-          int fd = _ep_events[i].data.fd;
-
-          if ((it = _fdClientMap.find(fd)) != _fdClientMap.end() &&
-              it->second->readyForWrite()) {
-            // if event from client socket
-            it->second->sendResponse();
-
-          } else if ((it = _connClientMap.find(fd)) != _connClientMap.end() &&
-                     it->second->readyToQueryServer()) {
-            // else if event from the remove server socker
-            it->second->sendRequest();
+        } else {
+          // else if event came from a remote server's socket
+          try {
+            if ((events & EPOLLIN) == EPOLLIN) {
+              c->readFromRemote();
+              if (!c->getCompletedQueries().empty()) {
+                _metrics.recordQueries(c->getCompletedQueries());
+                _logger->logCompleted(c);
+              }
+            }
+            if ((events & EPOLLOUT) == EPOLLOUT)
+              c->writeToRemote();
+
+            // same for the responses
+            if (c->hasPendingResponse() &&
+                (c->watchedClientEvents() & EPOLLOUT) == 0)
+              c->writeToClient();
+
+            // the transaction is over, the connection goes back to the pool
+            if (_pool && c->isConnected() && c->canRelease())
+              releaseBackend(c, true);
+            updateEvents(c);
+          } catch (const Client::ClientReadWriteException &e) {
+            std::cerr << "client " << c->getID() << " : " << e.what()
+                      << std::endl;
+            _metrics.sessionsFailed.add();
+          } catch (const Connection::ConnectionException &e) {
+            std::cerr << "client " << c->getID() << " : " << e.what()
+                      << std::endl;
+            // the connect failed, a read only session can use the primary
+            if (!c->isConnecting() || !rerouteFailed(c))
+              _metrics.sessionsFailed.add();
           }
         }
+        markDead(c);
       }
     }
 
     // clear diconnected clients
     clearDisconnected();
+
+    _metrics.loopMicroseconds.record(
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start)
+            .count());
+    if (_metrics.getProgress() == progress)
+      _metrics.spuriousWakeups.add();
   }
 }
 
-void ServerEpoll::acceptNewClient() {
+void ServerEpoll::acceptClients() {
   sockaddr_in clt;
-  unsigned int len = sizeof(clt);
+  socklen_t len;
+
+  for (std::size_t n = 0; n < _options.acceptBatch; ++n) {
+    bool full = _options.maxClients > 0 &&
+                _clientCount >= _options.maxClients;
+    if (full && !_options.rejectOverLimit) {
+      // the connections wait in the accept queue until a client leaves
+      pauseAccept(true);
+      return;
+    }
+
+    len = sizeof(clt);
+    int fd = accept4(_servSock, (sockaddr *)&clt, &len,
+                     SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return;
+      // out of file descriptors or memory: the server socket stays readable,
+      // retry once a client left or after a delay instead of spinning
+      std::cerr << "accept : " << strerror(errno) << std::endl;
+      pauseAccept(true);
+      _acceptRetrying = true;
+      _acceptRetry = std::chrono::steady_clock::now() +
+                     std::chrono::milliseconds(ACCEPT_RETRY_MS);
+      return;
+    }
+
+    if (full)
+      rejectClient(fd);
+    else
+      acceptNewClient(fd, clt);
+  }
+}
+
+void ServerEpoll::acceptNewClient(int fd, const sockaddr_in &addr) {
   char c_ip[255] = {0};
 
-  // create a client
-  int fd = accept(_servSock, (sockaddr *)&clt, &len);
-  if (fd < 0)
-    throw InitException(strerror(errno));
-  inet_ntop(AF_INET, &(clt.sin_addr), c_ip, 255);
+  inet_ntop(AF_INET, &(addr.sin_addr), c_ip, 255);
+  std::string ip(c_ip);
+  Client::pointer c;
   try {
-    std::string ip(c_ip);
-    auto c = std::make_shared<Client>(fd, ip, _remoteIP, _remotePort);
-    _fdClientMap[c->getClientSocket()] = c;
-    _connClientMap[c->getRemoteSocket()] = c;
-
-    c->setID(++_last_id);
-    std::cout << "client from address " << ip << " with id = " << c->getID()
-              << " : is added" << std::endl;
-
-    // add fds to epoll set
-    epoll_event ev; // epoll events
-    ev.events = EPOLLIN | EPOLLOUT;
+    c = std::make_shared<Client>(fd, ip, _remoteIP, _remotePort, _buffers,
+                                 _options.splice, _pool != nullptr,
+                                 _options.backends != nullptr);
+  } catch (const Connection::ConnectionException &e) {
+    // only this client is lost
+    std::cerr << "Could not open a connection with the remote server! "
+              << e.what() << std::endl;
+    close(fd);
+    _metrics.sessionsFailed.add();
+    return;
+  }
+
+  setFd(c->getClientSocket(), c, false);
+  if (c->hasConnection())
+    setFd(c->getRemoteSocket(), c, true);
+  ++_clientCount;
+  _metrics.sessionsAccepted.add();
+  _metrics.sessionsActive.add();
+
+  c->setID(++_last_id);
+  c->setMetrics(&_metrics);
+  c->setResultCache(_options.resultCache.get());
+  c->keepQueryText(_logger->needsQueryText());
+  _logger->connect(c);
+  std::cout << "client from address " << ip << " with id = " << c->getID()
+            << " : is added" << std::endl;
+
+  // add fds to epoll set, only for the events of the current mode
+  epoll_event ev; // epoll events
+  ev.events = c->watchedClientEvents() = c->clientEvents();
+  ev.data.fd = c->getClientSocket();
+  if (epoll_ctl(_epfd, EPOLL_CTL_ADD, c->getClientSocket(), &ev) < 0)
+    throw ProcessingException(
+        (char *)"Could not add the new client socket to the epoll set !");
+
+  // a pooled (routed) client gets its connection once it sent its
+  // StartupMessage
+  if (!c->hasConnection())
+    return;
+
+  ev.events = c->watchedRemoteEvents() = c->remoteEvents();
+  ev.data.fd = c->getRemoteSocket();
+  if (epoll_ctl(_epfd, EPOLL_CTL_ADD, c->getRemoteSocket(), &ev) < 0)
+    throw ProcessingException(
+        (char *)"Could not add the new connection socket to the epoll set !");
+  watchConnect(c);
+}
+
+void ServerEpoll::rejectClient(int fd) {
+  static const std::string error =
+      makeErrorResponse("53300", "sorry, too many clients already");
+
+  // best effort, the socket is new so its send buffer is empty
+  if (send(fd, error.data(), error.size(), MSG_DONTWAIT | MSG_NOSIGNAL) < 0)
+    std::cerr << "reject : " << strerror(errno) << std::endl;
+
+  // closing with unread data (the StartupMessage) would reset the connection
+  // and drop the error, read it first
+  char discard[1024];
+  while (recv(fd, discard, sizeof(discard), MSG_DONTWAIT) > 0)
+    ;
+  close(fd);
+  _metrics.sessionsRejected.add();
+}
+
+void ServerEpoll::pauseAccept(bool pause) {
+  if (pause == _acceptPaused)
+    return;
+
+  epoll_event ev; // epoll events
+  ev.events = pause ? 0 : EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP;
+  ev.data.fd = _servSock;
+  if (epoll_ctl(_epfd, EPOLL_CTL_MOD, _servSock, &ev) < 0)
+    throw ProcessingException(
+        (char *)"Could not modify the server socket in the epoll set !");
+  _acceptPaused = pause;
+}
+
+void ServerEpoll::updateEvents(const Client::pointer &c) {
+  if (!c->isConnected())
+    return;
+
+  epoll_event ev; // epoll events
+  if (c->clientEvents() != c->watchedClientEvents()) {
+    ev.events = c->clientEvents();
     ev.data.fd = c->getClientSocket();
-    if (epoll_ctl(_epfd, EPOLL_CTL_ADD, c->getClientSocket(), &ev) < 0)
+    if (epoll_ctl(_epfd, EPOLL_CTL_MOD, c->getClientSocket(), &ev) < 0)
       throw ProcessingException(
-          (char *)"Could not add the new client socket to the epoll set !");
+          (char *)"Could not modify the client socket in the epoll set !");
+    c->watchedClientEvents() = ev.events;
+  }
 
-    ev.events = EPOLLIN | EPOLLOUT;
+  if (c->hasConnection() && c->remoteEvents() != c->watchedRemoteEvents()) {
+    ev.events = c->remoteEvents();
     ev.data.fd = c->getRemoteSocket();
-    if (epoll_ctl(_epfd, EPOLL_CTL_ADD, c->getRemoteSocket(), &ev) < 0)
+    if (epoll_ctl(_epfd, EPOLL_CTL_MOD, c->getRemoteSocket(), &ev) < 0)
       throw ProcessingException(
-          (char *)"Could not add the new connection socket to the epoll set !");
+          (char *)"Could not modify the connection socket in the epoll set !");
+    c->watchedRemoteEvents() = ev.events;
+  }
+}
 
-  } catch (const Connection::ConnectionException &e) {
-    std::cerr << "Could not opent a connection with the remote server!"
+void ServerEpoll::markDead(const Client::pointer &c) {
+  if (c->isConnected() || c->deadQueued())
+    return;
+  // pushed at the head, the order does not matter
+  c->deadQueued() = true;
+  c->nextDead() = std::move(_dead);
+  _dead = c;
+}
+
+void ServerEpoll::clearDisconnected() {
+  bool removed = _dead != nullptr;
+
+  while (_dead) {
+    auto c = std::move(_dead);
+    _dead = std::move(c->nextDead());
+
+    std::cout << "client from address " << c->getIP()
+              << " with id = " << c->getID() << " : is disconnected !"
               << std::endl;
-    throw ServerEpoll::ProcessingException(e.what());
-  } catch (const std::exception &) {
-    throw ProcessingException((char *)"Could not add a new Client !");
+
+    if (epoll_ctl(_epfd, EPOLL_CTL_DEL, c->getClientSocket(), NULL) < 0)
+      throw ProcessingException(
+          (char *)"Could not delete the client socket from the epoll set !");
+
+    _logger->disconnect(c);
+    if (c->getBackend() >= 0)
+      _options.backends->release(c->getBackend());
+    if (c->waitingBackend()) {
+      auto &waiting = _poolWaiting[c->getPoolKey()];
+      auto w = std::find(waiting.begin(), waiting.end(), c);
+      if (w != waiting.end())
+        waiting.erase(w);
+      c->waitingBackend() = false;
+    }
+    if (_pool && c->hasConnection()) {
+      // an idle connection is reused, one in a transaction is closed
+      releaseBackend(c, c->canRelease());
+    } else if (c->hasConnection()) {
+      if (epoll_ctl(_epfd, EPOLL_CTL_DEL, c->getRemoteSocket(), NULL) < 0)
+        throw ProcessingException((char *)"Could not delete the connection "
+                                          "socket from the epoll set !");
+      clearFd(c->getRemoteSocket());
+    }
+    clearFd(c->getClientSocket());
+    --_clientCount;
+    _metrics.sessionsActive.sub();
   }
+
+  // room for the connections waiting in the accept queue
+  if (_acceptPaused && removed &&
+      (_options.maxClients == 0 || _clientCount < _options.maxClients))
+    pauseAccept(false);
 }
 
-void ServerEpoll::clearDisconnected() {
+void ServerEpoll::setFd(int fd, const Client::pointer &c, bool remote) {
+  if (std::size_t(fd) >= _fdTable.size())
+    _fdTable.resize(std::max<std::size_t>(fd + 1, _fdTable.size() * 2));
+  _fdTable[fd].client = c;
+  _fdTable[fd].remote = remote;
+}
 
-  for (auto it = _fdClientMap.begin(); it != _fdClientMap.end();) {
-    auto c = it->second;
-    if (!c->isConnected()) {
-      std::cout << "client from address " << c->getIP()
-                << " with id = " << c->getID() << " : is disconnected !"
-                << std::endl;
+void ServerEpoll::clearFd(int fd) {
+  if (fd >= 0 && std::size_t(fd) < _fdTable.size())
+    _fdTable[fd].client.reset();
+}
+
+void ServerEpoll::servePooled(const Client::pointer &c) {
+  c->processPooled();
+  if (!c->isConnected() || !c->needsBackend() || c->waitingBackend())
+    return;
+
+  // the pools of the session are on the server it is routed to
+  if (_options.backends && c->getBackend() < 0)
+    c->route(_options.backends->pick(c->isReadOnly()));
+
+  if (!assignBackend(c)) {
+    _poolWaiting[c->getPoolKey()].push_back(c);
+    c->waitingBackend() = true;
+  }
+}
 
-      if (epoll_ctl(_epfd, EPOLL_CTL_DEL, c->getClientSocket(), NULL) < 0)
-        throw ProcessingException(
-            (char *)"Could not delete the client socket from the epoll set !");
+void ServerEpoll::serveRouted(const Client::pointer &c) {
+  c->processPooled();
+  if (!c->getCancelRequest().empty()) {
+    // nothing is answered to a CancelRequest
+    _options.backends->cancel(c->getCancelRequest());
+    c->disconnect();
+    return;
+  }
+  if (!c->isConnected() || !c->needsBackend())
+    return;
+
+  c->route(_options.backends->pick(c->isReadOnly()));
+  connectRouted(c);
+}
+
+void ServerEpoll::connectRouted(const Client::pointer &c) {
+  const auto &b = _options.backends->get(c->getBackend());
+  try {
+    attachBackend(c, std::make_unique<Connection>(b.ip, b.port));
+  } catch (const Connection::ConnectionException &e) {
+    std::cerr << "Could not open a connection with the " << b.ip << ":"
+              << b.port << " server! " << e.what() << std::endl;
+    if (!rerouteFailed(c)) {
+      c->disconnect();
+      _metrics.sessionsFailed.add();
+    }
+  }
+}
 
+bool ServerEpoll::rerouteFailed(const Client::pointer &c) {
+  if (c->getBackend() < 0)
+    return false;
+  std::size_t failed = c->getBackend();
+  _options.backends->reportFailure(failed);
+  if (failed == 0 || !c->canRestart())
+    return false;
+
+  const auto &b = _options.backends->get(failed);
+  std::cerr << "client " << c->getID() << " : the replica " << b.ip << ":"
+            << b.port << " failed, routed to the primary" << std::endl;
+  if (c->hasConnection()) {
+    if (_pool) {
+      releaseBackend(c, false);
+    } else {
       if (epoll_ctl(_epfd, EPOLL_CTL_DEL, c->getRemoteSocket(), NULL) < 0)
         throw ProcessingException((char *)"Could not delete the connection "
                                           "socket from the epoll set !");
+      clearFd(c->getRemoteSocket());
+    }
+  }
+  c->restart();
+  _options.backends->release(failed);
+  c->route(_options.backends->pick(false));
+
+  // a new connection is always opened for the handshake
+  if (_pool)
+    assignBackend(c);
+  else
+    connectRouted(c);
+  return c->isConnected();
+}
+
+bool ServerEpoll::assignBackend(const Client::pointer &c) {
+  const std::string &key = c->getPoolKey();
+
+  if (c->getHandshake() == Client::Handshake::STARTED) {
+    // the client always authenticates through a new connection, the remote
+    // server checks its credentials. once the pool is full the connection is
+    // only opened for the handshake and closed after it
+    std::string ip = _remoteIP;
+    int port = _remotePort;
+    if (c->getBackend() >= 0) {
+      const auto &b = _options.backends->get(c->getBackend());
+      ip = b.ip;
+      port = b.port;
+    }
+    try {
+      if (_pool->canOpen(key)) {
+        attachBackend(c, _pool->open(key, ip, port));
+      } else {
+        c->handshakeOnly() = true;
+        attachBackend(c, std::make_unique<Connection>(ip, port));
+      }
+    } catch (const Connection::ConnectionException &e) {
+      std::cerr << "Could not open a connection with the remote server!"
+                << std::endl;
+      // an attached connection is closed by releaseBackend()
+      if (!c->hasConnection())
+        c->handshakeOnly() = false;
+      if (!rerouteFailed(c)) {
+        c->disconnect();
+        _metrics.sessionsFailed.add();
+      }
+    }
+    return true;
+  }
+
+  auto conn = _pool->acquire(key);
+  if (!conn && _pool->size(key) == 0) {
+    // the connections of the pool were closed by the remote server, the
+    // session can't get a new one without authenticating again
+    std::cerr << "client " << c->getID()
+              << " : no connection left in its pool" << std::endl;
+    c->disconnect();
+    _metrics.sessionsFailed.add();
+    return true;
+  }
+  if (!conn)
+    return false;
+  attachBackend(c, std::move(conn));
+  return true;
+}
+
+void ServerEpoll::attachBackend(const Client::pointer &c,
+                                Connection::uniq_ptr conn) {
+  c->attach(std::move(conn));
+  setFd(c->getRemoteSocket(), c, true);
+
+  epoll_event ev; // epoll events
+  ev.events = c->watchedRemoteEvents() = c->remoteEvents();
+  ev.data.fd = c->getRemoteSocket();
+  if (epoll_ctl(_epfd, EPOLL_CTL_ADD, c->getRemoteSocket(), &ev) < 0)
+    throw ProcessingException(
+        (char *)"Could not add the connection socket to the epoll set !");
+
+  watchConnect(c);
+  if (c->hasPendingRequest())
+    c->writeToRemote();
+  updateEvents(c);
+}
+
+void ServerEpoll::releaseBackend(const Client::pointer &c, const bool reuse) {
+  const std::string &key = c->getPoolKey();
+  int fd = c->getRemoteSocket();
+
+  if (epoll_ctl(_epfd, EPOLL_CTL_DEL, fd, NULL) < 0)
+    throw ProcessingException(
+        (char *)"Could not delete the connection socket from the epoll set !");
+  clearFd(fd);
+
+  if (c->handshakeOnly()) {
+    // not counted in the pool, nobody waits for it
+    c->handshakeOnly() = false;
+    auto conn = c->detach();
+    if (reuse) {
+      // best effort, the connection is idle so its send buffer is empty
+      static const char terminate[] = {'X', 0, 0, 0, 4};
+      iovec iov{const_cast<char *>(terminate), sizeof(terminate)};
+      conn->send(&iov, 1);
+    }
+    return;
+  }
+
+  if (reuse) {
+    _pool->release(key, c->detach());
+  } else {
+    c->detach(); // closes the connection
+    _pool->discard(key);
+  }
+  serveWaiting(key);
+}
+
+void ServerEpoll::serveWaiting(const std::string &key) {
+  auto it = _poolWaiting.find(key);
+  if (it == _poolWaiting.end())
+    return;
+
+  auto &waiting = it->second;
+  while (!waiting.empty()) {
+    auto c = waiting.front();
+    try {
+      if (c->isConnected() && c->needsBackend() && !assignBackend(c))
+        break;
+      waiting.pop_front();
+      c->waitingBackend() = false;
+      updateEvents(c);
+    } catch (const Client::ClientReadWriteException &e) {
+      std::cerr << "client " << c->getID() << " : " << e.what() << std::endl;
+      _metrics.sessionsFailed.add();
+    } catch (const Connection::ConnectionException &e) {
+      std::cerr << "client " << c->getID() << " : " << e.what() << std::endl;
+      _metrics.sessionsFailed.add();
+    }
+    markDead(c);
+  }
+}
+
+void ServerEpoll::watchConnect(const Client::pointer &c) {
+  if (_options.connectTimeout > 0 && c->isConnecting())
+    _connecting.emplace_back(std::chrono::steady_clock::now() +
+                                 std::chrono::milliseconds(
+                                     _options.connectTimeout),
+                             c);
+}
+
+int ServerEpoll::checkConnectTimeouts() {
+  auto now = std::chrono::steady_clock::now();
+  bool expired = false;
+  int timeout = -1;
+
+  while (!_connecting.empty()) {
+    // a copy, rerouting the client adds its new connect to the queue
+    auto [deadline, c] = _connecting.front();
+    if (c->isConnected() && c->isConnecting()) {
+      if (deadline > now) {
+        // round up so the deadline is over when epoll_wait returns
+        timeout = std::chrono::duration_cast<std::chrono::milliseconds>(
+                      deadline - now)
+                      .count() +
+                  1;
+        break;
+      }
+      std::cerr << "client " << c->getID()
+                << " : timeout while connecting to the remote server"
+                << std::endl;
+      _connecting.pop_front();
+      if (!rerouteFailed(c)) {
+        c->disconnect();
+        _metrics.sessionsFailed.add();
+        markDead(c);
+        expired = true;
+      }
+      continue;
+    }
+    _connecting.pop_front();
+  }
 
-      auto p = _connClientMap.find(c->getRemoteSocket());
-      _connClientMap.erase(p);
-      it = _fdClientMap.erase(it);
-    } else
-      ++it;
+  if (expired)
+    clearDisconnected();
+  return timeout;
+}
+
+int ServerEpoll::checkAcceptRetry() {
+  if (!_acceptRetrying)
+    return -1;
+  if (!_acceptPaused) {
+    // a client left meanwhile
+    _acceptRetrying = false;
+    return -1;
   }
+
+  auto now = std::chrono::steady_clock::now();
+  if (_acceptRetry > now)
+    // round up so the delay is over when epoll_wait returns
+    return std::chrono::duration_cast<std::chrono::milliseconds>(_acceptRetry -
+                                                                 now)
+               .count() +
+           1;
+  _acceptRetrying = false;
+  if (_options.maxClients == 0 || _clientCount < _options.maxClients)
+    pauseAccept(false);
+  return -1;
 }
 
 ServerEpoll::InitException::InitException() {
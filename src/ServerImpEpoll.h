@@ -6,23 +6,34 @@
  */
 
 #include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
 #include <ctime>
+#include <deque>
 #include <fcntl.h>
 #include <iostream>
 #include <map>
 #include <memory>
 #include <netinet/in.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <unordered_map>
 #include <vector>
 
+#include "BackendPool.h"
+#include "BufferPool.h"
 #include "Client.h"
 #include "IServer.h"
 #include "Logger.h"
+#include "Metrics.h"
 
 #define MAX_EVENTS 128
 
+// how long accepting stays paused after accept4() ran out of file descriptors
+// or memory, when no client can leave to free some
+#define ACCEPT_RETRY_MS 100
+
 class Client;
 
 class ServerEpoll : public IServer {
@@ -36,12 +47,16 @@ public:
    * @param remoteIP : the ip (ipv4) address of the remote server.
    * @param remotePort : the port of the remote server.
    * @param logger : the object responsible for logging the client state.
+   * @param options : the optional settings, with options.reusePort several
+   * servers (one per thread) can share the same local port, with
+   * options.poolSize the server owns a BackendPool.
    *
    * @note initializes looping to true and logFile to null.
    */
   ServerEpoll(const std::string &localIp, const int localPort,
               const std::string &remoteIp, const int remotePort,
-              const ClientLogger::pointer &logger);
+              const ClientLogger::pointer &logger,
+              const ServerOptions &options = ServerOptions());
 
   /*
    * @brief close the server socket and disconnects.
@@ -51,29 +66,39 @@ public:
   /*
    * @brief opens a listening socket (socket/bind/listen) and sets it to
    * NONBLOCK. then it creates an epoll instance with epoll_create1 and adds the
-   * server socket to the epoll set of fds to be monitored.
+   * server socket and the wake up eventfd to the epoll set of fds to be
+   * monitored.
    *
    * @throws InitException on error.
    */
   void init() override;
 
   /*
-   * @brief works while _looping == true, uses epoll_wait with infinite time to
-   * wait for io event to occur on one of the fds monitored by epoll if servSock
+   * @brief works while _looping == true, uses epoll_wait (with a timeout only
+   * while connects are in progress, see checkConnectTimeouts()) to wait for io
+   * event to occur on one of the fds monitored by epoll if servSock
    * is ready for reading it accepts a new client then loops for each file
    * descriptor in the ep_events and checks if it is a client or connection
-   * socket and accordingly to the client mode it performs a read/write to the
-   * client/remoteServer finally it deletes the disconnected clients.
+   * socket and performs the reads/writes the events allow in both directions
+   * (the session is full duplex), pending data is forwarded right away. a
+   * read/write error only disconnects the client it happened on. finally it
+   * deletes the disconnected clients.
    *
    * throws ProcessingException on error.
    */
   void loop() override;
 
   /*
-   * @brief sets looping parameter to false.
+   * @brief sets looping parameter to false and wakes up epoll_wait through the
+   * eventfd, so it can be called from a signal handler or from another thread.
    */
   void stop() override;
 
+  /*
+   * @return the metrics of this server (one event loop thread).
+   */
+  std::vector<const ServerMetrics *> getMetrics() const override;
+
   class InitException : public std::exception {
   private:
     std::string e;
@@ -99,31 +124,193 @@ public:
 
 private:
   /*
-   * @brief accepts a new connection to the server socket then creates a new
-   *client object and adds it to the fdClientMap and connClientMap, then it adds
-   *the client socket and the connection socket to the epoll set to be monitored
-   *by epoll using epoll_ctl function, it monitors them for read and write by
-   *setting the events mask to EPOLLIN | EPOLLOUT.
+   * @brief drains the accept queue of the server socket with accept4(), at
+   * most acceptBatch connections per call (the rest is accepted at the next
+   * iteration, after the clients had their turn).
+   * admission control: once maxClients clients are served, the new
+   * connections are either left in the accept queue (the server socket is
+   * not watched until a client leaves) or rejected right away.
+   * out of file descriptors or memory, accepting is paused until a client
+   * leaves or for ACCEPT_RETRY_MS (see checkAcceptRetry()).
    *
-   * @throws ProcessingException or InitException on error.
+   * @throws ProcessingException on error.
    */
-  void acceptNewClient();
+  void acceptClients();
 
   /*
-   * @brief loops through the clients list and deletes the disconnected client
-   * and removes them from the epoll set.
+   * @brief creates a client for an accepted connection and adds it to the
+   *fd table for both sockets, then it adds the client socket and the
+   *connection socket to the epoll set to be monitored by epoll using epoll_ctl
+   *function, for the events the client mode needs.
+   * if the connection to the remote server can not be created the client is
+   *closed and the server goes on.
+   *
+   * @throws ProcessingException on error.
+   */
+  void acceptNewClient(int fd, const sockaddr_in &addr);
+
+  /*
+   * @brief answers a connection over the limit with an ErrorResponse
+   * (too_many_connections) and closes it.
+   */
+  void rejectClient(int fd);
+
+  /*
+   * @brief stops (or resumes) watching the server socket, the connections
+   * wait in the accept queue meanwhile.
+   *
+   * @throws ProcessingException on error.
+   */
+  void pauseAccept(bool pause);
+
+  /*
+   * @brief updates the events monitored for the client and connection sockets
+   * when they differ from the ones the client mode needs, so EPOLLOUT is only
+   * armed while there is pending output.
+   *
+   * @throws ProcessingException on error.
+   */
+  void updateEvents(const Client::pointer &c);
+
+  /*
+   * @brief queues the client on the dead list if it is disconnected (once),
+   * called after each operation that can disconnect a client.
+   */
+  void markDead(const Client::pointer &c);
+
+  /*
+   * @brief deletes the clients of the dead list and removes them from the
+   * epoll set, the cost does not depend on the number of connected clients.
    */
   void clearDisconnected();
 
-  int _servSock;
-  int _last_id;
-  std::unordered_map<int, Client::pointer> _fdClientMap;
-  std::unordered_map<int, Client::pointer> _connClientMap;
+  /*
+   * @brief sets (clears) the entry of a socket in the fd table.
+   */
+  void setFd(int fd, const Client::pointer &c, bool remote);
+  void clearFd(int fd);
+
+  /*
+   * @brief pooling mode: lets the client process its startup messages then
+   * assigns it a connection if it needs one, or queues it until a connection
+   * of its pool is released. with a BackendSet the session is routed once,
+   * all its transactions use the pool of that server.
+   *
+   * @throws ProcessingException on error.
+   */
+  void servePooled(const Client::pointer &c);
+
+  /*
+   * @brief routing mode without pooling: lets the client process its startup
+   * messages then connects it, for the whole session, to the server the
+   * BackendSet picks (a replica for a read only session).
+   *
+   * @throws ProcessingException on error.
+   */
+  void serveRouted(const Client::pointer &c);
+
+  /*
+   * @brief routing mode without pooling: connects the client to the server
+   * it is routed to.
+   *
+   * @throws ProcessingException on error.
+   */
+  void connectRouted(const Client::pointer &c);
+
+  /*
+   * @brief the connection of a routed client could not be opened (or timed
+   * out): reports the failure to the BackendSet and, if the session was
+   * routed to a replica and nothing was exchanged with it yet, routes it to
+   * the primary and connects it there.
+   * @return true if the session goes on with the primary.
+   *
+   * @throws ProcessingException on error.
+   */
+  bool rerouteFailed(const Client::pointer &c);
+
+  /*
+   * @brief gives the client a new connection to authenticate (one of its
+   * pool, or one only for the handshake when the pool is full) or an idle
+   * connection of its pool (the client is disconnected if its pool has none
+   * left).
+   * @return false if the client has to wait.
+   *
+   * @throws ProcessingException on error.
+   */
+  bool assignBackend(const Client::pointer &c);
+
+  /*
+   * @brief attaches a connection to the client, forwards its pending
+   * requests and adds the connection socket to the epoll set.
+   *
+   * @throws ProcessingException on error.
+   */
+  void attachBackend(const Client::pointer &c, Connection::uniq_ptr conn);
+
+  /*
+   * @brief removes the connection of the client from the epoll set and gives
+   * it back to the pool (reuse) or closes it, then serves the clients
+   * waiting for that pool. a connection opened only for the handshake is
+   * closed (with a Terminate if it is idle).
+   *
+   * @throws ProcessingException on error.
+   */
+  void releaseBackend(const Client::pointer &c, const bool reuse);
+
+  /*
+   * @brief assigns the released connections to the waiting clients in
+   * order.
+   */
+  void serveWaiting(const std::string &key);
+
+  /*
+   * @brief remembers the deadline of the connect of the client, if it is in
+   * progress.
+   */
+  void watchConnect(const Client::pointer &c);
+
+  /*
+   * @brief disconnects the clients whose connect is over its deadline (or
+   * routes them to the primary, see rerouteFailed()).
+   * @return the epoll_wait timeout until the next deadline (-1 if none).
+   */
+  int checkConnectTimeouts();
+
+  /*
+   * @brief resumes accepting once the retry delay of a failed accept is over.
+   * @return the epoll_wait timeout until then (-1 if accepting is not
+   * waiting for a retry).
+   */
+  int checkAcceptRetry();
+
+  int _servSock = -1;
+  static std::atomic<int> _last_id; // shared by all the servers (threads)
+  BufferPool _buffers; // declared before the clients, which borrow from it
+  // the client of each socket, indexed by fd (the kernel hands out the lowest
+  // free fds so the table stays dense)
+  struct FdEntry {
+    Client::pointer client;
+    bool remote = false; // the connection socket of the client
+  };
+  std::vector<FdEntry> _fdTable;
+  std::size_t _clientCount = 0;
+  Client::pointer _dead; // the disconnected clients, linked by nextDead()
   sockaddr_in _servAddr;
-  volatile bool _looping;
+  std::atomic<bool> _looping;
   ClientLogger::pointer _logger;
-  int _epfd = -1; // epoll instance fd
+  int _epfd = -1;   // epoll instance fd
+  int _wakeFd = -1; // eventfd used by stop() to interrupt epoll_wait
+  bool _acceptPaused = false; // the server socket is not watched
+  bool _acceptRetrying = false; // paused by a failed accept until _acceptRetry
+  std::chrono::steady_clock::time_point _acceptRetry;
   std::vector<epoll_event> _ep_events;
+  BackendPool::uniq_ptr _pool; // pooling mode only
+  // the clients connecting to the remote server by deadline (the timeout is
+  // the same for all, so in connect order)
+  std::deque<std::pair<std::chrono::steady_clock::time_point, Client::pointer>>
+      _connecting;
+  std::unordered_map<std::string, std::deque<Client::pointer>> _poolWaiting;
+  ServerMetrics _metrics; // only written by the loop thread
 };
 
 #endif
@@ -0,0 +1,635 @@
+#include "ServerImpIoUring.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+std::atomic<int> ServerIoUring::_last_id{0};
+
+namespace {
+
+int uringSetup(unsigned entries, io_uring_params *p) {
+  return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+int uringEnter(int fd, unsigned toSubmit, unsigned minComplete,
+               unsigned flags, const void *arg, std::size_t argSize) {
+  return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags,
+                      arg, argSize);
+}
+
+int uringRegister(int fd, unsigned opcode, const void *arg,
+                  unsigned nrArgs) {
+  return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs);
+}
+
+// the user data of an operation: the client id and the operation
+uint64_t userData(uint8_t op, int id) {
+  return (uint64_t(uint32_t(id)) << 8) | op;
+}
+
+} // namespace
+
+ServerIoUring::ServerIoUring(const std::string &localIp, const int localPort,
+                             const std::string &remoteIp, const int remotePort,
+                             const ClientLogger::pointer &logger,
+                             const ServerOptions &options)
+    : IServer(localIp, localPort, remoteIp, remotePort, logger, options),
+      _servAddr{}, _buffers(options.hugePages) {
+  std::cout << "io_uring server !" << std::endl;
+  _looping = true;
+  _logger = logger;
+}
+
+ServerIoUring::~ServerIoUring() {
+  // closing the ring cancels the operations still in flight
+  if (_ringFd != -1)
+    close(_ringFd);
+  if (_sqes != nullptr)
+    munmap(_sqes, _sqesSize);
+  if (_sqRing != nullptr)
+    munmap(_sqRing, _sqRingSize);
+  if (_bufRing != nullptr)
+    munmap(_bufRing, URING_BUFFERS * sizeof(io_uring_buf));
+  if (_bufBase != nullptr)
+    munmap(_bufBase, URING_BUFFERS * URING_BUFFER_SIZE);
+  if (_wakeFd != -1)
+    close(_wakeFd);
+  if (_servSock != -1)
+    close(_servSock);
+}
+
+void ServerIoUring::init() {
+
+  // listening socket
+  _servAddr.sin_port = htons(_localPort);
+  _servAddr.sin_family = AF_INET;
+  if (!inet_aton(_localIP.c_str(), &_servAddr.sin_addr))
+    throw InitException((char *)"Invalid localIP address !\n");
+  if ((_servSock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+    throw InitException(strerror(errno));
+  int on = 1;
+  if (setsockopt(_servSock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0)
+    throw InitException(strerror(errno));
+  if (_options.reusePort &&
+      setsockopt(_servSock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0)
+    throw InitException(strerror(errno));
+  if (bind(_servSock, (const struct sockaddr *)&_servAddr, sizeof(_servAddr)) <
+      0)
+    throw InitException(strerror(errno));
+  if (listen(_servSock, _options.backlog) < 0)
+    throw InitException(strerror(errno));
+
+  // the ring, only this thread submits and the completions are only needed
+  // when it waits for them
+  io_uring_params params;
+  std::memset(&params, 0, sizeof(params));
+  params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+  if ((_ringFd = uringSetup(URING_ENTRIES, &params)) < 0 && errno == EINVAL) {
+    // an older kernel
+    std::memset(&params, 0, sizeof(params));
+    _ringFd = uringSetup(URING_ENTRIES, &params);
+  }
+  if (_ringFd < 0)
+    throw InitException(strerror(errno));
+  if ((params.features & IORING_FEAT_SINGLE_MMAP) == 0 ||
+      (params.features & IORING_FEAT_EXT_ARG) == 0)
+    throw InitException((char *)"io_uring is too old (Linux 6.0+ needed) !");
+
+  // the submission and completion rings share one mapping
+  _sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  _cqRingSize =
+      params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  _sqRingSize = std::max(_sqRingSize, _cqRingSize);
+  void *ring = mmap(nullptr, _sqRingSize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_SQ_RING);
+  if (ring == MAP_FAILED)
+    throw InitException(strerror(errno));
+  _sqRing = _cqRing = ring;
+
+  _sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+  void *sqes = mmap(nullptr, _sqesSize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED)
+    throw InitException(strerror(errno));
+  _sqes = static_cast<io_uring_sqe *>(sqes);
+
+  char *sq = static_cast<char *>(_sqRing);
+  _sqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+  _sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+  _sqMask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+  _sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+  _sqEntries = params.sq_entries;
+  char *cq = static_cast<char *>(_cqRing);
+  _cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+  _cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+  _cqMask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+  _cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+  // the provided buffers: the kernel picks one for each received packet and
+  // the buffer is given back once its content is copied to the client
+  void *bufRing = mmap(nullptr, URING_BUFFERS * sizeof(io_uring_buf),
+                       PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                       -1, 0);
+  if (bufRing == MAP_FAILED)
+    throw InitException(strerror(errno));
+  _bufRing = static_cast<io_uring_buf_ring *>(bufRing);
+  void *bufBase = mmap(nullptr, URING_BUFFERS * URING_BUFFER_SIZE,
+                       PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                       -1, 0);
+  if (bufBase == MAP_FAILED)
+    throw InitException(strerror(errno));
+  _bufBase = static_cast<char *>(bufBase);
+
+  io_uring_buf_reg reg;
+  std::memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = reinterpret_cast<uint64_t>(_bufRing);
+  reg.ring_entries = URING_BUFFERS;
+  reg.bgid = 0;
+  if (uringRegister(_ringFd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    throw InitException(strerror(errno));
+  for (uint16_t id = 0; id < URING_BUFFERS; ++id)
+    recycleBuffer(id);
+
+  // wake up fd for stop()
+  if ((_wakeFd = eventfd(0, EFD_CLOEXEC)) < 0)
+    throw InitException(strerror(errno));
+
+  armAccept();
+  armWake();
+}
+
+void ServerIoUring::stop() {
+  _looping = false;
+  // write is async-signal-safe, the pending read of the eventfd completes
+  if (_wakeFd != -1) {
+    uint64_t one = 1;
+    if (write(_wakeFd, &one, sizeof(one)) < 0)
+      return;
+  }
+}
+
+std::vector<const ServerMetrics *> ServerIoUring::getMetrics() const {
+  return {&_metrics};
+}
+
+void ServerIoUring::loop() {
+
+  while (_looping) {
+    submitAndWait(checkConnectTimeouts());
+    auto start = std::chrono::steady_clock::now();
+    uint64_t progress = _metrics.getProgress();
+
+    // the completions, the kernel only reuses the entries once the head moved
+    unsigned head = *_cqHead;
+    unsigned tail = __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE);
+    _metrics.wakeups.add();
+    _metrics.events.add(tail - head);
+    _metrics.eventsPerWakeup.record(tail - head);
+    for (; head != tail; ++head) {
+      io_uring_cqe cqe = _cqes[head & *_cqMask];
+      __atomic_store_n(_cqHead, head + 1, __ATOMIC_RELEASE);
+      handle(cqe);
+    }
+
+    // delete the sessions the kernel is done with
+    for (int id : _closed) {
+      auto it = _sessions.find(id);
+      if (it == _sessions.end())
+        continue;
+      auto &c = it->second.client;
+      std::cout << "client from address " << c->getIP()
+                << " with id = " << c->getID() << " : is disconnected !"
+                << std::endl;
+      _logger->disconnect(c);
+      _sessions.erase(it);
+      _metrics.sessionsActive.sub();
+    }
+    if (!_closed.empty() && !_acceptArmed && _looping && !isFull())
+      armAccept();
+    _closed.clear();
+
+    _metrics.loopMicroseconds.record(
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start)
+            .count());
+    if (_metrics.getProgress() == progress)
+      _metrics.spuriousWakeups.add();
+  }
+}
+
+void ServerIoUring::handle(const io_uring_cqe &cqe) {
+  uint8_t op = cqe.user_data & 0xff;
+  int id = int(cqe.user_data >> 8);
+  bool more = (cqe.flags & IORING_CQE_F_MORE) != 0;
+
+  if (op == ACCEPT) {
+    if (cqe.res >= 0 && isFull() && _options.rejectOverLimit)
+      rejectClient(cqe.res);
+    else if (cqe.res >= 0)
+      acceptNewClient(cqe.res);
+    else if (cqe.res != -ECANCELED)
+      std::cerr << "accept : " << strerror(-cqe.res) << std::endl;
+
+    if (!more) {
+      // the multishot accept stops on errors (out of file descriptors...)
+      // and when cancelled, it is armed again once a client left
+      _acceptArmed = _acceptStop = false;
+      if (cqe.res >= 0 && _looping && !isFull())
+        armAccept();
+    } else if (isFull() && !_options.rejectOverLimit && !_acceptStop) {
+      // the connections wait in the accept queue until a client leaves
+      _acceptStop = true;
+      io_uring_sqe *sqe = getSqe(CANCEL, 0);
+      sqe->opcode = IORING_OP_ASYNC_CANCEL;
+      sqe->addr = userData(ACCEPT, 0);
+    }
+    return;
+  }
+  if (op == WAKE)
+    return;
+
+  auto it = _sessions.find(id);
+  if (it == _sessions.end())
+    return;
+  Session &s = it->second;
+  auto &c = s.client;
+  // a multishot operation is over with its last completion
+  if (!more)
+    --s.inflight;
+
+  try {
+    switch (op) {
+    case CLIENT_RECV:
+    case REMOTE_RECV: {
+      bool remote = op == REMOTE_RECV;
+      if (!more) {
+        (remote ? s.remoteRecv : s.clientRecv) = false;
+        (remote ? s.remoteRecvStop : s.clientRecvStop) = false;
+      }
+      if (cqe.res > 0 && (cqe.flags & IORING_CQE_F_BUFFER) != 0) {
+        uint16_t bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+        std::string_view data(_bufBase + bid * URING_BUFFER_SIZE, cqe.res);
+        if (c->isConnected() && remote) {
+          c->receivedFromRemote(data);
+          if (!c->getCompletedQueries().empty()) {
+            _metrics.recordQueries(c->getCompletedQueries());
+            _logger->logCompleted(c);
+          }
+        } else if (c->isConnected()) {
+          c->receivedFromClient(data);
+          _logger->log(c);
+          _metrics.countMessages(c->getLastMessages());
+          c->processCached();
+        }
+        recycleBuffer(bid);
+      } else if (cqe.res == 0 && c->isConnected()) {
+        if (remote)
+          c->remoteClosed();
+        else
+          c->clientClosed();
+      } else if (cqe.res < 0 && cqe.res != -ENOBUFS &&
+                 cqe.res != -ECANCELED && c->isConnected()) {
+        // out of provided buffers or stopped: armed again by update()
+        std::cerr << "client " << c->getID() << " : " << strerror(-cqe.res)
+                  << std::endl;
+        c->disconnect();
+        _metrics.sessionsFailed.add();
+      }
+      break;
+    }
+    case CLIENT_SEND:
+    case REMOTE_SEND: {
+      bool remote = op == REMOTE_SEND;
+      (remote ? s.remoteSend : s.clientSend) = false;
+      if (cqe.res >= 0 && remote)
+        c->sentToRemote(cqe.res);
+      else if (cqe.res >= 0)
+        c->sentToClient(cqe.res);
+      else if (cqe.res != -ECANCELED && c->isConnected()) {
+        std::cerr << "client " << c->getID() << " : " << strerror(-cqe.res)
+                  << std::endl;
+        c->disconnect();
+        _metrics.sessionsFailed.add();
+      }
+      break;
+    }
+    case CONNECT:
+      s.connecting = false;
+      if (c->isConnected() && !c->finishConnect())
+        armConnect(s);
+      break;
+    default:
+      break;
+    }
+  } catch (const Connection::ConnectionException &e) {
+    std::cerr << "client " << c->getID() << " : " << e.what() << std::endl;
+    _metrics.sessionsFailed.add();
+  }
+
+  update(s);
+  if (s.closing && s.inflight == 0)
+    _closed.push_back(id);
+}
+
+void ServerIoUring::acceptNewClient(int fd) {
+  sockaddr_in clt;
+  socklen_t len = sizeof(clt);
+  char c_ip[255] = {0};
+
+  if (getpeername(fd, (sockaddr *)&clt, &len) == 0)
+    inet_ntop(AF_INET, &(clt.sin_addr), c_ip, 255);
+
+  Client::pointer c;
+  std::string ip(c_ip);
+  try {
+    c = std::make_shared<Client>(fd, ip, _remoteIP, _remotePort, _buffers);
+  } catch (const Connection::ConnectionException &e) {
+    // the client is dropped, the server goes on
+    std::cerr << "Could not open a connection with the remote server! "
+              << e.what() << std::endl;
+    close(fd);
+    _metrics.sessionsFailed.add();
+    return;
+  }
+
+  c->setID(++_last_id);
+  c->setMetrics(&_metrics);
+  c->setResultCache(_options.resultCache.get());
+  c->keepQueryText(_logger->needsQueryText());
+  _metrics.sessionsAccepted.add();
+  _metrics.sessionsActive.add();
+  _logger->connect(c);
+  std::cout << "client from address " << ip << " with id = " << c->getID()
+            << " : is added" << std::endl;
+
+  Session &s = _sessions[c->getID()];
+  s.client = c;
+  armRecv(s, false);
+  if (c->isConnecting()) {
+    armConnect(s);
+    if (_options.connectTimeout > 0)
+      _connecting.emplace_back(std::chrono::steady_clock::now() +
+                                   std::chrono::milliseconds(
+                                       _options.connectTimeout),
+                               c->getID());
+  } else
+    armRecv(s, true);
+}
+
+void ServerIoUring::update(Session &s) {
+  auto &c = s.client;
+
+  if (!c->isConnected()) {
+    // cancel everything once, the session goes when the last completes
+    if (!s.closing) {
+      s.closing = true;
+      cancel(s, CLIENT_RECV);
+      cancel(s, REMOTE_RECV);
+    }
+    return;
+  }
+
+  // the receives run while the buffers are not full (same as the epoll
+  // interest of the other servers)
+  uint32_t clientEvents = c->clientEvents();
+  if ((clientEvents & EPOLLIN) != 0 && !s.clientRecv)
+    armRecv(s, false);
+  else if ((clientEvents & EPOLLIN) == 0 && s.clientRecv &&
+           !s.clientRecvStop) {
+    s.clientRecvStop = true;
+    cancel(s, CLIENT_RECV);
+  }
+  if ((clientEvents & EPOLLOUT) != 0 && !s.clientSend)
+    armSend(s, false);
+
+  if (c->isConnecting())
+    return;
+  uint32_t remoteEvents = c->remoteEvents();
+  if ((remoteEvents & EPOLLIN) != 0 && !s.remoteRecv)
+    armRecv(s, true);
+  else if ((remoteEvents & EPOLLIN) == 0 && s.remoteRecv &&
+           !s.remoteRecvStop) {
+    s.remoteRecvStop = true;
+    cancel(s, REMOTE_RECV);
+  }
+  if ((remoteEvents & EPOLLOUT) != 0 && !s.remoteSend)
+    armSend(s, true);
+}
+
+io_uring_sqe *ServerIoUring::getSqe(uint8_t op, int id) {
+  unsigned tail = *_sqTail;
+  if (tail - __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE) == _sqEntries) {
+    // the queue is full, submit it without waiting
+    int ret = uringEnter(_ringFd, _toSubmit, 0, 0, nullptr, 0);
+    if (ret < 0)
+      throw ProcessingException(strerror(errno));
+    _toSubmit -= ret;
+  }
+
+  unsigned index = tail & *_sqMask;
+  io_uring_sqe *sqe = &_sqes[index];
+  std::memset(sqe, 0, sizeof(*sqe));
+  sqe->user_data = userData(op, id);
+  _sqArray[index] = index;
+  __atomic_store_n(_sqTail, tail + 1, __ATOMIC_RELEASE);
+  ++_toSubmit;
+  return sqe;
+}
+
+void ServerIoUring::submitAndWait(int timeout) {
+  unsigned flags = IORING_ENTER_GETEVENTS;
+  int ret;
+
+  if (timeout >= 0) {
+    __kernel_timespec ts;
+    ts.tv_sec = timeout / 1000;
+    ts.tv_nsec = (timeout % 1000) * 1000000L;
+    io_uring_getevents_arg arg;
+    std::memset(&arg, 0, sizeof(arg));
+    arg.ts = reinterpret_cast<uint64_t>(&ts);
+    ret = uringEnter(_ringFd, _toSubmit, 1, flags | IORING_ENTER_EXT_ARG, &arg,
+                     sizeof(arg));
+  } else
+    ret = uringEnter(_ringFd, _toSubmit, 1, flags, nullptr, 0);
+
+  if (ret < 0) {
+    if (errno == EINTR || errno == ETIME || errno == EBUSY)
+      return;
+    throw ProcessingException(strerror(errno));
+  }
+  _toSubmit -= ret;
+}
+
+void ServerIoUring::armAccept() {
+  io_uring_sqe *sqe = getSqe(ACCEPT, 0);
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = _servSock;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+  _acceptArmed = true;
+}
+
+bool ServerIoUring::isFull() const {
+  return _options.maxClients > 0 && _sessions.size() >= _options.maxClients;
+}
+
+void ServerIoUring::rejectClient(int fd) {
+  static const std::string error =
+      makeErrorResponse("53300", "sorry, too many clients already");
+
+  // best effort, the socket is new so its send buffer is empty
+  if (send(fd, error.data(), error.size(), MSG_DONTWAIT | MSG_NOSIGNAL) < 0)
+    std::cerr << "reject : " << strerror(errno) << std::endl;
+
+  // closing with unread data (the StartupMessage) would reset the connection
+  // and drop the error, read it first
+  char discard[1024];
+  while (recv(fd, discard, sizeof(discard), MSG_DONTWAIT) > 0)
+    ;
+  close(fd);
+  _metrics.sessionsRejected.add();
+}
+
+void ServerIoUring::armWake() {
+  io_uring_sqe *sqe = getSqe(WAKE, 0);
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = _wakeFd;
+  sqe->addr = reinterpret_cast<uint64_t>(&_wakeValue);
+  sqe->len = sizeof(_wakeValue);
+}
+
+void ServerIoUring::armRecv(Session &s, bool remote) {
+  auto &c = s.client;
+  io_uring_sqe *sqe =
+      getSqe(remote ? REMOTE_RECV : CLIENT_RECV, c->getID());
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = remote ? c->getRemoteSocket() : c->getClientSocket();
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = 0;
+  (remote ? s.remoteRecv : s.clientRecv) = true;
+  ++s.inflight;
+}
+
+void ServerIoUring::armConnect(Session &s) {
+  auto &c = s.client;
+  io_uring_sqe *sqe = getSqe(CONNECT, c->getID());
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = c->getRemoteSocket();
+  sqe->poll32_events = POLLOUT;
+  s.connecting = true;
+  ++s.inflight;
+}
+
+void ServerIoUring::armSend(Session &s, bool remote) {
+  auto &c = s.client;
+  msghdr &msg = remote ? s.remoteMsg : s.clientMsg;
+  iovec *iov = remote ? s.remoteIov : s.clientIov;
+
+  // the chunks stay in the buffer until the completion consumes them
+  int count = remote ? c->peekRequests(iov, SEND_IOV_MAX)
+                     : c->peekResponses(iov, SEND_IOV_MAX);
+  if (count == 0)
+    return;
+  std::memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = count;
+
+  io_uring_sqe *sqe =
+      getSqe(remote ? REMOTE_SEND : CLIENT_SEND, c->getID());
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = remote ? c->getRemoteSocket() : c->getClientSocket();
+  sqe->addr = reinterpret_cast<uint64_t>(&msg);
+  sqe->len = 1;
+  sqe->msg_flags = MSG_NOSIGNAL;
+  (remote ? s.remoteSend : s.clientSend) = true;
+  ++s.inflight;
+}
+
+void ServerIoUring::cancel(Session &s, uint8_t op) {
+  auto &c = s.client;
+  io_uring_sqe *sqe = getSqe(CANCEL, c->getID());
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+
+  if (s.closing) {
+    // every operation on the socket
+    int fd = op == REMOTE_RECV ? c->getRemoteSocket() : c->getClientSocket();
+    sqe->fd = fd;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    if (fd < 0)
+      sqe->opcode = IORING_OP_NOP;
+  } else
+    sqe->addr = userData(op, c->getID());
+  ++s.inflight;
+}
+
+void ServerIoUring::recycleBuffer(uint16_t id) {
+  // not through bufs[], in C++ the flexible array of the uapi header does not
+  // start at the beginning of the ring
+  io_uring_buf &buf = reinterpret_cast<io_uring_buf *>(
+      _bufRing)[_bufTail & (URING_BUFFERS - 1)];
+  buf.addr = reinterpret_cast<uint64_t>(_bufBase + id * URING_BUFFER_SIZE);
+  buf.len = URING_BUFFER_SIZE;
+  buf.bid = id;
+  ++_bufTail;
+  __atomic_store_n(&_bufRing->tail, _bufTail, __ATOMIC_RELEASE);
+}
+
+int ServerIoUring::checkConnectTimeouts() {
+  auto now = std::chrono::steady_clock::now();
+  int timeout = -1;
+
+  while (!_connecting.empty()) {
+    auto &[deadline, id] = _connecting.front();
+    auto it = _sessions.find(id);
+    if (it != _sessions.end() && it->second.client->isConnected() &&
+        it->second.client->isConnecting()) {
+      if (deadline > now) {
+        // round up so the deadline is over when io_uring_enter returns
+        timeout = std::chrono::duration_cast<std::chrono::milliseconds>(
+                      deadline - now)
+                      .count() +
+                  1;
+        break;
+      }
+      Session &s = it->second;
+      std::cerr << "client " << id
+                << " : timeout while connecting to the remote server"
+                << std::endl;
+      s.client->disconnect();
+      _metrics.sessionsFailed.add();
+      update(s);
+    }
+    _connecting.pop_front();
+  }
+  return timeout;
+}
+
+ServerIoUring::InitException::InitException() {
+  e = std::string("An Error occurred while initializing the server!");
+}
+ServerIoUring::InitException::InitException(const char *e) : e(e) {}
+
+ServerIoUring::InitException::~InitException() throw(){};
+
+const char *ServerIoUring::InitException::what() const throw() {
+  return e.c_str();
+}
+
+ServerIoUring::ProcessingException::ProcessingException() {
+  e = std::string("An Error occurred while running the server!");
+}
+ServerIoUring::ProcessingException::ProcessingException(const char *e)
+    : e(e) {}
+
+ServerIoUring::ProcessingException::~ProcessingException() throw(){};
+
+const char *ServerIoUring::ProcessingException::what() const throw() {
+  return e.c_str();
+}
@@ -0,0 +1,251 @@
+#ifndef __SERVER_IO_URING_HPP_
+#define __SERVER_IO_URING_HPP_
+
+/*
+ * using io_uring (Linux 6.0+) through the raw system calls: one
+ * io_uring_enter per loop iteration submits and reaps every operation.
+ */
+
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <linux/io_uring.h>
+#include <memory>
+#include <netinet/in.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unordered_map>
+#include <vector>
+
+#include "BufferPool.h"
+#include "Client.h"
+#include "IServer.h"
+#include "Logger.h"
+#include "Metrics.h"
+
+// the number of submission queue entries
+#define URING_ENTRIES 1024
+
+// the provided buffers the multishot receives pick from
+#define URING_BUFFERS 256
+#define URING_BUFFER_SIZE (std::size_t(16 * 1024))
+
+class ServerIoUring : public IServer {
+
+public:
+  /*
+   * @brief server constructor.
+   *
+   * @param localIP : the ip (ipv4) address of the client.
+   * @param localPort : the port of the local (proxy) server.
+   * @param remoteIP : the ip (ipv4) address of the remote server.
+   * @param remotePort : the port of the remote server.
+   * @param logger : the object responsible for logging the client state.
+   * @param options : the optional settings, splice and pooling are not
+   * supported by this server.
+   */
+  ServerIoUring(const std::string &localIp, const int localPort,
+                const std::string &remoteIp, const int remotePort,
+                const ClientLogger::pointer &logger,
+                const ServerOptions &options = ServerOptions());
+
+  /*
+   * @brief closes the ring, the server socket and the clients.
+   */
+  ~ServerIoUring();
+
+  /*
+   * @brief opens a listening socket, sets up the ring (mapping its queues)
+   * and registers the ring of provided buffers, then arms the multishot
+   * accept and the read of the wake up eventfd.
+   *
+   * @throws InitException on error.
+   */
+  void init() override;
+
+  /*
+   * @brief works while _looping == true: submits the prepared operations and
+   * waits for completions in one io_uring_enter, then handles them:
+   *   - accept: creates a client, arms a multishot receive on its socket and
+   *     waits for its connection (poll) to be established.
+   *   - receive: the data (in a provided buffer) is appended to the client
+   *     buffers and logged, the buffer is given back right away.
+   *   - send: one sendmsg per direction is in flight at a time, it sends all
+   *     the pending chunks (scatter-gather) and is resubmitted while data is
+   *     pending.
+   * a disconnected client has its operations cancelled and is deleted once
+   * the kernel does not reference it anymore.
+   *
+   * throws ProcessingException on error.
+   */
+  void loop() override;
+
+  /*
+   * @brief sets looping parameter to false and wakes up the loop through the
+   * eventfd, so it can be called from a signal handler or from another thread.
+   */
+  void stop() override;
+
+  /*
+   * @return the metrics of this server, a completion counts as an event.
+   */
+  std::vector<const ServerMetrics *> getMetrics() const override;
+
+  class InitException : public std::exception {
+  private:
+    std::string e;
+
+  public:
+    InitException();
+    InitException(const char *e);
+    virtual ~InitException() throw();
+    virtual const char *what() const throw();
+  };
+
+  class ProcessingException : public std::exception {
+  private:
+    std::string e;
+
+  public:
+    ProcessingException();
+    ProcessingException(const char *e);
+    virtual ~ProcessingException() throw();
+    virtual const char *what() const throw();
+  };
+
+private:
+  // the operation of a completion, in the low byte of its user data
+  enum Operation : uint8_t {
+    ACCEPT,
+    WAKE,
+    CLIENT_RECV,
+    REMOTE_RECV,
+    CLIENT_SEND,
+    REMOTE_SEND,
+    CONNECT,
+    CANCEL
+  };
+
+  /*
+   * @brief a client and the operations the kernel still owns for it, a
+   * session is only deleted when none is left.
+   */
+  struct Session {
+    Client::pointer client;
+    unsigned inflight = 0;
+    bool clientRecv = false; // multishot receive armed
+    bool remoteRecv = false;
+    bool clientRecvStop = false; // the receive was cancelled (buffer full)
+    bool remoteRecvStop = false;
+    bool clientSend = false; // sendmsg in flight
+    bool remoteSend = false;
+    bool connecting = false;
+    bool closing = false;
+    msghdr clientMsg;
+    msghdr remoteMsg;
+    iovec clientIov[SEND_IOV_MAX];
+    iovec remoteIov[SEND_IOV_MAX];
+  };
+
+  /*
+   * @return a free submission queue entry (cleared), the queue is submitted
+   * first if it is full.
+   */
+  io_uring_sqe *getSqe(uint8_t op, int id);
+
+  /*
+   * @brief submits the prepared entries and waits for at least one
+   * completion or the timeout (-1 for none).
+   */
+  void submitAndWait(int timeout);
+
+  /*
+   * @brief handles a completion.
+   */
+  void handle(const io_uring_cqe &cqe);
+
+  /*
+   * @brief the operations on the sockets.
+   */
+  void armAccept();
+  void armWake();
+  void armRecv(Session &s, bool remote);
+  void armConnect(Session &s);
+  void armSend(Session &s, bool remote);
+  void cancel(Session &s, uint8_t op);
+
+  /*
+   * @brief accepts the new client of an accept completion.
+   */
+  void acceptNewClient(int fd);
+
+  /*
+   * @return true when maxClients clients are served, the accept is then
+   * cancelled (the connections wait in the accept queue) or the new
+   * connections are rejected.
+   */
+  bool isFull() const;
+
+  /*
+   * @brief answers a connection over the limit with an ErrorResponse
+   * (too_many_connections) and closes it.
+   */
+  void rejectClient(int fd);
+
+  /*
+   * @brief arms or stops the operations the session needs after a
+   * completion: sends while data is pending, receives while the buffers are
+   * not full, the cancellation of everything once the client is off.
+   */
+  void update(Session &s);
+
+  /*
+   * @brief gives a provided buffer back to the buffer ring.
+   */
+  void recycleBuffer(uint16_t id);
+
+  /*
+   * @brief disconnects the clients whose connect is over its deadline.
+   * @return the timeout until the next deadline (-1 if none).
+   */
+  int checkConnectTimeouts();
+
+  int _servSock = -1;
+  sockaddr_in _servAddr;
+  static std::atomic<int> _last_id;
+  std::atomic<bool> _looping;
+  int _wakeFd = -1;
+  uint64_t _wakeValue = 0;
+  bool _acceptArmed = false; // the multishot accept is running
+  bool _acceptStop = false;  // and being cancelled
+
+  // the ring
+  int _ringFd = -1;
+  void *_sqRing = nullptr;
+  void *_cqRing = nullptr; // the same mapping as the submission ring
+  io_uring_sqe *_sqes = nullptr;
+  std::size_t _sqRingSize = 0, _cqRingSize = 0, _sqesSize = 0;
+  unsigned *_sqHead, *_sqTail, *_sqMask, *_sqArray;
+  unsigned *_cqHead, *_cqTail, *_cqMask;
+  io_uring_cqe *_cqes;
+  unsigned _sqEntries = 0;
+  unsigned _toSubmit = 0;
+
+  // the provided buffers
+  io_uring_buf_ring *_bufRing = nullptr;
+  char *_bufBase = nullptr;
+  uint16_t _bufTail = 0;
+
+  BufferPool _buffers; // declared before the clients, which borrow from it
+  std::unordered_map<int, Session> _sessions; // by client id
+  std::deque<std::pair<std::chrono::steady_clock::time_point, int>>
+      _connecting;
+  std::vector<int> _closed; // the sessions to delete after the completions
+  ClientLogger::pointer _logger;
+  ServerMetrics _metrics; // only written by the loop thread
+};
+
+#endif // __SERVER_IO_URING_HPP_
@@ -0,0 +1,85 @@
+#include "ServerImpMultiEpoll.h"
+#include <csignal>
+#include <pthread.h>
+
+ServerMultiEpoll::ServerMultiEpoll(const std::string &localIp,
+                                   const int localPort,
+                                   const std::string &remoteIp,
+                                   const int remotePort,
+                                   const ClientLogger::pointer &logger,
+                                   const unsigned int threads,
+                                   const ServerOptions &options)
+    : IServer(localIp, localPort, remoteIp, remotePort, logger, options),
+      _threadsCount(threads) {
+  _options.reusePort = true;
+  if (_threadsCount == 0)
+    _threadsCount = std::max(1u, std::thread::hardware_concurrency());
+  std::cout << "Multi epoll server with " << _threadsCount << " threads !"
+            << std::endl;
+}
+
+ServerMultiEpoll::~ServerMultiEpoll() {
+  stop();
+  for (auto &t : _threads)
+    if (t.joinable())
+      t.join();
+}
+
+void ServerMultiEpoll::init() {
+  for (unsigned int i = 0; i < _threadsCount; ++i) {
+    _reactors.push_back(std::make_unique<ServerEpoll>(
+        _localIP, _localPort, _remoteIP, _remotePort, _logger, _options));
+    _reactors.back()->init();
+  }
+}
+
+void ServerMultiEpoll::loop() {
+  // block the termination signals while spawning so that the workers inherit
+  // the mask and the handler always runs in this thread.
+  sigset_t set, old;
+  sigemptyset(&set);
+  sigaddset(&set, SIGINT);
+  sigaddset(&set, SIGTERM);
+  sigaddset(&set, SIGQUIT);
+  pthread_sigmask(SIG_BLOCK, &set, &old);
+
+  for (auto &r : _reactors) {
+    ServerEpoll *reactor = r.get();
+    _threads.emplace_back([this, reactor]() {
+      try {
+        reactor->loop();
+      } catch (...) {
+        {
+          std::lock_guard<std::mutex> lock(_errorMutex);
+          if (!_error)
+            _error = std::current_exception();
+        }
+        // one failing reactor brings the whole server down
+        stop();
+      }
+    });
+  }
+
+  pthread_sigmask(SIG_SETMASK, &old, nullptr);
+
+  for (auto &t : _threads)
+    t.join();
+  _threads.clear();
+
+  if (_error)
+    std::rethrow_exception(_error);
+}
+
+void ServerMultiEpoll::stop() {
+  for (auto &r : _reactors)
+    r->stop();
+}
+
+std::vector<const ServerMetrics *> ServerMultiEpoll::getMetrics() const {
+  std::vector<const ServerMetrics *> metrics;
+  for (auto &r : _reactors) {
+    auto m = r->getMetrics();
+    metrics.insert(metrics.end(), m.begin(), m.end());
+  }
+  return metrics;
+}
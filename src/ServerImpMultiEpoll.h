@@ -0,0 +1,81 @@
+#ifndef __SERVER_MULTI_EPOLL_HPP_
+#define __SERVER_MULTI_EPOLL_HPP_
+
+/*
+ * multi reactor server: runs several ServerEpoll instances, one per thread,
+ * each with its own epoll instance, listening socket and fd table. the
+ * listening sockets share the same port through SO_REUSEPORT so the kernel
+ * balances the incoming connections between the threads.
+ */
+
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "IServer.h"
+#include "Logger.h"
+#include "ServerImpEpoll.h"
+
+class ServerMultiEpoll : public IServer {
+
+public:
+  /*
+   * @brief server constructor.
+   *
+   * @param localIP : the ip (ipv4) address of the client.
+   * @param localPort : the port of the local (proxy) server.
+   * @param remoteIP : the ip (ipv4) address of the remote server.
+   * @param remotePort : the port of the remote server.
+   * @param logger : the object responsible for logging the client state, it
+   * is shared by all the threads.
+   * @param threads : the number of event loop threads, 0 means one per core.
+   * @param options : the optional settings given to each reactor.
+   */
+  ServerMultiEpoll(const std::string &localIp, const int localPort,
+                   const std::string &remoteIp, const int remotePort,
+                   const ClientLogger::pointer &logger,
+                   const unsigned int threads = 0,
+                   const ServerOptions &options = ServerOptions());
+
+  /*
+   * @brief stops and joins the threads if they are still running.
+   */
+  ~ServerMultiEpoll();
+
+  /*
+   * @brief creates the reactors and calls init() on each one of them.
+   *
+   * @throws ServerEpoll::InitException on error.
+   */
+  void init() override;
+
+  /*
+   * @brief runs the loop of each reactor in its own thread and waits for them
+   * to finish. the termination signals are blocked in the worker threads so
+   * they are delivered to the calling thread.
+   *
+   * @throws the first exception thrown by one of the reactors.
+   */
+  void loop() override;
+
+  /*
+   * @brief stops all the reactors, safe to call from a signal handler.
+   */
+  void stop() override;
+
+  /*
+   * @return the metrics of each reactor, in thread order.
+   */
+  std::vector<const ServerMetrics *> getMetrics() const override;
+
+private:
+  unsigned int _threadsCount;
+  std::vector<std::unique_ptr<ServerEpoll>> _reactors;
+  std::vector<std::thread> _threads;
+  std::mutex _errorMutex;
+  std::exception_ptr _error;
+};
+
+#endif // __SERVER_MULTI_EPOLL_HPP_
@@ -0,0 +1,94 @@
+#include "SlowQueryLog.h"
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+#include <ios>
+#include <sstream>
+
+SlowQueryLog::SlowQueryLog(const std::string &filePath,
+                           const uint64_t thresholdMicros)
+    : _outStream(filePath, std::ios_base::app), _threshold(thresholdMicros) {
+  if (!_outStream.is_open() || _outStream.fail())
+    throw std::ios_base::failure(strerror(errno));
+  _writer = std::thread(&SlowQueryLog::run, this);
+}
+
+SlowQueryLog::~SlowQueryLog() {
+  {
+    std::lock_guard<std::mutex> lock(_pendingMutex);
+    _running = false;
+  }
+  _pendingCond.notify_one();
+  _writer.join();
+}
+
+void SlowQueryLog::log(const Client::pointer &c) {
+  auto &queries = c->getCompletedQueries();
+  bool found = false;
+  for (auto &q : queries)
+    found = found || q.micros >= _threshold;
+
+  if (!found)
+    return;
+
+  auto in_time_t =
+      std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+  std::tm tm_now;
+  localtime_r(&in_time_t, &tm_now);
+
+  std::ostringstream lines;
+  std::size_t count = 0;
+  for (auto &q : queries) {
+    if (q.micros < _threshold)
+      continue;
+    lines << std::put_time(&tm_now, "%Y-%m-%d\t%X") << "\t\t-\tIP: "
+          << c->getIP() << "\t-\tclient " << c->getID() << ": ("
+          << std::fixed << std::setprecision(3) << q.micros / 1000.0
+          << " ms)\t\t" << (q.query.empty() ? "-" : q.query) << "\n";
+    ++count;
+  }
+
+  std::string text = lines.str();
+  {
+    std::lock_guard<std::mutex> lock(_pendingMutex);
+    if (_pending.size() + text.size() > SLOW_QUERY_LOG_PENDING_MAX) {
+      _dropped += count;
+      return;
+    }
+    _pending += text;
+    _pendingLines += count;
+  }
+  _pendingCond.notify_one();
+}
+
+uint64_t SlowQueryLog::getThreshold() const { return _threshold; }
+
+std::size_t SlowQueryLog::getDropped() const { return _dropped; }
+
+void SlowQueryLog::run() {
+  std::string batch;
+  std::size_t lines = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(_pendingMutex);
+      _pendingCond.wait(lock,
+                        [this] { return !_running || !_pending.empty(); });
+      if (_pending.empty())
+        return;
+      batch.swap(_pending);
+      _pending.clear();
+      lines = _pendingLines;
+      _pendingLines = 0;
+    }
+
+    _outStream.write(batch.data(), batch.size());
+    _outStream.flush();
+    if (_outStream.fail()) {
+      // counted, the next batch is tried again
+      _dropped += lines;
+      _outStream.clear();
+    }
+  }
+}
@@ -0,0 +1,82 @@
+#ifndef __SLOW_QUERY_LOG_HPP_
+#define __SLOW_QUERY_LOG_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "Client.h"
+
+// the bytes of lines waiting for the writer, the next ones are dropped
+#define SLOW_QUERY_LOG_PENDING_MAX (1 << 20)
+
+/*
+ * @brief writes the queries answered slower than a threshold with their
+ * duration, one line per query in the layout of the query log:
+ *
+ *   date  time  -  IP: ip  -  client id: (duration ms)  query
+ *
+ * it is called from all the event loop threads, they only format the lines
+ * and append them to a buffer under a mutex, a writer thread writes them to
+ * the file (and flushes, the file is meant to be followed).
+ */
+class SlowQueryLog {
+
+public:
+  using uniq_ptr = std::unique_ptr<SlowQueryLog>;
+
+  /*
+   * @brief opens the file and starts the writer thread.
+   *
+   * @param filePath : the file the slow queries are appended to.
+   * @param thresholdMicros : the queries that took at least this long are
+   * written.
+   *
+   * @throws std::ios_base::failure if the file can not be opened.
+   */
+  SlowQueryLog(const std::string &filePath, const uint64_t thresholdMicros);
+
+  /*
+   * @brief writes the lines left and stops the writer thread.
+   */
+  ~SlowQueryLog();
+
+  /*
+   * @brief queues the queries of Client::getCompletedQueries() over the
+   * threshold, never does any I/O.
+   */
+  void log(const Client::pointer &c);
+
+  uint64_t getThreshold() const;
+
+  /*
+   * @return the number of lines dropped because too many were waiting or
+   * the write failed.
+   */
+  std::size_t getDropped() const;
+
+private:
+  /*
+   * @brief the writer thread: writes the pending lines and sleeps while
+   * there are none.
+   */
+  void run();
+
+  std::ofstream _outStream; // writer thread only
+  uint64_t _threshold;
+  std::atomic<std::size_t> _dropped{0};
+
+  std::mutex _pendingMutex;
+  std::condition_variable _pendingCond;
+  std::string _pending;
+  std::size_t _pendingLines = 0;
+  bool _running = true;
+  std::thread _writer;
+};
+
+#endif // __SLOW_QUERY_LOG_HPP_
@@ -0,0 +1,199 @@
+#include "StatementCache.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <charconv>
+#include <cstring>
+
+namespace {
+
+// the first string of a body (a name) and what follows its terminator
+bool split(std::string_view body, std::string_view &name,
+           std::string_view &rest) {
+  std::size_t end = body.find('\0');
+  if (end == std::string_view::npos)
+    return false;
+  name = body.substr(0, end);
+  rest = body.substr(end + 1);
+  return true;
+}
+
+bool readInt16(std::string_view &data, int16_t &v) {
+  if (data.size() < 2)
+    return false;
+  uint16_t n;
+  std::memcpy(&n, data.data(), 2);
+  v = static_cast<int16_t>(ntohs(n));
+  data.remove_prefix(2);
+  return true;
+}
+
+bool readInt32(std::string_view &data, int32_t &v) {
+  if (data.size() < 4)
+    return false;
+  uint32_t n;
+  std::memcpy(&n, data.data(), 4);
+  v = static_cast<int32_t>(ntohl(n));
+  data.remove_prefix(4);
+  return true;
+}
+
+// appends a char of a parameter, the comment holding it must not end or
+// nest
+void appendSafe(std::string &out, char c) {
+  if ((c == '/' && out.back() == '*') || (c == '*' && out.back() == '/'))
+    out.push_back(' ');
+  out.push_back(c);
+}
+
+void appendParam(std::string &out, std::string_view value, bool binary) {
+  static const char hex[] = "0123456789abcdef";
+  std::size_t max = binary ? PARAM_TEXT_MAX / 2 : PARAM_TEXT_MAX;
+
+  out.append(binary ? "'\\x" : "'");
+  for (std::size_t i = 0; i < value.size() && i < max; ++i) {
+    unsigned char c = value[i];
+    if (binary) {
+      out.push_back(hex[c >> 4]);
+      out.push_back(hex[c & 15]);
+    } else {
+      if (c == '\'')
+        out.push_back('\'');
+      appendSafe(out, c);
+    }
+  }
+  out.push_back('\'');
+}
+
+} // namespace
+
+const StatementCache::Portal *StatementCache::track(const PgMessage &m) {
+  switch (m.type) {
+  case 'P':
+    parse(m.body);
+    break;
+  case 'B':
+    bind(m.body);
+    break;
+  case 'C':
+    close(m.body);
+    break;
+  case 'E': {
+    std::string_view name, rest;
+    if (!split(m.body, name, rest))
+      return nullptr;
+    Portal *p = _portals.find(name);
+    return p != nullptr && p->query ? p : nullptr;
+  }
+  default:
+    break;
+  }
+  return nullptr;
+}
+
+void StatementCache::parse(std::string_view body) {
+  std::string_view name, query;
+  if (!split(body, name, query))
+    return;
+  query = query.substr(0, std::min(query.find('\0'), STATEMENT_TEXT_MAX));
+
+  Statement *s = _statements.find(name);
+  // the unnamed statement of a query run again, nothing to copy
+  if (s != nullptr && *s && **s == query)
+    return;
+  if (s == nullptr) {
+    if (_statements.full())
+      _bytes -= bytes(_statements.evict());
+    s = &_statements.insert(name);
+  }
+  _bytes -= bytes(*s);
+  // a new string, the portals bound to the previous text keep it
+  *s = std::make_shared<const std::string>(query);
+  _bytes += query.size();
+
+  while (_bytes > STATEMENT_CACHE_BYTES && _statements.size() > 1)
+    _bytes -= bytes(_statements.evict());
+}
+
+void StatementCache::bind(std::string_view body) {
+  std::string_view portal, statement, params;
+  if (!split(body, portal, params) || !split(params, statement, params))
+    return;
+
+  Statement *s = _statements.find(statement);
+  Portal *p = _portals.find(portal);
+  if (p == nullptr) {
+    if (_portals.full())
+      _bytes -= bytes(_portals.evict());
+    p = &_portals.insert(portal);
+  }
+  _bytes -= bytes(*p);
+  p->query = s != nullptr ? *s : nullptr;
+  p->bind.assign(params.substr(0, BIND_COPY_MAX));
+  _bytes += bytes(*p);
+}
+
+void StatementCache::close(std::string_view body) {
+  if (body.empty())
+    return;
+  std::string_view name = body.substr(1, body.find('\0', 1) - 1);
+  if (body[0] == 'S')
+    _bytes -= bytes(_statements.erase(name));
+  else if (body[0] == 'P')
+    _bytes -= bytes(_portals.erase(name));
+}
+
+void StatementCache::describe(const Portal &p, std::string &out) {
+  out.append(*p.query);
+
+  // format codes, parameters (length, value), see the Bind message
+  std::string_view data = p.bind;
+  int16_t formatCount, paramCount;
+  if (!readInt16(data, formatCount) || formatCount < 0 ||
+      data.size() < std::size_t(formatCount) * 2)
+    return;
+  std::string_view formats = data.substr(0, formatCount * 2);
+  data.remove_prefix(formatCount * 2);
+  if (!readInt16(data, paramCount) || paramCount <= 0)
+    return;
+
+  out.append(" /* ");
+  for (int16_t i = 0; i < paramCount; ++i) {
+    char name[16];
+    auto end = std::to_chars(name, name + sizeof(name), i + 1).ptr;
+    if (i > 0)
+      out.append(", ");
+    out.append("$").append(name, end).append(" = ");
+
+    int32_t len;
+    if (!readInt32(data, len)) {
+      out.append("..."); // cut to BIND_COPY_MAX
+      break;
+    }
+    if (len < 0) {
+      out.append("NULL");
+      continue;
+    }
+    std::string_view format = formats;
+    if (formatCount > 1)
+      format = formats.substr(std::min<std::size_t>(i * 2, formats.size()));
+    int16_t code = 0;
+    if (formatCount > 0)
+      readInt16(format, code);
+
+    std::string_view value = data.substr(0, len);
+    data.remove_prefix(value.size());
+    appendParam(out, value, code == 1);
+    if (value.size() < std::size_t(len) ||
+        value.size() > (code == 1 ? PARAM_TEXT_MAX / 2 : PARAM_TEXT_MAX))
+      out.append("...");
+  }
+  out.append(" */");
+}
+
+std::size_t StatementCache::getStatementCount() const {
+  return _statements.size();
+}
+
+std::size_t StatementCache::getPortalCount() const { return _portals.size(); }
+
+std::size_t StatementCache::getBytes() const { return _bytes; }
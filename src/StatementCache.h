@@ -0,0 +1,158 @@
+#ifndef __STATEMENT_CACHE_HPP_
+#define __STATEMENT_CACHE_HPP_
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "MessageFramer.h"
+
+// the bounds of the cache of one session: the number of statements and
+// portals and the bytes of their text
+#define STATEMENT_CACHE_SIZE 256
+#define PORTAL_CACHE_SIZE 32
+#define STATEMENT_CACHE_BYTES (128 * 1024)
+
+// the text of a statement and the parameters of a Bind are cut to these
+#define STATEMENT_TEXT_MAX (std::size_t(16 * 1024))
+#define BIND_COPY_MAX 1024
+
+// a parameter is cut to this in the description of an execution
+#define PARAM_TEXT_MAX 64
+
+/*
+ * @brief the prepared statements and the portals of a session, so that an
+ * Execute, which only names its portal, can be logged with the SQL of its
+ * statement and the parameters of its Bind.
+ *
+ * the cache follows the extended query messages read from the client: Parse
+ * stores the statement (the unnamed one is replaced by the next Parse), Bind
+ * stores the portal with the statement text and a copy of the parameters,
+ * Close removes a statement or a portal. both maps are LRU bounded (count and
+ * bytes), the least recently used entries are evicted and an Execute of an
+ * evicted portal is simply not described. the portal keeps the text of its
+ * statement, closing the statement does not change what it executes.
+ *
+ * a cache is only used by the event loop thread of its client.
+ */
+class StatementCache {
+
+public:
+  struct Portal {
+    std::shared_ptr<const std::string> query;
+    std::string bind; // the Bind body after the names, cut to BIND_COPY_MAX
+  };
+
+  StatementCache() = default;
+
+  /*
+   * @brief updates the cache with a message read from the client.
+   *
+   * @return the portal an Execute runs (nullptr for the other messages or an
+   * unknown portal), valid until the next call.
+   */
+  const Portal *track(const PgMessage &m);
+
+  /*
+   * @brief appends the query of a portal to out followed by its parameters
+   * in an SQL comment (so the stats normalize it like the query), e.g. the
+   * query "SELECT $1" then the comment "$1 = '42'".
+   */
+  static void describe(const Portal &p, std::string &out);
+
+  /*
+   * @return the number of statements (portals) cached.
+   */
+  std::size_t getStatementCount() const;
+  std::size_t getPortalCount() const;
+
+  /*
+   * @return the bytes of the text of the statements and the parameters of
+   * the portals.
+   */
+  std::size_t getBytes() const;
+
+private:
+  /*
+   * @brief a map with a bounded number of entries, the entries are moved to
+   * the front when used and evicted from the back. O(1) operations.
+   */
+  template <class Value> class LruMap {
+
+  public:
+    explicit LruMap(std::size_t maxSize) : _maxSize(maxSize) {}
+
+    Value *find(std::string_view key) {
+      auto it = _index.find(key);
+      if (it == _index.end())
+        return nullptr;
+      _entries.splice(_entries.begin(), _entries, it->second);
+      return &it->second->second;
+    }
+
+    /*
+     * @brief inserts the entry of a key that is not in the map (see find())
+     * at the front, the map must not be full (see evict()).
+     * @return the value, to be filled by the caller.
+     */
+    Value &insert(std::string_view key) {
+      _entries.emplace_front(std::string(key), Value());
+      // the key of the index points to the string of the list node
+      _index.emplace(_entries.front().first, _entries.begin());
+      return _entries.front().second;
+    }
+
+    /*
+     * @return the value removed (a default one if the key is unknown).
+     */
+    Value erase(std::string_view key) {
+      auto it = _index.find(key);
+      if (it == _index.end())
+        return Value();
+      Value value = std::move(it->second->second);
+      _entries.erase(it->second);
+      _index.erase(it);
+      return value;
+    }
+
+    /*
+     * @brief removes the least recently used entry.
+     * @return its value.
+     */
+    Value evict() {
+      Value value = std::move(_entries.back().second);
+      _index.erase(_entries.back().first);
+      _entries.pop_back();
+      return value;
+    }
+
+    std::size_t size() const { return _index.size(); }
+    bool full() const { return _index.size() >= _maxSize; }
+
+  private:
+    using Entry = std::pair<std::string, Value>;
+    std::list<Entry> _entries; // the most recently used first
+    std::unordered_map<std::string_view, typename std::list<Entry>::iterator>
+        _index;
+    std::size_t _maxSize;
+  };
+
+  using Statement = std::shared_ptr<const std::string>;
+
+  void parse(std::string_view body);
+  void bind(std::string_view body);
+  void close(std::string_view body);
+
+  // the text of a statement or the parameters of a portal
+  static std::size_t bytes(const Statement &s) { return s ? s->size() : 0; }
+  static std::size_t bytes(const Portal &p) { return p.bind.size(); }
+
+  LruMap<Statement> _statements{STATEMENT_CACHE_SIZE};
+  LruMap<Portal> _portals{PORTAL_CACHE_SIZE};
+  std::size_t _bytes = 0;
+};
+
+#endif // __STATEMENT_CACHE_HPP_
@@ -0,0 +1,208 @@
+/*
+ * the segments of a binary query log can be decoded on their own: logs
+ * enough queries of a few clients to fill several segments (plain and
+ * compressed), then decodes each segment alone with LogDecoder (after
+ * LogDecompress) and checks that each line has the ip of its client and a
+ * timestamp of today, not one relative to 1970, and that no query is lost.
+ *
+ * ./LogSegmentsTest path/to/LogDecoder path/to/LogDecompress
+ */
+
+#include "../src/AsyncLogger.h"
+#include "../src/BufferPool.h"
+#include "../src/Client.h"
+#include "../src/Compression.h"
+#include "../src/LogSink.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <iostream>
+#include <random>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+std::string message(char type, std::string_view body) {
+  std::string m(1, type);
+  uint32_t len = htonl(uint32_t(body.size() + 4));
+  m.append(reinterpret_cast<const char *>(&len), sizeof(len));
+  m.append(body);
+  return m;
+}
+
+std::string startupMessage() {
+  std::string body("\0\3\0\0user\0test\0\0", 16);
+  uint32_t len = htonl(uint32_t(body.size() + 4));
+  return std::string(reinterpret_cast<const char *>(&len), sizeof(len)) +
+         body;
+}
+
+/*
+ * @brief a pooled client (it has no connection to open) on one end of a
+ * socket pair, as in MicroBench.
+ */
+Client::pointer makeClient(BufferPool &pool, int id, const std::string &ip) {
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+    throw std::runtime_error(strerror(errno));
+  close(fds[1]);
+  auto c = std::make_shared<Client>(fds[0], ip, "127.0.0.1", 5432, pool,
+                                    false, true);
+  c->setID(id);
+  c->receivedFromClient(startupMessage());
+  c->sentToRemote(startupMessage().size());
+  return c;
+}
+
+/*
+ * @return the segments of the log, in the order they were written.
+ */
+std::vector<std::string> segments(const std::string &dir) {
+  std::vector<std::pair<unsigned long, std::string>> found;
+  DIR *d = opendir(dir.c_str());
+  if (d == nullptr)
+    throw std::runtime_error(strerror(errno));
+  while (dirent *e = readdir(d)) {
+    std::string name(e->d_name);
+    if (name.rfind("log.", 0) != 0)
+      continue;
+    // log.date.N
+    found.emplace_back(std::stoul(name.substr(name.rfind('.') + 1)),
+                       dir + "/" + name);
+  }
+  closedir(d);
+  std::sort(found.begin(), found.end());
+
+  std::vector<std::string> paths;
+  for (auto &f : found)
+    paths.push_back(f.second);
+  return paths;
+}
+
+/*
+ * @return the lines the command writes to stdout.
+ */
+std::vector<std::string> run(const std::string &command) {
+  std::vector<std::string> lines;
+  std::FILE *out = popen(command.c_str(), "r");
+  if (out == nullptr)
+    throw std::runtime_error(strerror(errno));
+
+  std::string line;
+  int ch;
+  while ((ch = std::fgetc(out)) != EOF) {
+    if (ch != '\n') {
+      line.push_back(char(ch));
+      continue;
+    }
+    lines.push_back(line);
+    line.clear();
+  }
+  if (pclose(out) != 0)
+    throw std::runtime_error("failed: " + command);
+  return lines;
+}
+
+/*
+ * @brief logs the queries of 3 clients to segments of segmentSize bytes,
+ * one of them leaves half way, then checks the segments one by one.
+ * @return false if the check failed.
+ */
+bool check(const std::string &decoder, const std::string &decompress,
+           const bool compress, const std::size_t segmentSize) {
+  char dir[] = "/tmp/LogSegmentsTest.XXXXXX";
+  if (mkdtemp(dir) == nullptr)
+    throw std::runtime_error(strerror(errno));
+
+  BufferPool pool;
+  const char *ips[] = {"10.0.0.1", "10.0.0.2", "10.0.0.3"};
+  std::vector<Client::pointer> clients;
+  const int count = compress ? 6000 : 600;
+  {
+    LogSink::uniq_ptr sink = std::make_unique<SegmentSink>(
+        std::string(dir) + "/log", segmentSize);
+    if (compress)
+      sink = std::make_unique<CompressedSink>(std::move(sink));
+    AsyncQueryLogger logger(std::move(sink), 1024,
+                            AsyncQueryLogger::Overflow::BLOCK,
+                            LogFormat::BINARY);
+
+    for (int id = 0; id < 3; ++id) {
+      clients.push_back(makeClient(pool, id + 1, ips[id]));
+      logger.connect(clients.back());
+    }
+
+    // queries that do not compress much, so the segments fill up
+    std::mt19937 rng(42);
+    for (int i = 0; i < count; ++i) {
+      if (i == count / 2)
+        logger.disconnect(clients[2]);
+      auto &c = clients[i % (i < count / 2 ? 3 : 2)];
+      std::string query = "SELECT " + std::to_string(i) + " /* ";
+      while (query.size() < 200)
+        query.push_back(char('a' + rng() % 26));
+      c->receivedFromClient(message('Q', query + " */" + '\0'));
+      logger.log(c);
+      c->sentToRemote(c->getPendingRequestSize());
+    }
+  }
+
+  char year[8];
+  time_t now = time(nullptr);
+  std::tm tm_now;
+  localtime_r(&now, &tm_now);
+  std::strftime(year, sizeof(year), "%Y-", &tm_now);
+
+  // each segment alone, the lines of all of them are the queries logged
+  std::vector<std::string> paths = segments(dir);
+  bool ok = paths.size() >= 3;
+  std::size_t total = 0;
+  for (const auto &path : paths) {
+    std::string command = decoder + " " + path;
+    if (compress)
+      command = decompress + " " + path + " > " + path + ".raw && " +
+                decoder + " " + path + ".raw";
+    for (const auto &line : run(command)) {
+      bool knownIP = line.find("IP: 10.0.0.") != std::string::npos;
+      if (ok && (line.rfind(year, 0) != 0 || !knownIP)) {
+        std::cerr << path << ": bad line: " << line << std::endl;
+        ok = false;
+      }
+      ++total;
+    }
+  }
+  ok = ok && total == std::size_t(count);
+  std::cout << (compress ? "compressed" : "plain") << ": " << paths.size()
+            << " segments, " << total << " lines: " << (ok ? "ok" : "FAILED")
+            << std::endl;
+
+  if (ok)
+    std::system((std::string("rm -rf ") + dir).c_str());
+  return ok;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc != 3) {
+    std::cerr << "./LogSegmentsTest path/to/LogDecoder path/to/LogDecompress"
+              << std::endl;
+    return 1;
+  }
+
+  try {
+    bool ok = check(argv[1], argv[2], false, 16 * 1024);
+    ok = check(argv[1], argv[2], true, COMPRESSED_FRAME_MAX) && ok;
+    return ok ? 0 : 1;
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+}
@@ -0,0 +1,423 @@
+/*
+ * a load generator for the benchmarks of the proxy: N connections (spread
+ * over the threads, one epoll loop each) send requests in a closed loop and
+ * the time from a request to its ReadyForQuery is recorded, then the
+ * throughput and the latency percentiles are printed.
+ *
+ * a request is a simple query ('Q'), or with --extended the Bind, Execute
+ * and Sync of a statement prepared once per connection. with --pipeline K
+ * each connection keeps K requests in flight.
+ *
+ * ./LoadGen host port [--connections N] [--threads N] [--duration S]
+ *     [--warmup S] [--extended] [--pipeline K] [--query SQL]
+ *
+ * e.g. against MockBackend directly then through the proxy, the difference
+ * is the overhead of the proxy.
+ */
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <iostream>
+#include <memory>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "../src/MessageFramer.h"
+#include "../src/Metrics.h"
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+struct Options {
+  std::string host;
+  int port = 0;
+  int connections = 16;
+  int threads = 1;
+  double duration = 10;
+  double warmup = 1;
+  bool extended = false;
+  int pipeline = 1;
+  std::string query = "SELECT 1";
+};
+
+Options g_options;
+std::atomic<bool> g_recording{false};
+std::atomic<bool> g_running{true};
+
+std::string message(char type, std::string_view body) {
+  std::string m(1, type);
+  uint32_t len = htonl(uint32_t(body.size() + 4));
+  m.append(reinterpret_cast<const char *>(&len), sizeof(len));
+  m.append(body);
+  return m;
+}
+
+/*
+ * @brief one connection: the requests in flight and what is left to send.
+ */
+struct Connection {
+  int fd = -1;
+  MessageFramer framer{false, 1}; // only the message types are needed
+  std::vector<PgMessage> messages;
+  std::deque<clock_type::time_point> inFlight;
+  std::string out;
+  std::size_t outSent = 0;
+  bool watchingOut = false;
+
+  Connection() = default;
+  Connection(const Connection &other) = delete;
+  Connection &operator=(const Connection &other) = delete;
+  ~Connection() {
+    if (fd != -1)
+      close(fd);
+  }
+};
+
+// the results of a thread
+struct Stats {
+  LatencyHistogram latency;
+  uint64_t requests = 0;
+  uint64_t errors = 0;
+};
+
+/*
+ * @brief connects and goes through the startup (no authentication is
+ * supported, the backend must trust the user), blocking.
+ * @throws std::runtime_error on error.
+ */
+void connectAndStart(Connection &c) {
+  addrinfo hints{}, *res;
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(g_options.host.c_str(),
+                  std::to_string(g_options.port).c_str(), &hints, &res) != 0)
+    throw std::runtime_error("invalid host " + g_options.host);
+  c.fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  int rc = c.fd < 0 ? -1 : connect(c.fd, res->ai_addr, res->ai_addrlen);
+  freeaddrinfo(res);
+  if (rc < 0)
+    throw std::runtime_error(std::string("connect : ") + strerror(errno));
+  int on = 1;
+  setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+  std::string body("\0\3\0\0user\0loadgen\0database\0loadgen\0\0", 35);
+  uint32_t len = htonl(uint32_t(body.size() + 4));
+  std::string startup(reinterpret_cast<const char *>(&len), sizeof(len));
+  startup += body;
+  if (g_options.extended) {
+    // the statement the requests execute
+    startup += message('P', std::string("s\0", 2) + g_options.query +
+                                std::string(3, '\0'));
+    startup += message('S', std::string_view());
+  }
+  if (send(c.fd, startup.data(), startup.size(), MSG_NOSIGNAL) !=
+      ssize_t(startup.size()))
+    throw std::runtime_error(std::string("send : ") + strerror(errno));
+
+  // the ReadyForQuery of the startup (and of the Parse)
+  int ready = g_options.extended ? 2 : 1;
+  char buff[16384];
+  while (ready > 0) {
+    ssize_t n = recv(c.fd, buff, sizeof(buff), 0);
+    if (n <= 0)
+      throw std::runtime_error("the server closed the connection");
+    c.framer.feed(std::string_view(buff, n), c.messages);
+    for (auto &m : c.messages) {
+      // only AuthenticationOk (0) is supported
+      bool authOk = m.body.find_first_not_of('\0') == std::string_view::npos;
+      if (m.type == 'R' && !authOk)
+        throw std::runtime_error("authentication is not supported");
+      if (m.type == 'E')
+        throw std::runtime_error("the server returned an error");
+      ready -= m.type == 'Z';
+    }
+  }
+
+  if (fcntl(c.fd, F_SETFL, O_NONBLOCK) < 0)
+    throw std::runtime_error(strerror(errno));
+}
+
+class Worker {
+
+public:
+  explicit Worker(int connections) : _connections(connections) {}
+
+  Stats &getStats() { return _stats; }
+
+  void run() {
+    _epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (_epfd < 0)
+      throw std::runtime_error(strerror(errno));
+
+    for (auto &c : _connections) {
+      connectAndStart(c);
+      epoll_event ev{};
+      ev.events = EPOLLIN;
+      ev.data.ptr = &c;
+      if (epoll_ctl(_epfd, EPOLL_CTL_ADD, c.fd, &ev) < 0)
+        throw std::runtime_error(strerror(errno));
+    }
+
+    std::string request;
+    if (g_options.extended) {
+      request = message('B', std::string("\0s\0\0\0\0\0\0\0", 9));
+      request += message('E', std::string(5, '\0'));
+      request += message('S', std::string_view());
+    } else
+      request = message('Q', g_options.query + '\0');
+    _request = request;
+
+    for (auto &c : _connections)
+      for (int i = 0; i < g_options.pipeline; ++i)
+        sendRequest(c);
+
+    std::vector<epoll_event> events(64);
+    while (g_running) {
+      int n = epoll_wait(_epfd, events.data(), events.size(), 100);
+      if (n < 0 && errno != EINTR)
+        throw std::runtime_error(strerror(errno));
+      for (int i = 0; i < n; ++i) {
+        auto &c = *static_cast<Connection *>(events[i].data.ptr);
+        if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+          receive(c);
+        if (events[i].events & EPOLLOUT)
+          flush(c);
+      }
+    }
+    close(_epfd);
+  }
+
+private:
+  void sendRequest(Connection &c) {
+    c.inFlight.push_back(clock_type::now());
+    c.out += _request;
+    flush(c);
+  }
+
+  void flush(Connection &c) {
+    while (c.outSent < c.out.size()) {
+      ssize_t n = send(c.fd, c.out.data() + c.outSent,
+                       c.out.size() - c.outSent, MSG_NOSIGNAL);
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        break;
+      if (n <= 0)
+        throw std::runtime_error("send : the connection was closed");
+      c.outSent += n;
+    }
+    if (c.outSent == c.out.size()) {
+      c.out.clear();
+      c.outSent = 0;
+    }
+
+    bool watch = !c.out.empty();
+    if (watch != c.watchingOut) {
+      epoll_event ev{};
+      ev.events = EPOLLIN;
+      if (watch)
+        ev.events |= EPOLLOUT;
+      ev.data.ptr = &c;
+      if (epoll_ctl(_epfd, EPOLL_CTL_MOD, c.fd, &ev) < 0)
+        throw std::runtime_error(strerror(errno));
+      c.watchingOut = watch;
+    }
+  }
+
+  void receive(Connection &c) {
+    char buff[65536];
+    while (true) {
+      ssize_t n = recv(c.fd, buff, sizeof(buff), 0);
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return;
+      if (n <= 0)
+        throw std::runtime_error("recv : the connection was closed");
+
+      c.framer.feed(std::string_view(buff, n), c.messages);
+      for (auto &m : c.messages) {
+        if (m.type == 'E' && g_recording)
+          ++_stats.errors;
+        if (m.type != 'Z' || c.inFlight.empty())
+          continue;
+        auto now = clock_type::now();
+        if (g_recording) {
+          _stats.latency.record(
+              std::chrono::duration_cast<std::chrono::microseconds>(
+                  now - c.inFlight.front())
+                  .count());
+          ++_stats.requests;
+        }
+        c.inFlight.pop_front();
+        if (g_running)
+          sendRequest(c);
+      }
+    }
+  }
+
+  std::vector<Connection> _connections;
+  std::string _request;
+  int _epfd = -1;
+  Stats _stats;
+};
+
+/*
+ * @brief parses the whole text as an integer between min and max.
+ * @return false if it is not one.
+ */
+bool parseNumber(const char *text, const int min, const int max, int &value) {
+  char *end = nullptr;
+  errno = 0;
+  long n = strtol(text, &end, 10);
+  if (end == text || *end != '\0' || errno != 0 || n < min || n > max)
+    return false;
+  value = int(n);
+  return true;
+}
+
+/*
+ * @brief parses the whole text as a number of seconds, at least min.
+ * @return false if it is not one.
+ */
+bool parseSeconds(const char *text, const double min, double &value) {
+  char *end = nullptr;
+  errno = 0;
+  double s = strtod(text, &end);
+  if (end == text || *end != '\0' || errno != 0 || !(s >= min))
+    return false;
+  value = s;
+  return true;
+}
+
+void usage() {
+  std::cout << "./LoadGen host port [options]\n"
+            << "  --connections N: the number of connections (default 16).\n"
+            << "  --threads N: the threads sharing the connections (default "
+               "1).\n"
+            << "  --duration S: the measured time in seconds (default 10).\n"
+            << "  --warmup S: the time before measuring (default 1).\n"
+            << "  --extended: Bind/Execute/Sync of a prepared statement "
+               "instead of simple queries.\n"
+            << "  --pipeline K: the requests in flight per connection "
+               "(default 1).\n"
+            << "  --query SQL: the query (default SELECT 1), see "
+               "MockBackend for the result size and delay tokens."
+            << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    usage();
+    return 1;
+  }
+  g_options.host = argv[1];
+  bool ok = parseNumber(argv[2], 1, 65535, g_options.port);
+  for (int i = 3; ok && i < argc; ++i) {
+    std::string opt(argv[i]);
+    if (opt == "--connections" && i + 1 < argc)
+      ok = parseNumber(argv[++i], 1, INT_MAX, g_options.connections);
+    else if (opt == "--threads" && i + 1 < argc)
+      ok = parseNumber(argv[++i], 1, INT_MAX, g_options.threads);
+    else if (opt == "--duration" && i + 1 < argc)
+      ok = parseSeconds(argv[++i], 0.1, g_options.duration);
+    else if (opt == "--warmup" && i + 1 < argc)
+      ok = parseSeconds(argv[++i], 0, g_options.warmup);
+    else if (opt == "--extended")
+      g_options.extended = true;
+    else if (opt == "--pipeline" && i + 1 < argc)
+      ok = parseNumber(argv[++i], 1, INT_MAX, g_options.pipeline);
+    else if (opt == "--query" && i + 1 < argc)
+      g_options.query = argv[++i];
+    else
+      ok = false;
+  }
+  if (!ok) {
+    usage();
+    return 1;
+  }
+  g_options.threads = std::min(g_options.threads, g_options.connections);
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  for (int t = 0; t < g_options.threads; ++t)
+    workers.push_back(std::make_unique<Worker>(
+        g_options.connections / g_options.threads +
+        (t < g_options.connections % g_options.threads ? 1 : 0)));
+
+  std::atomic<int> failed{0};
+  std::vector<std::thread> threads;
+  for (auto &w : workers)
+    threads.emplace_back([&w, &failed] {
+      try {
+        w->run();
+      } catch (const std::exception &e) {
+        std::cerr << "LoadGen : " << e.what() << std::endl;
+        ++failed;
+        g_running = false;
+      }
+    });
+
+  auto sleep = [](double seconds) {
+    auto end = clock_type::now() + std::chrono::duration<double>(seconds);
+    while (g_running && clock_type::now() < end)
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  };
+  sleep(g_options.warmup);
+  g_recording = true;
+  auto start = clock_type::now();
+  sleep(g_options.duration);
+  g_recording = false;
+  double elapsed =
+      std::chrono::duration<double>(clock_type::now() - start).count();
+  g_running = false;
+  for (auto &t : threads)
+    t.join();
+  if (failed > 0)
+    return 1;
+
+  // the histograms of the threads merge exactly
+  std::vector<uint64_t> buckets(LATENCY_BUCKETS, 0);
+  uint64_t requests = 0, errors = 0, sum = 0;
+  for (auto &w : workers) {
+    auto &s = w->getStats();
+    for (std::size_t i = 0; i < LATENCY_BUCKETS; ++i)
+      buckets[i] += s.latency.getBucket(i);
+    sum += s.latency.getSum();
+    requests += s.requests;
+    errors += s.errors;
+  }
+  auto percentile = [&](double q) {
+    uint64_t rank = std::max<uint64_t>(1, uint64_t(q * requests + 0.999999));
+    uint64_t cumulative = 0;
+    std::size_t i = 0;
+    while (i + 1 < LATENCY_BUCKETS && cumulative + buckets[i] < rank)
+      cumulative += buckets[i++];
+    return LatencyHistogram::getBound(i);
+  };
+
+  std::cout << "connections " << g_options.connections << ", pipeline "
+            << g_options.pipeline << ", "
+            << (g_options.extended ? "extended" : "simple") << " queries\n"
+            << "requests    " << requests << " in " << elapsed << " s ("
+            << uint64_t(requests / elapsed) << " req/s), " << errors
+            << " errors\n";
+  if (requests > 0)
+    std::cout << "latency us  avg " << sum / requests << ", p50 "
+              << percentile(0.5) << ", p99 " << percentile(0.99) << ", p999 "
+              << percentile(0.999) << ", max " << percentile(1) << std::endl;
+  return 0;
+}
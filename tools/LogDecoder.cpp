@@ -0,0 +1,145 @@
+/*
+ * decodes a binary query log (see src/LogFormat.h) back to the text layout
+ * of FileQueryLogger, the files are decoded in the given order as one stream
+ * so the segments of a log can be given all at once (each segment can be
+ * decoded on its own too).
+ *
+ * ./LogDecoder file...
+ */
+
+#include "../src/LogFormat.h"
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+
+class Decoder {
+
+public:
+  Decoder() { fillMessageTypes(_messageTypes); }
+
+  /*
+   * @brief decodes the complete records at the beginning of data and writes
+   * them to out.
+   * @return the number of bytes consumed, the rest is an incomplete record.
+   * @throws std::runtime_error on an invalid record.
+   */
+  std::size_t decode(const char *data, std::size_t len, std::FILE *out) {
+    const char *p = data, *end = data + len;
+
+    while (p < end) {
+      const char *record = p;
+      if (!decodeRecord(p, end, out))
+        return record - data;
+    }
+    return p - data;
+  }
+
+private:
+  bool decodeRecord(const char *&p, const char *end, std::FILE *out) {
+    uint64_t id, len, delta;
+
+    switch (*p++) {
+    case BINARY_LOG_HEADER:
+      if (end - p < 5)
+        return false;
+      if (std::memcmp(p, BINARY_LOG_MAGIC, 4) != 0 ||
+          p[4] != BINARY_LOG_VERSION)
+        throw std::runtime_error("not a binary query log (or bad version)");
+      p += 5;
+      _sessions.clear();
+      _timestamp = 0;
+      return true;
+
+    case BINARY_LOG_SESSION:
+      if (!getVarint(p, end, id) || !getVarint(p, end, len) ||
+          static_cast<uint64_t>(end - p) < len)
+        return false;
+      _sessions[id].assign(p, len);
+      p += len;
+      return true;
+
+    case BINARY_LOG_MESSAGE: {
+      if (!getVarint(p, end, delta) || !getVarint(p, end, id) || p == end)
+        return false;
+      char type = *p++;
+      if (!getVarint(p, end, len) || static_cast<uint64_t>(end - p) < len)
+        return false;
+
+      _timestamp += unzigzag(delta);
+      writeLine(id, type, p, len, out);
+      p += len;
+      return true;
+    }
+
+    default:
+      throw std::runtime_error("invalid record");
+    }
+  }
+
+  void writeLine(uint64_t id, char type, const char *query, std::size_t len,
+                 std::FILE *out) {
+    time_t second = _timestamp / 1000000;
+    if (second != _lastSecond) {
+      std::tm tm_now;
+      localtime_r(&second, &tm_now);
+      std::strftime(_timeStr, sizeof(_timeStr), "%Y-%m-%d\t%X", &tm_now);
+      _lastSecond = second;
+    }
+
+    auto ip = _sessions.find(id);
+    std::fprintf(out, "%s\t\t-\tIP: %s\t-\tclient %llu: (%s)\t\t", _timeStr,
+                 ip == _sessions.end() ? "unknown" : ip->second.c_str(),
+                 static_cast<unsigned long long>(id),
+                 _messageTypes[(unsigned char)type].c_str());
+    std::fwrite(query, 1, len, out);
+    std::fputc('\n', out);
+  }
+
+  std::array<std::string, 256> _messageTypes;
+  std::unordered_map<uint64_t, std::string> _sessions;
+  int64_t _timestamp = 0;
+  time_t _lastSecond = -1;
+  char _timeStr[32];
+};
+
+int main(int argc, char **argv) {
+
+  if (argc < 2) {
+    std::cout << "./LogDecoder file...\n"
+              << "decodes the binary query logs (--log-format binary) to the "
+                 "text format, the files are read in order as one log."
+              << std::endl;
+    return 1;
+  }
+
+  Decoder decoder;
+  std::string buffer;
+  std::array<char, 1 << 16> chunk;
+
+  try {
+    for (int i = 1; i < argc; ++i) {
+      std::ifstream in(argv[i], std::ios::binary);
+      if (!in.is_open())
+        throw std::runtime_error(std::string("could not open ") + argv[i]);
+
+      while (in.read(chunk.data(), chunk.size()) || in.gcount() > 0) {
+        buffer.append(chunk.data(), in.gcount());
+        buffer.erase(0, decoder.decode(buffer.data(), buffer.size(), stdout));
+      }
+    }
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  if (!buffer.empty()) {
+    std::cerr << "the log ends with an incomplete record" << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,103 @@
+/*
+ * restores a query log written with --log-compress (see src/Compression.h)
+ * to stdout, the files are read in the given order as one stream so the
+ * segments of a log can be given all at once. the frames are independent:
+ * a corrupted one is reported and skipped up to the next frame.
+ *
+ * ./LogDecompress file... [| ./LogDecoder /dev/stdin]
+ */
+
+#include "../src/Compression.h"
+#include <arpa/inet.h>
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+namespace {
+
+/*
+ * @brief restores the complete frames at the beginning of data to out.
+ *
+ * @param last : no more data will come, an incomplete frame is corrupted.
+ * @return the number of bytes consumed.
+ */
+std::size_t decompress(const std::string &data, bool last, std::string &out,
+                       std::size_t &corrupted) {
+  const char *p = data.data(), *end = data.data() + data.size();
+
+  while (end - p >= COMPRESSED_FRAME_HEADER) {
+    uint32_t storedSize;
+    std::memcpy(&storedSize, p + 8, 4);
+    storedSize = ntohl(storedSize) & ~COMPRESSED_BLOCK_RAW;
+    bool valid = std::memcmp(p, COMPRESSED_LOG_MAGIC, 4) == 0 &&
+                 storedSize <= compressBound(COMPRESS_BLOCK_SIZE);
+    if (valid && static_cast<std::size_t>(end - p) <
+                     COMPRESSED_FRAME_HEADER + storedSize &&
+        !last)
+      break; // wait for the rest of the frame
+
+    if (valid && decompressFrame(p, end, out))
+      continue;
+
+    // skip to the next magic
+    const char *next = static_cast<const char *>(
+        memmem(p + 1, end - p - 1, COMPRESSED_LOG_MAGIC, 4));
+    if (next == nullptr)
+      next = last ? end : std::max(p + 1, end - 3);
+    corrupted += next - p;
+    p = next;
+  }
+  if (last) {
+    corrupted += end - p;
+    p = end;
+  }
+  return p - data.data();
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+
+  if (argc < 2) {
+    std::cout << "./LogDecompress file...\n"
+              << "restores the compressed query logs (--log-compress) to "
+                 "stdout, the files are read in order as one log."
+              << std::endl;
+    return 1;
+  }
+
+  std::string buffer, out;
+  std::size_t corrupted = 0;
+  std::array<char, 1 << 16> chunk;
+
+  for (int i = 1; i < argc; ++i) {
+    std::ifstream in(argv[i], std::ios::binary);
+    if (!in.is_open()) {
+      std::cerr << "could not open " << argv[i] << std::endl;
+      return 1;
+    }
+
+    while (in.read(chunk.data(), chunk.size()) || in.gcount() > 0) {
+      buffer.append(chunk.data(), in.gcount());
+      out.clear();
+      buffer.erase(0, decompress(buffer, false, out, corrupted));
+      if (std::fwrite(out.data(), 1, out.size(), stdout) != out.size()) {
+        std::cerr << "write error" << std::endl;
+        return 1;
+      }
+    }
+  }
+  out.clear();
+  decompress(buffer, true, out, corrupted);
+  std::fwrite(out.data(), 1, out.size(), stdout);
+  std::fflush(stdout);
+
+  if (corrupted > 0) {
+    std::cerr << corrupted << " corrupted bytes were skipped" << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,403 @@
+/*
+ * microbenchmarks of the hot paths of the proxy, no dependency and no
+ * database: the framing of the requests, FileQueryLogger::log() by message
+ * type and query size, the session buffers (IOBuffer and Client) drained by
+ * partial writes, the dispatch of an event to its session for 10, 1k and
+ * 10k clients, the compression of a text query log and the lookup of a
+ * query in the result cache.
+ *
+ * each benchmark is calibrated (that first run is the warmup) to last at
+ * least --min-time then repeated, the median and the best run are reported
+ * in ns per operation, with the throughput for the ones that move bytes.
+ *
+ * ./MicroBench [--filter SUBSTRING] [--repeat N] [--min-time MS] [--log PATH]
+ */
+
+#include "../src/BufferPool.h"
+#include "../src/Client.h"
+#include "../src/Compression.h"
+#include "../src/IOBuffer.h"
+#include "../src/Logger.h"
+#include "../src/MessageFramer.h"
+#include "../src/ResultCache.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+struct Options {
+  std::string filter;
+  int repeat = 5;
+  long minTimeMs = 50;
+  std::string logPath = "/dev/null";
+};
+
+Options g_options;
+
+// keeps the compiler from removing a computation whose result is unused
+template <class T> inline void doNotOptimize(const T &value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+/*
+ * @brief runs body(n) (n operations) until a run lasts --min-time, then
+ * --repeat more runs of the same n, and prints the median and best ns/op.
+ *
+ * @param bytes : the bytes moved by one operation (0 if not relevant).
+ */
+void bench(const std::string &name, std::size_t bytes,
+           const std::function<void(std::size_t)> &body) {
+  if (!g_options.filter.empty() &&
+      name.find(g_options.filter) == std::string::npos)
+    return;
+
+  using clock = std::chrono::steady_clock;
+  auto run = [&](std::size_t n) {
+    auto start = clock::now();
+    body(n);
+    return std::chrono::duration<double, std::nano>(clock::now() - start)
+        .count();
+  };
+
+  // calibration, also the warmup (caches, pools, page faults)
+  std::size_t n = 1;
+  while (run(n) < g_options.minTimeMs * 1e6 && n < (std::size_t(1) << 40))
+    n *= 2;
+
+  std::vector<double> perOp;
+  for (int r = 0; r < g_options.repeat; ++r)
+    perOp.push_back(run(n) / n);
+  std::sort(perOp.begin(), perOp.end());
+  double median = perOp[perOp.size() / 2];
+
+  std::printf("%-36s %12.1f %12.1f", name.c_str(), median, perOp.front());
+  if (bytes > 0)
+    std::printf(" %12.1f", bytes / median * 1e9 / (1024 * 1024));
+  std::printf("\n");
+}
+
+std::string message(char type, std::string_view body) {
+  std::string m(1, type);
+  uint32_t len = htonl(uint32_t(body.size() + 4));
+  m.append(reinterpret_cast<const char *>(&len), sizeof(len));
+  m.append(body);
+  return m;
+}
+
+std::string startupMessage() {
+  std::string body("\0\3\0\0user\0bench\0\0", 17);
+  uint32_t len = htonl(uint32_t(body.size() + 4));
+  return std::string(reinterpret_cast<const char *>(&len), sizeof(len)) +
+         body;
+}
+
+// a query of about size bytes
+std::string query(std::size_t size) {
+  std::string q = "SELECT c FROM sbtest1 WHERE id = 42";
+  while (q.size() < size)
+    q += " OR id = " + std::to_string(q.size());
+  q.resize(size);
+  return q;
+}
+
+// a request of the given type holding a query of size bytes
+std::string request(char type, std::size_t size) {
+  switch (type) {
+  case 'Q':
+    return message('Q', query(size) + '\0');
+  case 'P':
+    // unnamed statement, no parameter type
+    return message('P', '\0' + query(size) + '\0' + std::string(2, '\0'));
+  default:
+    return message(type, std::string());
+  }
+}
+
+/*
+ * @brief a pooled client (it has no connection to open) on one end of a
+ * socket pair, for the code paths that do not touch the sockets.
+ */
+Client::pointer makeClient(BufferPool &pool) {
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+    throw std::runtime_error(strerror(errno));
+  close(fds[1]);
+  auto c = std::make_shared<Client>(fds[0], "127.0.0.1", "127.0.0.1", 5432,
+                                    pool, false, true);
+  c->receivedFromClient(startupMessage());
+  c->sentToRemote(startupMessage().size());
+  return c;
+}
+
+void benchFraming() {
+  for (std::size_t size : {32, 256, 4096}) {
+    // a read holding 16 queries
+    std::string data;
+    for (int i = 0; i < 16; ++i)
+      data += request('Q', size);
+
+    MessageFramer framer(false);
+    std::vector<PgMessage> out;
+    bench("frame/Q/" + std::to_string(size) + "x16", data.size(),
+          [&](std::size_t n) {
+            for (std::size_t i = 0; i < n; ++i) {
+              framer.feed(data, out);
+              doNotOptimize(out.data());
+            }
+          });
+
+    // the same read split in two in the middle of a message
+    std::string_view first(data.data(), data.size() / 2 + 3);
+    std::string_view second(data.data() + first.size(),
+                            data.size() - first.size());
+    bench("frame/Q/" + std::to_string(size) + "x16/split", data.size(),
+          [&](std::size_t n) {
+            for (std::size_t i = 0; i < n; ++i) {
+              framer.feed(first, out);
+              framer.feedMore(second, out);
+              doNotOptimize(out.data());
+            }
+          });
+  }
+}
+
+void benchLogger() {
+  BufferPool pool;
+  FileQueryLogger logger(g_options.logPath, true);
+
+  for (char type : {'Q', 'P', 'S'}) {
+    for (std::size_t size : {32, 256, 4096}) {
+      // the messages logged are the ones of the last read
+      auto c = makeClient(pool);
+      std::string data = request(type, size);
+      c->receivedFromClient(data);
+
+      bench(std::string("log/") + type + "/" +
+                std::to_string(type == 'S' ? 0 : size),
+            data.size(), [&](std::size_t n) {
+              for (std::size_t i = 0; i < n; ++i)
+                logger.log(c);
+            });
+      if (type == 'S')
+        break;
+    }
+  }
+}
+
+void benchBuffers() {
+  BufferPool pool;
+  iovec iov[SEND_IOV_MAX];
+
+  for (std::size_t size : {512, 16384, 262144}) {
+    std::string data(size, 'x');
+
+    // the socket takes 60% of what is queued, then the rest
+    IOBuffer buffer(pool);
+    bench("iobuffer/" + std::to_string(size) + "/partial", size,
+          [&](std::size_t n) {
+            for (std::size_t i = 0; i < n; ++i) {
+              buffer.append(data.data(), data.size());
+              while (!buffer.empty()) {
+                int count = buffer.peek(iov, SEND_IOV_MAX);
+                std::size_t total = 0;
+                for (int j = 0; j < count; ++j)
+                  total += iov[j].iov_len;
+                buffer.consume(std::max<std::size_t>(total * 6 / 10, 1));
+              }
+            }
+          });
+
+    // the same through the client (framing and request tracking included),
+    // CopyData messages since they wait for no answer
+    auto c = makeClient(pool);
+    std::string copyData = message('d', data);
+    bench("client/requests/" + std::to_string(size) + "/partial",
+          copyData.size(), [&](std::size_t n) {
+            for (std::size_t i = 0; i < n; ++i) {
+              c->receivedFromClient(copyData);
+              while (c->hasPendingRequest()) {
+                int count = c->peekRequests(iov, SEND_IOV_MAX);
+                std::size_t total = 0;
+                for (int j = 0; j < count; ++j)
+                  total += iov[j].iov_len;
+                c->sentToRemote(std::max<std::size_t>(total * 6 / 10, 1));
+              }
+            }
+          });
+  }
+}
+
+void benchDispatch() {
+  // the session of each socket, found from the fd of an event
+  struct Session {
+    uint64_t events = 0;
+  };
+
+  for (std::size_t clients : {10, 1000, 10000}) {
+    // two sockets per client, the fds are dense (the kernel hands out the
+    // lowest free one)
+    std::size_t fds = 2 * clients + 8;
+    std::vector<Session> sessions(clients);
+    std::vector<int> order(4096);
+    std::mt19937 rng(42);
+    for (auto &fd : order)
+      fd = 8 + rng() % (fds - 8);
+
+    // the fd table of ServerEpoll
+    std::vector<Session *> table(fds, nullptr);
+    for (std::size_t fd = 8; fd < fds; ++fd)
+      table[fd] = &sessions[(fd - 8) / 2];
+    bench("dispatch/fdtable/" + std::to_string(clients), 0,
+          [&](std::size_t n) {
+            for (std::size_t i = 0; i < n; ++i)
+              ++table[order[i & 4095]]->events;
+          });
+
+    // a hash map by fd, like the session map of ServerIoUring (by id)
+    std::unordered_map<int, Session *> map;
+    for (std::size_t fd = 8; fd < fds; ++fd)
+      map[fd] = &sessions[(fd - 8) / 2];
+    bench("dispatch/hashmap/" + std::to_string(clients), 0,
+          [&](std::size_t n) {
+            for (std::size_t i = 0; i < n; ++i)
+              ++map.find(order[i & 4095])->second->events;
+          });
+    doNotOptimize(sessions.data());
+  }
+}
+
+void benchCompression() {
+  // a block of a text query log, the queries differ by their literals
+  std::string log;
+  std::mt19937 rng(42);
+  while (log.size() < COMPRESS_BLOCK_SIZE) {
+    log += "2024-05-17\t12:34:" + std::to_string(10 + rng() % 50) +
+           "\t\t-\tIP: 10.0.0." + std::to_string(rng() % 255) +
+           "\t-\tclient " + std::to_string(rng() % 1000) +
+           ": (simple query)\t\tSELECT c FROM sbtest" +
+           std::to_string(rng() % 16) +
+           " WHERE id = " + std::to_string(rng()) + "\n";
+  }
+  log.resize(COMPRESS_BLOCK_SIZE);
+
+  std::vector<uint32_t> table(COMPRESS_TABLE_SIZE);
+  std::string compressed(compressBound(log.size()), '\0');
+  std::size_t size =
+      compressBlock(log.data(), log.size(), compressed.data(), table.data());
+  bench("compress/textlog", log.size(), [&](std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i)
+      size = compressBlock(log.data(), log.size(), compressed.data(),
+                           table.data());
+  });
+
+  std::string restored(log.size(), '\0');
+  bench("decompress/textlog", log.size(), [&](std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i)
+      if (!decompressBlock(compressed.data(), size, restored.data(),
+                           restored.size()))
+        throw std::runtime_error("the block does not decompress");
+  });
+  if (!decompressBlock(compressed.data(), size, restored.data(),
+                       restored.size()) ||
+      restored != log)
+    throw std::runtime_error("the block is not restored");
+  if (!g_options.filter.empty() &&
+      std::string("compress/textlog/ratio").find(g_options.filter) ==
+          std::string::npos)
+    return;
+  std::printf("%-36s %12.2f\n", "compress/textlog/ratio",
+              double(log.size()) / size);
+}
+
+void benchResultCache() {
+  ResultCacheOptions options;
+  options.tables = {"countries", "currencies"};
+  ResultCache cache(options);
+  std::string session("bench\0bench", 11), key;
+  std::string allowed = "SELECT c.name, x.code FROM countries c JOIN "
+                        "currencies x ON x.id = c.currency WHERE c.id = 42";
+  std::string other = query(allowed.size());
+
+  bench("cache/key/allowed", 0, [&](std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i)
+      doNotOptimize(cache.makeKey(session, allowed, key));
+  });
+  bench("cache/key/other", 0, [&](std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i)
+      doNotOptimize(cache.makeKey(session, other, key));
+  });
+
+  // a response of 10 rows
+  std::string response = message('T', std::string(40, 'r'));
+  for (int i = 0; i < 10; ++i)
+    response += message('D', std::string(60, 'd'));
+  response += message('C', "SELECT 10") + message('Z', "I");
+  std::vector<std::string> keys;
+  for (int i = 0; i < 1000; ++i) {
+    cache.makeKey(session, allowed + std::to_string(i), key);
+    cache.insert(key, response);
+    keys.push_back(key);
+  }
+  bench("cache/hit", response.size(), [&](std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i)
+      doNotOptimize(cache.find(keys[i % keys.size()]));
+  });
+}
+
+void usage() {
+  std::cout << "./MicroBench [options]\n"
+            << "  --filter SUBSTRING: only the benchmarks whose name holds "
+               "it (frame, log, iobuffer, client, dispatch, compress, cache).\n"
+            << "  --repeat N: the measured runs of each benchmark (default "
+               "5).\n"
+            << "  --min-time MS: the minimum duration of a run (default 50).\n"
+            << "  --log PATH: the file FileQueryLogger writes to (default "
+               "/dev/null)."
+            << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  for (int i = 1; i < argc; ++i) {
+    std::string opt(argv[i]);
+    if (opt == "--filter" && i + 1 < argc)
+      g_options.filter = argv[++i];
+    else if (opt == "--repeat" && i + 1 < argc)
+      g_options.repeat = std::max(atoi(argv[++i]), 1);
+    else if (opt == "--min-time" && i + 1 < argc)
+      g_options.minTimeMs = std::max(atol(argv[++i]), 1L);
+    else if (opt == "--log" && i + 1 < argc)
+      g_options.logPath = argv[++i];
+    else {
+      usage();
+      return 1;
+    }
+  }
+
+  try {
+    std::printf("%-36s %12s %12s %12s\n", "benchmark", "ns/op (med)",
+                "ns/op (min)", "MiB/s (med)");
+    benchFraming();
+    benchLogger();
+    benchBuffers();
+    benchDispatch();
+    benchCompression();
+    benchResultCache();
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
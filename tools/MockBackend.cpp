@@ -0,0 +1,418 @@
+/*
+ * a minimal postgresql backend for the benchmarks of the proxy: it accepts
+ * any user without a password (answers the SSLRequest with 'N'), then answers
+ * the simple queries and the extended protocol (Parse, Bind, Describe,
+ * Execute, Close, Flush, Sync) with a result of one text column.
+ *
+ * the size of the results and the time the backend takes are set on the
+ * command line and can be changed per query with tokens in its text, e.g.
+ * "SELECT 'rows=100 size=200 delay_us=5000'". BEGIN, COMMIT and
+ * ROLLBACK set the transaction status of ReadyForQuery.
+ *
+ * one thread per connection, the backend is meant to be faster than the
+ * proxy and simple, not to scale like it.
+ *
+ * ./MockBackend port [--rows N] [--size BYTES] [--delay-us US]
+ */
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+
+#include "../src/MessageFramer.h"
+
+namespace {
+
+// the result of a query
+struct Result {
+  long rows = 1;
+  long size = 16;   // the bytes of the value of each row
+  long delayUs = 0; // the time spent before answering
+};
+
+Result g_defaults;
+
+// the output is sent when a ReadyForQuery or a Flush ends it, or once it
+// holds this much
+constexpr std::size_t FLUSH_SIZE = 64 * 1024;
+
+class Session {
+
+public:
+  explicit Session(int fd) : _fd(fd) {}
+  ~Session() { close(_fd); }
+
+  void run() {
+    if (!startup())
+      return;
+
+    char type;
+    std::string body;
+    while (readMessage(type, body)) {
+      switch (type) {
+      case 'Q':
+        query(body.substr(0, body.find('\0')));
+        if (!flush())
+          return;
+        break;
+      case 'P': {
+        // statement name, query, parameter types
+        std::string name = body.substr(0, body.find('\0'));
+        std::string text = body.substr(name.size() + 1);
+        _statements[name] = text.substr(0, text.find('\0'));
+        append('1', std::string_view());
+        break;
+      }
+      case 'B': {
+        // portal name, statement name, ...
+        std::string portal = body.substr(0, body.find('\0'));
+        std::string rest = body.substr(portal.size() + 1);
+        _portals[portal] = _statements[rest.substr(0, rest.find('\0'))];
+        append('2', std::string_view());
+        break;
+      }
+      case 'D':
+        // no parameter, the statement has the same columns as its portals
+        if (!body.empty() && body[0] == 'S')
+          append('t', std::string(2, '\0'));
+        rowDescription();
+        break;
+      case 'E': {
+        std::string portal = body.substr(0, body.find('\0'));
+        execute(_portals[portal], false);
+        break;
+      }
+      case 'C':
+        append('3', std::string_view());
+        break;
+      case 'H':
+        if (!flush())
+          return;
+        break;
+      case 'S':
+        readyForQuery();
+        if (!flush())
+          return;
+        break;
+      case 'X':
+        return;
+      default:
+        // the other messages (CopyData, FunctionCall ...) are not supported
+        error("0A000", "message type not supported by the mock backend");
+        break;
+      }
+      if (_out.size() >= FLUSH_SIZE && !flush())
+        return;
+    }
+  }
+
+private:
+  bool startup() {
+    std::string body;
+    while (true) {
+      char header[4];
+      if (!readAll(header, 4))
+        return false;
+      uint32_t len = readInt32(header);
+      if (len < 8 || len > 10000)
+        return false;
+      body.resize(len - 4);
+      if (!readAll(body.data(), body.size()))
+        return false;
+
+      uint32_t code = readInt32(body.data());
+      if (code == SSL_REQUEST_CODE || code == GSSENC_REQUEST_CODE) {
+        // no encryption, the client goes on in clear text
+        if (send(_fd, "N", 1, MSG_NOSIGNAL) != 1)
+          return false;
+        continue;
+      }
+      if (code == CANCEL_REQUEST_CODE)
+        return false;
+      break;
+    }
+
+    append('R', std::string(4, '\0')); // AuthenticationOk
+    parameterStatus("server_version", "16.0");
+    parameterStatus("server_encoding", "UTF8");
+    parameterStatus("client_encoding", "UTF8");
+    parameterStatus("DateStyle", "ISO, MDY");
+    parameterStatus("integer_datetimes", "on");
+    parameterStatus("standard_conforming_strings", "on");
+    std::string key(8, '\0');
+    uint32_t pid = htonl(uint32_t(getpid())), secret = htonl(uint32_t(_fd));
+    std::memcpy(key.data(), &pid, 4);
+    std::memcpy(key.data() + 4, &secret, 4);
+    append('K', key);
+    readyForQuery();
+    return flush();
+  }
+
+  void query(const std::string &text) {
+    if (text.find_first_not_of(" \t\r\n;") == std::string::npos) {
+      append('I', std::string_view()); // EmptyQueryResponse
+    } else {
+      execute(text, true);
+    }
+    readyForQuery();
+  }
+
+  /*
+   * @brief answers a query: the transaction commands change the status, the
+   * others return the rows of their result.
+   */
+  void execute(const std::string &text, bool describe) {
+    std::size_t start = text.find_first_not_of(" \t\r\n");
+    std::string command =
+        start == std::string::npos ? std::string() : text.substr(start);
+    for (auto &ch : command)
+      ch = char(toupper(static_cast<unsigned char>(ch)));
+
+    for (const char *tx : {"BEGIN", "START", "COMMIT", "END", "ROLLBACK"}) {
+      if (command.compare(0, std::strlen(tx), tx) != 0)
+        continue;
+      _status = tx[0] == 'B' || tx[0] == 'S' ? 'T' : 'I';
+      commandComplete(tx[0] == 'S' ? "START TRANSACTION" : tx);
+      return;
+    }
+
+    Result result = parse(text);
+    if (result.delayUs > 0) {
+      // the buffered output goes first, like a server working on the query
+      flush();
+      std::this_thread::sleep_for(std::chrono::microseconds(result.delayUs));
+    }
+    if (describe)
+      rowDescription();
+
+    std::string row(2 + 4, '\0');
+    uint16_t columns = htons(1);
+    uint32_t len = htonl(uint32_t(result.size));
+    std::memcpy(row.data(), &columns, 2);
+    std::memcpy(row.data() + 2, &len, 4);
+    row.append(std::size_t(result.size), 'x');
+    for (long i = 0; i < result.rows; ++i) {
+      append('D', row);
+      if (_out.size() >= FLUSH_SIZE)
+        flush();
+    }
+    commandComplete("SELECT " + std::to_string(result.rows));
+  }
+
+  // the defaults changed by the rows=, size= and delay_us= tokens of a query
+  static Result parse(std::string_view text) {
+    Result result = g_defaults;
+    auto token = [&](const char *name, long &value) {
+      std::size_t pos = text.find(name);
+      if (pos != std::string_view::npos)
+        value = std::max(
+            0L, atol(std::string(text.substr(pos + strlen(name), 20)).c_str()));
+    };
+    token("rows=", result.rows);
+    token("size=", result.size);
+    token("delay_us=", result.delayUs);
+    return result;
+  }
+
+  void rowDescription() {
+    // one text column named c
+    std::string body(2, '\0');
+    uint16_t columns = htons(1);
+    std::memcpy(body.data(), &columns, 2);
+    body.append("c", 2);
+    std::string field(18, '\0');
+    uint32_t textOid = htonl(25);
+    int16_t size = htons(-1);
+    int32_t modifier = htonl(-1);
+    std::memcpy(field.data() + 6, &textOid, 4);
+    std::memcpy(field.data() + 10, &size, 2);
+    std::memcpy(field.data() + 12, &modifier, 4);
+    append('T', body + field);
+  }
+
+  void parameterStatus(const char *name, const char *value) {
+    std::string body(name);
+    body.push_back('\0');
+    body.append(value).push_back('\0');
+    append('S', body);
+  }
+
+  void commandComplete(const std::string &tag) {
+    append('C', std::string_view(tag.c_str(), tag.size() + 1));
+  }
+
+  void error(const char *code, const char *message) {
+    std::string body("SERROR\0VERROR\0C", 15);
+    body.append(code).push_back('\0');
+    body.append("M").append(message).push_back('\0');
+    body.push_back('\0');
+    append('E', body);
+  }
+
+  void readyForQuery() { append('Z', std::string_view(&_status, 1)); }
+
+  void append(char type, std::string_view body) {
+    _out.push_back(type);
+    uint32_t len = htonl(uint32_t(body.size() + 4));
+    _out.append(reinterpret_cast<const char *>(&len), 4);
+    _out.append(body);
+  }
+
+  bool flush() {
+    std::size_t sent = 0;
+    while (sent < _out.size()) {
+      ssize_t len =
+          send(_fd, _out.data() + sent, _out.size() - sent, MSG_NOSIGNAL);
+      if (len < 0 && errno == EINTR)
+        continue;
+      if (len <= 0)
+        return false;
+      sent += len;
+    }
+    _out.clear();
+    return true;
+  }
+
+  bool readMessage(char &type, std::string &body) {
+    char header[5];
+    if (!readAll(header, 5))
+      return false;
+    type = header[0];
+    uint32_t len = readInt32(header + 1);
+    if (len < 4)
+      return false;
+    body.resize(len - 4);
+    return readAll(body.data(), body.size());
+  }
+
+  bool readAll(char *p, std::size_t len) {
+    // buffered, most messages are smaller than a read
+    while (len > 0) {
+      if (_inPos == _in.size()) {
+        _in.resize(65536);
+        ssize_t n = recv(_fd, _in.data(), _in.size(), 0);
+        if (n < 0 && errno == EINTR)
+          continue;
+        if (n <= 0)
+          return false;
+        _in.resize(n);
+        _inPos = 0;
+      }
+      std::size_t n = std::min(len, _in.size() - _inPos);
+      std::memcpy(p, _in.data() + _inPos, n);
+      _inPos += n;
+      p += n;
+      len -= n;
+    }
+    return true;
+  }
+
+  static uint32_t readInt32(const char *p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return ntohl(v);
+  }
+
+  int _fd;
+  char _status = 'I';
+  std::string _in;
+  std::size_t _inPos = 0;
+  std::string _out;
+  std::unordered_map<std::string, std::string> _statements;
+  std::unordered_map<std::string, std::string> _portals;
+};
+
+/*
+ * @brief parses the whole text as an integer between min and max.
+ * @return false if it is not one.
+ */
+bool parseNumber(const char *text, const long min, const long max,
+                 long &value) {
+  char *end = nullptr;
+  errno = 0;
+  long n = strtol(text, &end, 10);
+  if (end == text || *end != '\0' || errno != 0 || n < min || n > max)
+    return false;
+  value = n;
+  return true;
+}
+
+void usage() {
+  std::cout << "./MockBackend port [options]\n"
+            << "  --rows N: the rows of each result (default 1).\n"
+            << "  --size BYTES: the size of the value of each row (default "
+               "16).\n"
+            << "  --delay-us US: the time taken by each query (default 0).\n"
+            << "a query can change them with rows=N, size=N and delay_us=N "
+               "in its text."
+            << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    usage();
+    return 1;
+  }
+  long port = 0;
+  bool ok = parseNumber(argv[1], 1, 65535, port);
+  for (int i = 2; ok && i < argc; ++i) {
+    std::string opt(argv[i]);
+    if (opt == "--rows" && i + 1 < argc)
+      ok = parseNumber(argv[++i], 0, LONG_MAX, g_defaults.rows);
+    else if (opt == "--size" && i + 1 < argc)
+      ok = parseNumber(argv[++i], 0, LONG_MAX, g_defaults.size);
+    else if (opt == "--delay-us" && i + 1 < argc)
+      ok = parseNumber(argv[++i], 0, LONG_MAX, g_defaults.delayUs);
+    else
+      ok = false;
+  }
+  if (!ok) {
+    usage();
+    return 1;
+  }
+  signal(SIGPIPE, SIG_IGN);
+
+  int sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  int on = 1;
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (sock < 0 ||
+      setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0 ||
+      bind(sock, (const sockaddr *)&addr, sizeof(addr)) < 0 ||
+      listen(sock, 4096) < 0) {
+    std::cerr << "MockBackend : " << strerror(errno) << std::endl;
+    return 1;
+  }
+  std::cout << "MockBackend listening on port " << port << std::endl;
+
+  while (true) {
+    int fd = accept4(sock, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      std::cerr << "accept : " << strerror(errno) << std::endl;
+      return 1;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    std::thread([fd] { Session(fd).run(); }).detach();
+  }
+}